@@ -18,6 +18,7 @@
 #include <nav_msgs/Odometry.h>
 #include <geometry_msgs/PointStamped.h>
 #include <std_msgs/Empty.h>
+#include <atomic>
 
 namespace kino_planner
 {
@@ -32,6 +33,16 @@ private:
   bool searchForTraj(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,  
                      Vector3d end_pos, Vector3d end_vel, Vector3d end_acc, 
                      double search_time);
+  void prepareSearch(const Vector3d& start_pos, const Vector3d& end_pos);
+  bool finishSearch(int result);
+  void postProcessTraj(double traj_use_time);
+  /*
+   * anytime: connect a refined solution of the background search
+   * to the trajectory being flown, fails if the joined traj is not feasible
+   */
+  bool spliceRefinement(const Trajectory& refined, const ros::Time& splice_time, Trajectory& joined);
+  void pollRefinement();
+  void stopRefining();
   void sendTrajToServer(const Trajectory& poly_traj);
   void sendEStopToServer();
   bool reachGoal(double radius);
@@ -41,7 +52,7 @@ private:
    * replan in t second from current state
    */
   bool replanOnce(double t);
-  bool optimize();
+  bool optimize(const Trajectory& traj);
 
   // map, checker, planner 
   OccMap::Ptr env_ptr_;
@@ -49,6 +60,7 @@ private:
   KRRTPlanner::KRRTPlannerPtr krrt_planner_ptr_;
   BIKRRT::BIKRRTPtr bikrrt_ptr_;
   TrajOptimizer::Ptr optimizer_ptr_;
+  TrajOptimizer::Ptr regional_optimizer_ptr_; // used by the search thread
   VisualRviz::Ptr vis_ptr_;
   shared_ptr<R3Planner> r3_planer_ptr_;
   shared_ptr<AstarPathFinder> astar_searcher_;
@@ -80,10 +92,15 @@ private:
   double vel_limit_, acc_limit_;
   bool track_err_replan_, allow_track_err_replan_, close_goal_traj_, use_r3_;
   bool new_goal_, started_, use_optimization_, replan_, bidirection_;
+  bool anytime_, searching_, refining_;
+  std::atomic<bool> new_solution_; // set by the search thread
+  ros::Time search_start_time_, search_origin_time_;
+  double first_solution_time_, committed_cost_;
   double replan_time_;
   Eigen::Vector3d start_pos_, start_vel_, start_acc_, end_pos_, end_vel_, end_acc_;
   ros::Time curr_traj_start_time_, collision_detect_time_;
   Trajectory front_end_traj_, back_end_traj_, traj_;
+  Trajectory::Cursor traj_cursor_; // follows the expected state along traj_
   Eigen::Vector3d pos_about_to_collide_;
   double remain_safe_time_, e_stop_time_margin_, replan_check_duration_;
 };
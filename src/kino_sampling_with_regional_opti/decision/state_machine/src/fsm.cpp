@@ -25,6 +25,11 @@ namespace kino_planner
     optimizer_ptr_->setVisualizer(vis_ptr_);
     optimizer_ptr_->setSearcher(astar_searcher_);
 
+    regional_optimizer_ptr_.reset(new TrajOptimizer(nh));
+    regional_optimizer_ptr_->setPosChecker(pos_checker_ptr_);
+    regional_optimizer_ptr_->setVisualizer(vis_ptr_);
+    regional_optimizer_ptr_->setSearcher(astar_searcher_);
+
     r3_planer_ptr_.reset(new R3Planner(nh, pos_checker_ptr_));
 
     // krrt_planner_ptr_.reset(new BIKRRT(nh));
@@ -39,8 +44,9 @@ namespace kino_planner
     bikrrt_ptr_->init(nh);
     bikrrt_ptr_->setPosChecker(pos_checker_ptr_);
     bikrrt_ptr_->setVisualizer(vis_ptr_);
-    bikrrt_ptr_->setRegionalOptimizer(optimizer_ptr_);
+    bikrrt_ptr_->setRegionalOptimizer(regional_optimizer_ptr_);
     bikrrt_ptr_->setSearcher(astar_searcher_);
+    bikrrt_ptr_->setSolutionCallback([this](const Trajectory &, double) { new_solution_ = true; });
 
     goal_sub_ = nh_.subscribe("/goal", 1, &FSM::goalCallback, this);
     traj_pub_ = nh_.advertise<quadrotor_msgs::PolynomialTrajectory>("planning/poly_traj", 10);
@@ -57,15 +63,22 @@ namespace kino_planner
     nh.param("fsm/vel_limit", vel_limit_, 0.0);
     nh.param("fsm/acc_limit", acc_limit_, 0.0);
     nh.param("fsm/use_r3", use_r3_, false);
+    nh.param("fsm/anytime", anytime_, false);
+    nh.param("fsm/first_solution_time", first_solution_time_, replan_time_);
     ROS_WARN_STREAM("[fsm] param: use_optimization: " << use_optimization_);
     ROS_WARN_STREAM("[fsm] param: replan: " << replan_);
     ROS_WARN_STREAM("[fsm] param: replan_time: " << replan_time_);
     ROS_WARN_STREAM("[fsm] param: allow_track_err_replan: " << allow_track_err_replan_);
     ROS_WARN_STREAM("[fsm] param: e_stop_time_margin: " << e_stop_time_margin_);
     ROS_WARN_STREAM("[fsm] param: replan_check_duration: " << replan_check_duration_);
+    ROS_WARN_STREAM("[fsm] param: anytime: " << anytime_);
+    ROS_WARN_STREAM("[fsm] param: first_solution_time: " << first_solution_time_);
 
     track_err_replan_ = false;
     new_goal_ = false;
+    searching_ = false;
+    refining_ = false;
+    new_solution_ = false;
     machine_state_ = INIT;
     curr_traj_start_time_ = ros::Time::now();
     pos_about_to_collide_ << 0.0, 0.0, 0.0;
@@ -154,12 +167,57 @@ namespace kino_planner
 
     case GENERATE_TRAJ:
     {
-      ROS_INFO("!!!generate traj!!!");
-      bool success = searchForTraj(start_pos_, start_vel_, start_acc_, end_pos_, end_vel_, end_acc_, replan_time_); 
+      bool success(false);
+      if (anytime_)
+      {
+        /* search in background and keep this callback at its own rate, 
+           commit the best traj once first_solution_time_ is used up (or as soon as 
+           one is found after that) and keep refining it while following */
+        if (!searching_)
+        {
+          stopRefining();
+          ROS_INFO("!!!generate traj!!!");
+          prepareSearch(start_pos_, end_pos_);
+          bikrrt_ptr_->reset();
+          new_solution_ = false;
+          if (!bikrrt_ptr_->planAsync(start_pos_, start_vel_, start_acc_, end_pos_, end_vel_, end_acc_, replan_time_))
+            return;
+          searching_ = true;
+          search_start_time_ = ros::Time::now();
+          return;
+        }
+        Trajectory best_traj;
+        double best_cost(0.0);
+        bool planning = bikrrt_ptr_->isPlanning();
+        if (planning && (!new_solution_ || (ros::Time::now() - search_start_time_).toSec() < first_solution_time_))
+        {
+          return;
+        }
+        searching_ = false;
+        new_solution_ = false;
+        if (planning && bikrrt_ptr_->getBestTraj(best_traj, best_cost))
+        {
+          traj_ = best_traj;
+          committed_cost_ = best_cost;
+          postProcessTraj((ros::Time::now() - search_start_time_).toSec());
+          refining_ = true;
+          success = true;
+        }
+        else
+        {
+          success = finishSearch(bikrrt_ptr_->waitForResult());
+        }
+      }
+      else
+      {
+        ROS_INFO("!!!generate traj!!!");
+        success = searchForTraj(start_pos_, start_vel_, start_acc_, end_pos_, end_vel_, end_acc_, replan_time_); 
+      }
       if (success)
       {
         sendTrajToServer(traj_);
         curr_traj_start_time_ = ros::Time::now();
+        search_origin_time_ = curr_traj_start_time_;
         changeState(FOLLOW_TRAJ);
       }
       else
@@ -184,14 +242,19 @@ namespace kino_planner
 
     case FOLLOW_TRAJ:
     {
+      if (refining_)
+      {
+        pollRefinement();
+      }
       double t_during_traj = (ros::Time::now() - curr_traj_start_time_).toSec();
       VectorXd curr_expected_state(9);
-      curr_expected_state.head(3) = traj_.getPos(t_during_traj);
-      curr_expected_state.segment(3, 3) = traj_.getVel(t_during_traj);
-      curr_expected_state.tail(3) = traj_.getAcc(t_during_traj);
+      curr_expected_state.head(3) = traj_.getPos(t_during_traj, traj_cursor_);
+      curr_expected_state.segment(3, 3) = traj_.getVel(t_during_traj, traj_cursor_);
+      curr_expected_state.tail(3) = traj_.getAcc(t_during_traj, traj_cursor_);
       vis_ptr_->visualizeCurrExpectedState(curr_expected_state, ros::Time::now());
       if (t_during_traj >= traj_.getTotalDuration() || reachGoal(0.1))
       {
+        stopRefining();
         changeState(WAIT_GOAL);
       }
       else if (new_goal_)
@@ -222,8 +285,21 @@ namespace kino_planner
                           Vector3d end_pos, Vector3d end_vel, Vector3d end_acc,
                           double search_time)
   {
-    vis_ptr_->visualizeStartAndGoal(start_pos, end_pos, pos_checker_ptr_->getLocalTime());
     int result(false);
+    prepareSearch(start_pos, end_pos);
+    bikrrt_ptr_->reset();
+    result = bikrrt_ptr_->plan(start_pos, start_vel, start_acc, end_pos, end_vel, end_acc, search_time);
+    //krrt_planner_ptr_->reset();
+    //result = krrt_planner_ptr_->plan(start_pos, start_vel, start_acc, end_pos, end_vel, end_acc, search_time);
+    return finishSearch(result);
+  }
+
+  // the map is read locked here and in the other steps around the search, never while 
+  // waiting for the search thread, which takes the lock itself
+  void FSM::prepareSearch(const Vector3d& start_pos, const Vector3d& end_pos)
+  {
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
+    vis_ptr_->visualizeStartAndGoal(start_pos, end_pos, pos_checker_ptr_->getLocalTime());
 
     /* r3planner  If uncomment, then use the resulting path to guide the sampling */
     if (use_r3_)
@@ -260,65 +336,147 @@ namespace kino_planner
       }
     }
     /* r3planner   */
+  }
+
+  bool FSM::finishSearch(int result)
+  {
+    if (result == KRRTPlanner::SUCCESS)
+    {
+      bikrrt_ptr_->getTraj(traj_);
+      postProcessTraj(bikrrt_ptr_->getFinalTrajTimeUsage());
+      return true;
+    }
+    else
+      return false;
+  }
 
+  // visualizes the searched traj_ and optimizes it if use_optimization_
+  void FSM::postProcessTraj(double traj_use_time)
+  {
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
     vector<string> ss;
     vector<Vector3d> ps;
     vector<StatePVA> vis_x;
     double traj_len(0.0), traj_duration(0.0), traj_acc_itg(0.0), traj_jerk_itg(0.0);
     int traj_seg_nums(0);
 
-    bikrrt_ptr_->reset();
-    result = bikrrt_ptr_->plan(start_pos, start_vel, start_acc, end_pos, end_vel, end_acc, search_time);
-    //krrt_planner_ptr_->reset();
-    //result = krrt_planner_ptr_->plan(start_pos, start_vel, start_acc, end_pos, end_vel, end_acc, search_time);
-    if (result == KRRTPlanner::SUCCESS)
+    double traj_cost = bikrrt_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
+    //krrt_planner_ptr_->getTraj(traj_);
+    //traj_use_time = krrt_planner_ptr_->getFinalTrajTimeUsage();
+    //double traj_cost = krrt_planner_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
+    vis_x.clear();
+    traj_.sampleWholeTrajectory(&vis_x);
+    vis_ptr_->visualizeStates(vis_x, BLUE, pos_checker_ptr_->getLocalTime());
+    ss.push_back(std::to_string(traj_use_time * 1e3));
+    ss.push_back(std::to_string(traj_cost));
+    
+
+    if (use_optimization_)
     {
-      double traj_use_time(0.0);
-      bikrrt_ptr_->getTraj(traj_);
-      traj_use_time = bikrrt_ptr_->getFinalTrajTimeUsage();
-      double traj_cost = bikrrt_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
-      //krrt_planner_ptr_->getTraj(traj_);
-      //traj_use_time = krrt_planner_ptr_->getFinalTrajTimeUsage();
-      //double traj_cost = krrt_planner_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
       vis_x.clear();
-      traj_.sampleWholeTrajectory(&vis_x);
-      vis_ptr_->visualizeStates(vis_x, BLUE, pos_checker_ptr_->getLocalTime());
-      ss.push_back(std::to_string(traj_use_time * 1e3));
-      ss.push_back(std::to_string(traj_cost));
-      
+      ros::Time optimize_start_time(ros::Time::now());
+      bool optimize_succ = optimize(traj_);
+      ros::Time optimize_end_time(ros::Time::now());
+      if (optimize_succ)
+      {
+        optimizer_ptr_->getTraj(traj_);
+        traj_.sampleWholeTrajectory(&vis_x);
 
-      if (use_optimization_)
+        double traj_cost = krrt_planner_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
+        ss.push_back(std::to_string((optimize_end_time - optimize_start_time).toSec() * 1e3));
+        ss.push_back(std::to_string(traj_cost));
+      }
+      else
       {
-        vis_x.clear();
-        ros::Time optimize_start_time(ros::Time::now());
-        bool optimize_succ = optimize();
-        ros::Time optimize_end_time(ros::Time::now());
-        if (optimize_succ)
-        {
-          optimizer_ptr_->getTraj(traj_);
-          traj_.sampleWholeTrajectory(&vis_x);
+        ss.push_back("fail");
+        ss.push_back("fail");
+      }
+      vis_ptr_->visualizeStates(vis_x, RED, pos_checker_ptr_->getLocalTime());
+    }
+    vis_ptr_->visualizeText(ss, ps, pos_checker_ptr_->getLocalTime());
+  }
 
-          double traj_cost = krrt_planner_ptr_->evaluateTraj(traj_, traj_duration, traj_len, traj_seg_nums, traj_acc_itg, traj_jerk_itg);
-          ss.push_back(std::to_string((optimize_end_time - optimize_start_time).toSec() * 1e3));
-          ss.push_back(std::to_string(traj_cost));
-        }
-        else
+  // the search keeps running after its first solution was committed,
+  // every cheaper solution it publishes is joined to the traj being flown
+  void FSM::pollRefinement()
+  {
+    if (new_solution_)
+    {
+      new_solution_ = false;
+      Trajectory refined, joined;
+      double cost(0.0);
+      if (bikrrt_ptr_->getBestTraj(refined, cost) && cost < committed_cost_)
+      {
+        committed_cost_ = cost;
+        ros::Time splice_time = ros::Time::now();
+        if (spliceRefinement(refined, splice_time, joined))
         {
-          ss.push_back("fail");
-          ss.push_back("fail");
+          ROS_INFO_STREAM("[fsm] refined traj joined, cost: " << cost);
+          traj_ = joined;
+          sendTrajToServer(traj_);
+          curr_traj_start_time_ = splice_time;
+          traj_cursor_ = Trajectory::Cursor();
         }
-        vis_ptr_->visualizeStates(vis_x, RED, pos_checker_ptr_->getLocalTime());
       }
-      vis_ptr_->visualizeText(ss, ps, pos_checker_ptr_->getLocalTime());
-      return true;
     }
-    else
+    if (!bikrrt_ptr_->isPlanning())
+    {
+      bikrrt_ptr_->waitForResult();
+      refining_ = false;
+    }
+  }
+
+  void FSM::stopRefining()
+  {
+    if (!refining_)
+      return;
+    bikrrt_ptr_->cancel();
+    bikrrt_ptr_->waitForResult();
+    refining_ = false;
+  }
+
+  // solutions of the search all start at search_origin_time_, the flown state now 
+  // is connected to the refined traj at the end of its current piece by a quintic 
+  // with the same duration, the rest of the refined traj is kept as it is
+  bool FSM::spliceRefinement(const Trajectory &refined, const ros::Time &splice_time, Trajectory &joined)
+  {
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
+    double t_refined = (splice_time - search_origin_time_).toSec();
+    double t_during_traj = (splice_time - curr_traj_start_time_).toSec();
+    if (t_refined >= refined.getTotalDuration() || t_during_traj >= traj_.getTotalDuration())
       return false;
+    int idx = refined.locatePieceIdx(t_refined);
+    double bridge_dur = refined[idx].getDuration() - t_refined;
+    // a bridge too short to absorb the state difference ends at the next piece instead
+    if (bridge_dur < 0.5 && idx + 1 < refined.getPieceNum())
+    {
+      idx++;
+      bridge_dur += refined[idx].getDuration();
+    }
+    double t_end = refined[idx].getDuration();
+    BoundaryCond bound_cond;
+    bound_cond << traj_.getPos(t_during_traj), traj_.getVel(t_during_traj), traj_.getAcc(t_during_traj), 
+                  refined[idx].getPos(t_end), refined[idx].getVel(t_end), refined[idx].getAcc(t_end);
+    joined = Trajectory();
+    joined.emplace_back(bound_cond, bridge_dur);
+    for (int i = idx + 1; i < refined.getPieceNum(); ++i)
+      joined.emplace_back(refined[i]);
+
+    if (use_optimization_ && optimize(joined))
+      optimizer_ptr_->getTraj(joined);
+    if (!joined.checkMaxVelRate(vel_limit_) || !joined.checkMaxAccRate(acc_limit_))
+      return false;
+    if (!pos_checker_ptr_->checkPolyTraj(joined))
+      return false;
+    vector<StatePVA> vis_x;
+    joined.sampleWholeTrajectory(&vis_x);
+    vis_ptr_->visualizeStates(vis_x, RED, pos_checker_ptr_->getLocalTime());
+    return true;
   }
 
-  bool FSM::optimize()
+  bool FSM::optimize(const Trajectory &traj)
   {
-    if (!optimizer_ptr_->initialize(traj_, TrajOptimizer::SMOOTH_HOMO_OBS))
+    if (!optimizer_ptr_->initialize(traj, TrajOptimizer::SMOOTH_HOMO_OBS))
       return false;
     bool res = optimizer_ptr_->solve_S_H_O();
     return res;
@@ -375,6 +533,7 @@ namespace kino_planner
   inline bool FSM::needReplan()
   {
     //ROS_INFO("need replan chec");
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
     double t_during_traj = (ros::Time::now() - curr_traj_start_time_).toSec();
     double t_check_until_traj = std::min(traj_.getTotalDuration(), t_during_traj + replan_check_duration_);
     if (!pos_checker_ptr_->checkPolyTraj(traj_, t_during_traj, t_check_until_traj, pos_about_to_collide_, remain_safe_time_))
@@ -397,7 +556,9 @@ namespace kino_planner
     else if (machine_state_ == FOLLOW_TRAJ)
     {
       double curr_remain_safe_time = remain_safe_time_ - (ros::Time::now() - collision_detect_time_).toSec();
-      double dt = max(0.0, min(replan_time_, curr_remain_safe_time));
+      // the new traj is taken after first_solution_time_ when searching anytime
+      double commit_time = anytime_ ? first_solution_time_ : replan_time_;
+      double dt = max(0.0, min(commit_time, curr_remain_safe_time));
       double t_during_traj = (ros::Time::now() - curr_traj_start_time_).toSec();
       pos = traj_.getPos(t_during_traj + dt);
       vel = traj_.getVel(t_during_traj);
@@ -37,6 +37,9 @@ ros::Time _final_time = ros::TIME_MIN;
 ros::Time _start_time = ros::TIME_MAX;
 double _start_yaw = 0.0, _final_yaw = 0.0;
 bool _receive_traj = false;
+// segment of the last command and its start time, commands go forward in time
+int _seg_idx = 0;
+double _seg_start = 0.0;
 double _real_yaw;
 Eigen::Quaterniond _q;
 Eigen::Vector3d _euler;
@@ -166,6 +169,8 @@ void polyTrajCallback(const quadrotor_msgs::PolynomialTrajectory& traj)
     _n_segment = traj.num_segment;
     _final_time = _start_time = traj.header.stamp;
     _time.resize(_n_segment);
+    _seg_idx = 0;
+    _seg_start = 0.0;
 
     _order.clear();
     for (int idx = 0; idx < _n_segment; ++idx)
@@ -442,11 +447,19 @@ void cmdCallback(const ros::TimerEvent &e)
     
     // #3. calculate the desired states
     //ROS_WARN("[SERVER] the time : %.3lf\n, n = %d, m = %d", t, _n_order, _n_segment);
-    for (int idx = 0; idx < _n_segment; ++idx)
+    if (t < _seg_start)
+    {
+      _seg_idx = 0;
+      _seg_start = 0.0;
+    }
+    t -= _seg_start;
+    for (int idx = _seg_idx; idx < _n_segment; ++idx)
     {
       if (t > _time[idx] && idx + 1 < _n_segment)
       {
         t -= _time[idx];
+        _seg_start += _time[idx];
+        _seg_idx = idx + 1;
       }
       else
       { 
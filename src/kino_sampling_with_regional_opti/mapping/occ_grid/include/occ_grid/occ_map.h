@@ -19,6 +19,13 @@
 // #include <tf2_ros/transform_listener.h>
 
 #include <queue>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "occ_grid/thread_pool.h"
 
 #define logit(x) (log((x) / (1 - (x))))
 #define INVALID_IDX -1
@@ -43,7 +50,7 @@ class OccMap
 {
 public:
   OccMap() {}
-  ~OccMap() {};
+  ~OccMap();
   void init(const ros::NodeHandle& nh);
 
   bool odomValid() { return have_odom_; }
@@ -56,11 +63,19 @@ public:
   Eigen::Vector3d getOrigin() { return origin_; }
   void resetBuffer(Eigen::Vector3d min, Eigen::Vector3d max);
   void setOccupancy(const Eigen::Vector3d &pos);
+  void clearOccupancy(const Eigen::Vector3d &pos);
   int getVoxelState(const Eigen::Vector3d &pos);
   int getVoxelState(const Eigen::Vector3i &id);
   bool isInflateOccupied(const Eigen::Vector3d &pos);
   bool isInflateOccupied(const Eigen::Vector3i &id);
   float nearestObs(const double &x, const double &y, const double &z, float &x_obs, float &y_obs, float &z_obs);
+  // signed distance to the closest occupied voxel, negative inside obstacles, clamped to +-esdf_max_dist_.
+  // Without the esdf every query returns esdf_max_dist_ (and a zero gradient)
+  bool hasESDF() { return use_esdf_; }
+  double getDistance(const Eigen::Vector3d &pos);
+  double getDistance(const Eigen::Vector3i &id);
+  // trilinear interpolated distance and its gradient
+  double getDistWithGrad(const Eigen::Vector3d &pos, Eigen::Vector3d &grad);
 	ros::Time getLocalTime() { return latest_odom_time_; };
 
   Eigen::Vector3i posToIndex(const Eigen::Vector3d &pos);
@@ -70,16 +85,41 @@ public:
   bool isInMap(const Eigen::Vector3d &pos);
   bool isInMap(const Eigen::Vector3i &id);
   Eigen::Vector3i getMapSize();
+  // bytes held by each layer of the map
+  void getMemoryUsage(vector<pair<string, size_t>> &layers);
+  // the fusion, the global cloud and the rolling window write the map from ros callbacks. 
+  // Queries from other threads should hold this lock, e.g. for one planner iteration; 
+  // do not take it again while holding it, a waiting writer blocks the second one
+  typedef boost::shared_lock<boost::shared_mutex> ReadLock;
+  ReadLock lockForRead() { return ReadLock(map_mutex_); }
   
   typedef shared_ptr<OccMap> Ptr;
   
 private:
-  std::vector<double> occupancy_buffer_; 
+  // src/bench/inflation_bench.cpp times inflate() against the incremental inflation
+  friend class InflationBench;
+
+  std::vector<float> occupancy_buffer_; // log-odds
+  boost::shared_mutex map_mutex_;
+  typedef boost::unique_lock<boost::shared_mutex> WriteLock;
 
   // map property
   Eigen::Vector3d min_range_, max_range_;  // map range in pos
   Eigen::Vector3i grid_size_;              // map size in index
   int grid_size_y_multiply_z_;
+  // 8x8x8 bricks of x-major voxels, so that nearby queries share cache lines.
+  // A brick of the inflated occupancy is exactly one 64 byte line
+  bool bricked_layout_;
+  int brick_num_z_, brick_num_yz_;
+  // rolling map: a window of grid_size_ voxels that follows the vehicle in x and y. The buffers are a ring,
+  // window index i lives in slot (i + ring_offset_) % grid_size_, so callers keep using window indices
+  bool rolling_;
+  double rolling_shift_dist_;
+  int rolling_shift_num_;
+  Eigen::Vector3i window_min_id_; // first voxel of the window, counted from the world origin
+  Eigen::Vector3i ring_offset_;
+  void moveWindow(const Eigen::Vector3d &center);
+  void countInflation(const Eigen::Vector3i &box_lo, const Eigen::Vector3i &box_hi);
   Eigen::Vector3d local_range_min_, local_range_max_;
 
   
@@ -126,8 +166,13 @@ private:
   void projectDepthImage(const Eigen::Matrix3d& K, 
                          const Eigen::Matrix4d& T_wc, const cv::Mat& depth_image, 
                          Eigen::Matrix4d& last_T_wc, cv::Mat& last_depth_image, ros::Time r_s);
-  void raycastProcess(const Eigen::Vector3d& t_wc);
+  int projectDepthRows(const Eigen::Matrix3d& K, 
+                       const Eigen::Matrix4d& T_wc, const cv::Mat& depth_image, 
+                       const Eigen::Matrix4d& last_T_wc, const cv::Mat& last_depth_image, bool check_last, 
+                       int v_begin, int v_end, Eigen::Vector3d *pts);
+  void raycastProcess(const Eigen::Vector3d& t_wc, const vector<Eigen::Vector3d>& points, int points_cnt);
   int setCacheOccupancy(const Eigen::Vector3d &pos, int occ);
+  void addCacheOccupancy(const Eigen::Vector3i &id, int idx_ctns, int occ);
 
   void indepOdomCallback(const nav_msgs::OdometryConstPtr& msg);
   void globalOccVisCallback(const ros::TimerEvent& e);
@@ -143,10 +188,43 @@ private:
   int rows_, cols_;
   vector<Eigen::Vector3d> proj_points_;
   int proj_points_cnt_;
-  vector<int> cache_hit_, cache_all_;
-  vector<int> cache_traverse_, cache_rayend_;
+  vector<uint16_t> cache_hit_, cache_all_;
+  vector<uint16_t> cache_traverse_, cache_rayend_; // raycast_num_ of the last visit, 0 if never
   int raycast_num_;
   queue<Eigen::Vector3i> cache_voxel_;
+
+  /* fusion pipeline */
+  int fusion_threads_;      // depth rows and rays are split among this many threads
+  // persistent workers, one pool for the projection and one for the raycast so that 
+  // a pipelined frame can be projected while the last one is integrated
+  ThreadPool::Ptr project_pool_, raycast_pool_;
+  bool pipelined_fusion_;   // integrate on a worker while the callback projects the next frame
+  bool show_fusion_latency_;
+  struct RayVisit
+  {
+    Eigen::Vector3i id;
+    int address;
+    int occ;
+  };
+  vector<vector<RayVisit>> ray_visits_; // voxels visited by the rays of each thread, merged in ray order
+  vector<int> proj_chunk_cnt_;
+  vector<Eigen::Vector3d> fusion_points_; // the other half of the double buffer, owned by the worker
+  int fusion_points_cnt_;
+  Eigen::Vector3d fusion_center_, fusion_t_wc_;
+  bool fusion_pending_, fusion_stop_;
+  std::thread fusion_worker_;
+  std::mutex fusion_mutex_;
+  std::condition_variable fusion_cv_;
+  enum FusionStage { STAGE_CONVERT, STAGE_PROJECT, STAGE_WAIT, STAGE_RAYCAST, STAGE_UPDATE, STAGE_ESDF, STAGE_NUM };
+  double stage_time_[STAGE_NUM]; // ms summed since the last latency report
+  int stage_frames_;
+  void castRays(const Eigen::Vector3d& t_wc, const vector<Eigen::Vector3d>& points, int begin, int end, vector<RayVisit>& visits);
+  int visitVoxel(const Eigen::Vector3d &pos, int occ, vector<RayVisit>& visits);
+  bool stampVisit(vector<uint16_t> &stamps, int address);
+  void integrateFrame(const Eigen::Vector3d &center, const Eigen::Vector3d &t_wc, 
+                      const vector<Eigen::Vector3d> &points, int points_cnt);
+  void fusionLoop();
+  void reportFusionLatency();
 	int img_col_, img_row_;
   Eigen::Matrix3d K_depth_;
   Eigen::Vector3d sensor_range_;
@@ -187,6 +265,27 @@ private:
   Eigen::Vector3i inflate_idx_lower, inflate_idx_upper;
   std::vector<bool> inflate_occupancy_;
   void inflate(const Eigen::Vector3i &min_idx, const Eigen::Vector3i &max_idx);
+
+  /* incremental inflation, follows every change of the occupancy instead of inflate() */
+  bool incremental_inflation_;
+  int inflate_num_;
+  std::vector<uint16_t> inflate_count_; // occupied voxels whose inflation cube covers the voxel
+  void inflateVoxel(const Eigen::Vector3i &id, int delta);
+  void voxelStateChanged(const Eigen::Vector3i &id, bool occupied);
+
+  /* esdf */
+  bool use_esdf_;
+  double esdf_max_dist_;
+  std::vector<float> distance_buffer_;
+  bool esdf_need_update_;
+  Eigen::Vector3i esdf_update_min_, esdf_update_max_; // box of the voxels that changed state since the last update
+  std::vector<double> esdf_sqr_pos_, esdf_sqr_neg_;   // squared voxel distances inside the update box
+  std::vector<double> esdf_line_f_, esdf_line_d_, esdf_line_z_;
+  std::vector<int> esdf_line_v_;
+  void markESDFUpdate(const Eigen::Vector3i &id);
+  void updateESDF();
+  void computeSqrDist(const Eigen::Vector3i &box_min, const Eigen::Vector3i &box_size, bool to_occupied, std::vector<double> &sqr_dist);
+  void fillESDFLine(int n);
   
 public:
   void getSurroundPts(const Eigen::Vector3d& pos, Eigen::Vector3d pts[2][2][2],
@@ -222,12 +321,25 @@ public:
 
 inline int OccMap::idxToAddress(const int &x_id, const int &y_id, const int &z_id)
 {
-  return x_id * grid_size_y_multiply_z_ + y_id * grid_size_(2) + z_id;
+  int x = x_id, y = y_id, z = z_id;
+  if (rolling_)
+  {
+    x += ring_offset_(0);
+    if (x >= grid_size_(0))
+      x -= grid_size_(0);
+    y += ring_offset_(1);
+    if (y >= grid_size_(1))
+      y -= grid_size_(1);
+  }
+  if (bricked_layout_)
+    return (((x >> 3) * brick_num_yz_ + (y >> 3) * brick_num_z_ + (z >> 3)) << 9) + 
+           ((x & 7) << 6) + ((y & 7) << 3) + (z & 7);
+  return x * grid_size_y_multiply_z_ + y * grid_size_(2) + z;
 }
 
 inline int OccMap::idxToAddress(const Eigen::Vector3i &id)
 {
-  return id(0) * grid_size_y_multiply_z_ + id(1) * grid_size_(2) + id(2);
+  return idxToAddress(id(0), id(1), id(2));
 }
 
 // takes about 0.04 us
@@ -267,6 +379,24 @@ inline bool OccMap::isInflateOccupied(const Eigen::Vector3i &id)
   return inflate_occupancy_[idxToAddress(id)] == true;
 }
 
+inline double OccMap::getDistance(const Eigen::Vector3d &pos)
+{
+  Eigen::Vector3i id;
+  posToIndex(pos, id);
+  return getDistance(id);
+}
+
+// out of map ids are clamped to the map border
+inline double OccMap::getDistance(const Eigen::Vector3i &id)
+{
+  if (!use_esdf_)
+    return esdf_max_dist_;
+  int x = max(0, min(id[0], grid_size_[0] - 1));
+  int y = max(0, min(id[1], grid_size_[1] - 1));
+  int z = max(0, min(id[2], grid_size_[2] - 1));
+  return distance_buffer_[idxToAddress(x, y, z)];
+}
+
 inline bool OccMap::isInLocalMap(const Eigen::Vector3d &pos)
 {
   Eigen::Vector3i idx;
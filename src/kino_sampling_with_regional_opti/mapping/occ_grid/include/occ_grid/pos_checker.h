@@ -25,6 +25,12 @@ private:
   bool checkState(const Vector3d &pos, const Vector3d &vel, const Vector3d &acc);
   bool checkState(const Vector3d &pos, const Vector3d &vel, const Vector3d &acc, Vector3d &collision_pt);
 
+  // number of stamps t_s, t_s + dt_, ... that are not after t_e
+  inline int stampNum(double t_s, double t_e) const
+  {
+    return t_e < t_s ? 0 : (int)std::floor((t_e - t_s) / dt_) + 1;
+  };
+
   inline bool curvatureValid(const Vector3d &vel, const Vector3d &acc)
   {
     double tmp = vel.norm() * vel.norm() * vel.norm();
@@ -52,6 +58,12 @@ public:
     resolution_ = occ_map_->getResolution();
   };
 
+  // the checks below do not lock the map, see OccMap::lockForRead()
+  OccMap::ReadLock lockMapForRead()
+  {
+    return occ_map_->lockForRead();
+  };
+
   int getVoxelState(const Vector3d& pos)
   {
     return occ_map_->getVoxelState(pos);
@@ -105,8 +117,23 @@ public:
   {
     float obs_x, obs_y, obs_z;
     float range = occ_map_->nearestObs(pos[0], pos[1], pos[2], obs_x, obs_y, obs_z);
+    if (range >= 0.0)
+      obs = Vector3d(obs_x, obs_y, obs_z);
     return range;
   };
+  // signed distance field, only valid if the map keeps one (occ_map/use_esdf)
+  bool hasESDF()
+  {
+    return occ_map_->hasESDF();
+  };
+  double getDistance(const Vector3d &pos)
+  {
+    return occ_map_->getDistance(pos);
+  };
+  double getDistWithGrad(const Vector3d &pos, Vector3d &grad)
+  {
+    return occ_map_->getDistWithGrad(pos, grad);
+  };
 
   void posToIndex(const Eigen::Vector3d &pos, Eigen::Vector3i &id);
   Eigen::Vector3i posToIndex(const Eigen::Vector3d &pos);
@@ -0,0 +1,52 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace kino_planner
+{
+
+// Fixed set of worker threads that run one parallelFor() at a time.
+// The calling thread takes part as worker 0, so a pool of size n
+// spawns n - 1 threads. Each task is told which worker runs it so that
+// callers can keep per-worker scratch objects (e.g. one bvp solver each).
+class ThreadPool
+{
+public:
+  ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int size() const
+  {
+    return (int)workers_.size() + 1;
+  };
+
+  // runs task(worker_id, i) for i in [0, n) and blocks until all are done
+  void parallelFor(int n, const std::function<void(int, int)> &task);
+
+  typedef std::shared_ptr<ThreadPool> Ptr;
+
+private:
+  void workerLoop(int worker_id);
+  void runTasks(int worker_id);
+
+  std::vector<std::thread> workers_;
+  std::mutex mtx_;
+  std::condition_variable start_cv_, done_cv_;
+  const std::function<void(int, int)> *task_;
+  int n_tasks_;
+  std::atomic<int> next_task_;
+  int busy_workers_;
+  unsigned long generation_;
+  bool stop_;
+};
+
+} // namespace kino_planner
+
+#endif //_THREAD_POOL_H_
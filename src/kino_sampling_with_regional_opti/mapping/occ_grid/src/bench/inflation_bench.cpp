@@ -0,0 +1,132 @@
+// Full vs incremental inflation on a 40x40x5 m map at 0.1 m, inflated by 0.2 m.
+// Needs a running roscore, the map reads its params from the private namespace:
+//   rosrun occ_grid inflation_bench
+#include "occ_grid/occ_map.h"
+#include <ros/ros.h>
+#include <chrono>
+#include <random>
+
+namespace kino_planner
+{
+
+class InflationBench
+{
+public:
+  InflationBench(OccMap &map) : map_(map), gen_(3) {}
+
+  void run(int rounds, int flips_per_round)
+  {
+    const Eigen::Vector3i &grid = map_.grid_size_;
+    std::uniform_int_distribution<int> rand_x(0, grid[0] - 1), rand_y(0, grid[1] - 1);
+
+    /* 400 pillars of 0.5 x 0.5 m, inflated incrementally as they are set */
+    auto t0 = Clock::now();
+    int n_set = 0;
+    for (int p = 0; p < 400; ++p)
+    {
+      int x0 = rand_x(gen_), y0 = rand_y(gen_);
+      for (int x = x0; x < std::min(x0 + 5, grid[0]); ++x)
+        for (int y = y0; y < std::min(y0 + 5, grid[1]); ++y)
+          for (int z = 0; z < grid[2]; ++z)
+          {
+            map_.setOccupancy(posOf(x, y, z));
+            ++n_set;
+          }
+    }
+    ROS_INFO("[inflation_bench] build with incremental inflation: %.1f ms (%d voxels set)", msSince(t0), n_set);
+
+    /* inflate() over the whole map, what the global cloud callback did */
+    std::vector<bool> incremental = map_.inflate_occupancy_;
+    double full_ms = fullInflate(Eigen::Vector3i::Zero(), grid);
+    ROS_INFO("[inflation_bench] full inflate() of the map: %.1f ms, same result: %d",
+             full_ms, (int)(incremental == map_.inflate_occupancy_));
+    map_.inflate_occupancy_ = incremental;
+
+    /* batches of flips in a 6 m window, like the voxels one depth frame changes */
+    Eigen::Vector3i win_lo = grid / 2 - Eigen::Vector3i(30, 30, 0);
+    Eigen::Vector3i win_hi = grid / 2 + Eigen::Vector3i(30, 30, 0);
+    win_hi[2] = grid[2] - 1;
+    std::uniform_int_distribution<int> rand_wx(win_lo[0], win_hi[0]), rand_wy(win_lo[1], win_hi[1]), rand_wz(0, win_hi[2]);
+    double incremental_ms = 0.0;
+    for (int r = 0; r < rounds; ++r)
+    {
+      auto t = Clock::now();
+      for (int i = 0; i < flips_per_round; ++i)
+      {
+        Eigen::Vector3i id(rand_wx(gen_), rand_wy(gen_), rand_wz(gen_));
+        Eigen::Vector3d pos = posOf(id[0], id[1], id[2]);
+        // getVoxelState() only answers inside the local window around the odometry
+        if (map_.occupancy_buffer_[map_.idxToAddress(id)] > map_.min_occupancy_log_)
+          map_.clearOccupancy(pos);
+        else
+          map_.setOccupancy(pos);
+      }
+      incremental_ms += msSince(t);
+    }
+    ROS_INFO("[inflation_bench] incremental, batch of %d flips: %.3f ms", flips_per_round, incremental_ms / rounds);
+
+    /* the flips cleared voxels as well, the counts must still match a dilation from scratch */
+    incremental = map_.inflate_occupancy_;
+    fullInflate(Eigen::Vector3i::Zero(), grid);
+    ROS_INFO("[inflation_bench] after clearing, same result as a full inflate(): %d",
+             (int)(incremental == map_.inflate_occupancy_));
+    map_.inflate_occupancy_ = incremental;
+
+    /* inflate() only over the window the flips touched, padded by the inflation */
+    Eigen::Vector3i pad = Eigen::Vector3i::Constant(map_.inflate_num_);
+    ROS_INFO("[inflation_bench] full inflate() of the window: %.3f ms",
+             fullInflate((win_lo - pad).cwiseMax(0), (win_hi + pad + Eigen::Vector3i::Ones()).cwiseMin(grid)));
+    map_.inflate_occupancy_ = incremental;
+  }
+
+private:
+  typedef std::chrono::high_resolution_clock Clock;
+
+  OccMap &map_;
+  std::mt19937 gen_;
+
+  static double msSince(const Clock::time_point &t)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+  }
+
+  Eigen::Vector3d posOf(int x, int y, int z)
+  {
+    Eigen::Vector3d pos;
+    map_.indexToPos(x, y, z, pos);
+    return pos;
+  }
+
+  // inflate() into a cleared layer, it only ever sets voxels
+  double fullInflate(const Eigen::Vector3i &lo, const Eigen::Vector3i &hi)
+  {
+    std::fill(map_.inflate_occupancy_.begin(), map_.inflate_occupancy_.end(), false);
+    auto t = Clock::now();
+    map_.inflate(lo, hi);
+    return msSince(t);
+  }
+};
+
+} // namespace kino_planner
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "inflation_bench");
+  ros::NodeHandle nh("~");
+  nh.setParam("occ_map/origin_x", -20.0);
+  nh.setParam("occ_map/origin_y", -20.0);
+  nh.setParam("occ_map/origin_z", 0.0);
+  nh.setParam("occ_map/map_size_x", 40.0);
+  nh.setParam("occ_map/map_size_y", 40.0);
+  nh.setParam("occ_map/map_size_z", 5.0);
+  nh.setParam("occ_map/resolution", 0.1);
+  nh.setParam("occ_map/inflate_length", 0.2);
+  nh.setParam("occ_map/incremental_inflation", true);
+  nh.setParam("occ_map/skip_pixel", 1);
+
+  kino_planner::OccMap map;
+  map.init(nh);
+  kino_planner::InflationBench bench(map);
+  bench.run(50, 3000);
+  return 0;
+}
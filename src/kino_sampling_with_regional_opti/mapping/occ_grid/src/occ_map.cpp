@@ -7,7 +7,9 @@
 #include <tf2_ros/transform_broadcaster.h>
 #include <tf2/LinearMath/Quaternion.h>
 #include <chrono>
+#include <sstream>
 #include <random>
+#include <limits>
 
 //for img debug
 #include <opencv2/opencv.hpp>
@@ -17,6 +19,59 @@ ros::Subscriber global_cloud_sub_;
 
 namespace kino_planner
 {
+// the esdf is recomputed around the voxels that changed state, see updateESDF()
+inline void OccMap::markESDFUpdate(const Eigen::Vector3i &id)
+{
+  if (!esdf_need_update_)
+  {
+    esdf_update_min_ = id;
+    esdf_update_max_ = id;
+    esdf_need_update_ = true;
+    return;
+  }
+  esdf_update_min_ = esdf_update_min_.cwiseMin(id);
+  esdf_update_max_ = esdf_update_max_.cwiseMax(id);
+}
+
+// the occupancy cube of one voxel that became occupied (delta 1) or free (delta -1),
+// clamped to the map once and written row by row along z
+inline void OccMap::inflateVoxel(const Eigen::Vector3i &id, int delta)
+{
+  int x_lo = max(id[0] - inflate_num_, 0), x_hi = min(id[0] + inflate_num_, grid_size_[0] - 1);
+  int y_lo = max(id[1] - inflate_num_, 0), y_hi = min(id[1] + inflate_num_, grid_size_[1] - 1);
+  int z_lo = max(id[2] - inflate_num_, 0), z_hi = min(id[2] + inflate_num_, grid_size_[2] - 1);
+  for (int x = x_lo; x <= x_hi; ++x)
+    for (int y = y_lo; y <= y_hi; ++y)
+    {
+      if (delta > 0)
+      {
+        for (int z = z_lo; z <= z_hi; ++z)
+        {
+          int address = idxToAddress(x, y, z);
+          if (inflate_count_[address]++ == 0)
+            inflate_occupancy_[address] = true;
+        }
+      }
+      else
+      {
+        for (int z = z_lo; z <= z_hi; ++z)
+        {
+          int address = idxToAddress(x, y, z);
+          if (--inflate_count_[address] == 0)
+            inflate_occupancy_[address] = false;
+        }
+      }
+    }
+}
+
+// every flip of the occupied state goes through here, the layers derived from the occupancy follow it
+inline void OccMap::voxelStateChanged(const Eigen::Vector3i &id, bool occupied)
+{
+  markESDFUpdate(id);
+  if (incremental_inflation_)
+    inflateVoxel(id, occupied ? 1 : -1);
+}
+
 void OccMap::resetBuffer(Eigen::Vector3d min_pos, Eigen::Vector3d max_pos)
 {
   min_pos(0) = max(min_pos(0), min_range_(0));
@@ -36,11 +91,14 @@ void OccMap::resetBuffer(Eigen::Vector3d min_pos, Eigen::Vector3d max_pos)
     for (int y = min_id(1); y <= max_id(1); ++y)
       for (int z = min_id(2); z <= max_id(2); ++z)
       {
-        occupancy_buffer_[idxToAddress(x, y, z)] = clamp_min_log_;
+        int address = idxToAddress(x, y, z);
+        if (occupancy_buffer_[address] > min_occupancy_log_)
+          voxelStateChanged(Eigen::Vector3i(x, y, z), false);
+        occupancy_buffer_[address] = clamp_min_log_;
       }
 }
 
-inline void OccMap::setOccupancy(const Eigen::Vector3d &pos)
+void OccMap::setOccupancy(const Eigen::Vector3d &pos)
 {
   Eigen::Vector3i id;
   posToIndex(pos, id);
@@ -48,7 +106,23 @@ inline void OccMap::setOccupancy(const Eigen::Vector3d &pos)
   if (!isInMap(id))
     return;
 
-  occupancy_buffer_[idxToAddress(id)] = clamp_max_log_;
+  int address = idxToAddress(id);
+  if (occupancy_buffer_[address] <= min_occupancy_log_)
+    voxelStateChanged(id, true);
+  occupancy_buffer_[address] = clamp_max_log_;
+}
+
+void OccMap::clearOccupancy(const Eigen::Vector3d &pos)
+{
+  Eigen::Vector3i id;
+  posToIndex(pos, id);
+  if (!isInMap(id))
+    return;
+
+  int address = idxToAddress(id);
+  if (occupancy_buffer_[address] > min_occupancy_log_)
+    voxelStateChanged(id, false);
+  occupancy_buffer_[address] = clamp_min_log_;
 }
 
 void OccMap::pubPointCloudFromDepth(const std_msgs::Header& header, 
@@ -85,6 +159,7 @@ void OccMap::pubPointCloudFromDepth(const std_msgs::Header& header,
 void OccMap::globalOccVisCallback(const ros::TimerEvent& e)
 {
   //for vis
+  ReadLock map_lock(map_mutex_);
   history_view_cloud_ptr_->points.clear();
   for (int x = 0; x < grid_size_[0]; ++x)
     for (int y = 0; y < grid_size_[1]; ++y)
@@ -112,6 +187,7 @@ void OccMap::localOccVisCallback(const ros::TimerEvent& e)
 {
   //for vis
   // ros::Time t_s = ros::Time::now();
+  ReadLock map_lock(map_mutex_);
   curr_view_cloud_ptr_->points.clear();
   Eigen::Vector3i min_id, max_id;
   posToIndex(local_range_min_, min_id);
@@ -214,6 +290,7 @@ void OccMap::depthOdomCallback(const sensor_msgs::ImageConstPtr& depth_msg,
 	local_range_max_ = t_wc + sensor_range_;
 
   /* ---------- get depth image ---------- */
+  auto t_convert = std::chrono::high_resolution_clock::now();
   cv_bridge::CvImagePtr cv_ptr;
   cv_ptr = cv_bridge::toCvCopy(depth_msg, depth_msg->encoding);
   if (depth_msg->encoding == sensor_msgs::image_encodings::TYPE_32FC1)
@@ -227,9 +304,35 @@ void OccMap::depthOdomCallback(const sensor_msgs::ImageConstPtr& depth_msg,
     pubPointCloudFromDepth(depth_msg->header, depth_image_, K_depth_, camera_name);
   }
 
+  auto t_project = std::chrono::high_resolution_clock::now();
   proj_points_cnt_ = 0;
   projectDepthImage(K_depth_, T_wc, depth_image_, last_T_wc, last_depth_image, depth_msg->header.stamp);
-  raycastProcess(t_wc);
+  auto t_integrate = std::chrono::high_resolution_clock::now();
+  stage_time_[STAGE_CONVERT] += std::chrono::duration<double, std::milli>(t_project - t_convert).count();
+  stage_time_[STAGE_PROJECT] += std::chrono::duration<double, std::milli>(t_integrate - t_project).count();
+
+  if (!pipelined_fusion_)
+  {
+    integrateFrame(T_wi.block<3,1>(0,3), t_wc, proj_points_, proj_points_cnt_);
+    reportFusionLatency();
+  }
+  else
+  {
+    // hand the points over once the worker is done with the last frame, the next frame is
+    // projected into the other buffer while this one is integrated
+    std::unique_lock<std::mutex> lock(fusion_mutex_);
+    fusion_cv_.wait(lock, [this] { return !fusion_pending_; });
+    stage_time_[STAGE_WAIT] += std::chrono::duration<double, std::milli>(
+                                 std::chrono::high_resolution_clock::now() - t_integrate).count();
+    reportFusionLatency();
+    proj_points_.swap(fusion_points_);
+    fusion_points_cnt_ = proj_points_cnt_;
+    fusion_center_ = T_wi.block<3,1>(0,3);
+    fusion_t_wc_ = t_wc;
+    fusion_pending_ = true;
+    lock.unlock();
+    fusion_cv_.notify_all();
+  }
 
   local_map_valid_ = true;
   latest_odom_time_ = odom->header.stamp;
@@ -256,116 +359,59 @@ void OccMap::projectDepthImage(const Eigen::Matrix3d& K,
 {
   int cols = depth_image.cols;
   int rows = depth_image.rows;
-	pcl::PointCloud<pcl::PointXYZRGB> cloud;
-  pcl::PointXYZRGB point; //colored point clouds also have RGB values
-  
-  double depth;
-//   ROS_WARN("project for one rcved image");
-  if (!use_shift_filter_)
+  // the first image only seeds the depth filter
+  bool project = !use_shift_filter_ || has_first_depth_;
+  bool check_last = use_shift_filter_ && has_first_depth_;
+  if (use_shift_filter_)
+    has_first_depth_ = true;
+
+  int row_num = max(0, (rows - 2 * depth_filter_margin_ + skip_pixel_ - 1) / skip_pixel_);
+  int col_num = max(0, (cols - 2 * depth_filter_margin_ + skip_pixel_ - 1) / skip_pixel_);
+  if (project && row_num * col_num > 0)
   {
-    for (int v = depth_filter_margin_; v < rows - depth_filter_margin_; v += skip_pixel_)
+    if ((int)proj_points_.size() < row_num * col_num)
+      proj_points_.resize(row_num * col_num);
+
+    // every band of rows projects into its own slice of proj_points_, the slices are closed up afterwards
+    int n_threads = min(fusion_threads_, row_num);
+    proj_chunk_cnt_.resize(n_threads);
+    project_pool_->parallelFor(n_threads, [&](int, int t) {
+      int r_begin = row_num * t / n_threads, r_end = row_num * (t + 1) / n_threads;
+      proj_chunk_cnt_[t] = projectDepthRows(K, T_wc, depth_image, last_T_wc, last_depth_image, check_last, 
+                                            depth_filter_margin_ + r_begin * skip_pixel_, 
+                                            min(depth_filter_margin_ + r_end * skip_pixel_, rows - depth_filter_margin_), 
+                                            proj_points_.data() + r_begin * col_num);
+    });
+    proj_points_cnt_ = proj_chunk_cnt_[0];
+    for (int t = 1; t < n_threads; ++t)
     {
-      for (int u = depth_filter_margin_; u < cols - depth_filter_margin_; u += skip_pixel_)
-      {
-        depth = depth_image.at<uint16_t>(v, u) / depth_scale_;
-				if (isnan(depth) || isinf(depth))
-					continue;
-			  if (depth < depth_filter_mindist_)
-          continue;
-				Eigen::Vector3d proj_pt_NED, proj_pt_cam;
-        proj_pt_cam(0) = (u - K(0,2)) * depth / K(0,0);
-        proj_pt_cam(1) = (v - K(1,2)) * depth / K(1,1);
-        proj_pt_cam(2) = depth;
-				proj_pt_NED = T_wc.block<3,3>(0,0) * proj_pt_cam + T_wc.block<3,1>(0,3);
-        proj_points_[proj_points_cnt_++] = proj_pt_NED;
-        // cout << "pt in cam: " << proj_pt_cam.transpose() << ", depth: " << depth << endl;
-        // cout << "pt in map: " << proj_pt_NED.transpose() << ", depth: " << depth << endl;
-        if (show_filter_proj_depth_)
-	      {
-          point.x = proj_pt_NED[0];
-          point.y = proj_pt_NED[1];
-          point.z = proj_pt_NED[2];
-          point.r = 255;
-          point.g = 0;
-          point.b = 0;
-          cloud.points.push_back(point);
-        }
-      }
+      auto chunk = proj_points_.begin() + row_num * t / n_threads * col_num;
+      std::copy(chunk, chunk + proj_chunk_cnt_[t], proj_points_.begin() + proj_points_cnt_);
+      proj_points_cnt_ += proj_chunk_cnt_[t];
     }
   }
-  /* ---------- use depth filter ---------- */
-  else
-  {
-    if (!has_first_depth_)
-      has_first_depth_ = true;
-    else
-    {
-      Eigen::Vector3d pt_cur, pt_NED, pt_reproj;
 
-      for (int v = depth_filter_margin_; v < rows - depth_filter_margin_; v += skip_pixel_)
-      {
-        for (int u = depth_filter_margin_; u < cols - depth_filter_margin_; u += skip_pixel_)
-        {
-          depth = depth_image.at<uint16_t>(v, u) / depth_scale_;
-					if (isnan(depth) || isinf(depth))
-						continue;
-					// points with depth > depth_filter_maxdist_ or < depth_filter_mindist_ are not trusted 
-					if (depth < depth_filter_mindist_)
-            continue;
-					pt_cur(0) = (u - K(0,2)) * depth / K(0,0);
-          pt_cur(1) = (v - K(1,2)) * depth / K(1,1);
-          pt_cur(2) = depth;
-					
-          // check consistency
-					pt_NED = T_wc.block<3,3>(0,0) * pt_cur + T_wc.block<3,1>(0,3);
-          pt_reproj = last_T_wc.block<3,3>(0,0).inverse() * (pt_NED - last_T_wc.block<3,1>(0,3));
-          double uu = pt_reproj.x() * K(0,0) / pt_reproj.z() + K(0,2);
-          double vv = pt_reproj.y() * K(1,1) / pt_reproj.z() + K(1,2);
-          if (uu >= 0 && uu < cols && vv >= 0 && vv < rows)
-          {
-            double drift_dis = fabs(last_depth_image.at<uint16_t>((int)vv, (int)uu) / depth_scale_ - pt_reproj.z());
-            //cout << "drift dis: " << drift_dis << endl;
-            if (drift_dis < depth_filter_tolerance_)
-            {
-              proj_points_[proj_points_cnt_++] = pt_NED;
-              if (show_filter_proj_depth_)
-            	{
-                point.x = pt_NED[0];
-                point.y = pt_NED[1];
-                point.z = pt_NED[2];
-                point.r = 255;
-                point.g = 0;
-                point.b = 0;
-                cloud.points.push_back(point);
-              }
-            }
-          }
-          else
-          {
-						// new point
-            proj_points_[proj_points_cnt_++] = pt_NED;
-            if (show_filter_proj_depth_)
-          	{
-              point.x = pt_NED[0];
-              point.y = pt_NED[1];
-              point.z = pt_NED[2];
-              point.r = 255;
-              point.g = 0;
-              point.b = 0;
-              cloud.points.push_back(point);
-            }
-          }
-        }
-      }
-    }
-    /* ---------- maintain last ---------- */
+  /* ---------- maintain last ---------- */
+  if (use_shift_filter_)
+  {
     last_T_wc = T_wc;
     last_depth_image = depth_image;
   }
 
-
   if (show_filter_proj_depth_)
 	{
+    pcl::PointCloud<pcl::PointXYZRGB> cloud;
+    pcl::PointXYZRGB point; //colored point clouds also have RGB values
+    point.r = 255;
+    point.g = 0;
+    point.b = 0;
+    for (int i = 0; i < proj_points_cnt_; ++i)
+    {
+      point.x = proj_points_[i][0];
+      point.y = proj_points_[i][1];
+      point.z = proj_points_[i][2];
+      cloud.points.push_back(point);
+    }
     cloud.width = (int)cloud.points.size();
     cloud.height = 1;    //height=1 implies this is not an "ordered" point cloud
     // Convert the cloud to ROS message
@@ -377,70 +423,145 @@ void OccMap::projectDepthImage(const Eigen::Matrix3d& K,
   }
 }
 
-void OccMap::raycastProcess(const Eigen::Vector3d& t_wc)
+// projects the rows v_begin <= v < v_end into pts and returns the number of points. With check_last the 
+// points that fall into the last image but disagree with its depth are dropped
+int OccMap::projectDepthRows(const Eigen::Matrix3d& K, 
+                             const Eigen::Matrix4d& T_wc, const cv::Mat& depth_image, 
+                             const Eigen::Matrix4d& last_T_wc, const cv::Mat& last_depth_image, bool check_last, 
+                             int v_begin, int v_end, Eigen::Vector3d *pts)
+{
+  int cols = depth_image.cols;
+  int rows = depth_image.rows;
+  Eigen::Matrix3d R_wc = T_wc.block<3,3>(0,0);
+  Eigen::Vector3d t_wc = T_wc.block<3,1>(0,3);
+  Eigen::Matrix3d R_cw_last = last_T_wc.block<3,3>(0,0).inverse();
+  Eigen::Vector3d t_wc_last = last_T_wc.block<3,1>(0,3);
+  Eigen::Vector3d pt_cur, pt_NED, pt_reproj;
+  double depth;
+  int cnt = 0;
+  for (int v = v_begin; v < v_end; v += skip_pixel_)
+  {
+    for (int u = depth_filter_margin_; u < cols - depth_filter_margin_; u += skip_pixel_)
+    {
+      depth = depth_image.at<uint16_t>(v, u) / depth_scale_;
+      if (isnan(depth) || isinf(depth))
+        continue;
+      // points with depth > depth_filter_maxdist_ or < depth_filter_mindist_ are not trusted 
+      if (depth < depth_filter_mindist_)
+        continue;
+      pt_cur(0) = (u - K(0,2)) * depth / K(0,0);
+      pt_cur(1) = (v - K(1,2)) * depth / K(1,1);
+      pt_cur(2) = depth;
+      pt_NED = R_wc * pt_cur + t_wc;
+
+      if (check_last)
+      {
+        // check consistency, new points outside the last image are kept
+        pt_reproj = R_cw_last * (pt_NED - t_wc_last);
+        double uu = pt_reproj.x() * K(0,0) / pt_reproj.z() + K(0,2);
+        double vv = pt_reproj.y() * K(1,1) / pt_reproj.z() + K(1,2);
+        if (uu >= 0 && uu < cols && vv >= 0 && vv < rows)
+        {
+          double drift_dis = fabs(last_depth_image.at<uint16_t>((int)vv, (int)uu) / depth_scale_ - pt_reproj.z());
+          if (drift_dis >= depth_filter_tolerance_)
+            continue;
+        }
+      }
+      pts[cnt++] = pt_NED;
+    }
+  }
+  return cnt;
+}
+
+void OccMap::raycastProcess(const Eigen::Vector3d& t_wc, const vector<Eigen::Vector3d>& points, int points_cnt)
 {
-  if (proj_points_cnt_ == 0)
+  if (points_cnt == 0)
     return;
 
   // raycast_num_ = (raycast_num_ + 1) % 100000;
   raycast_num_ += 1;
+  // the stamps are 16 bit, start over before they wrap
+  if (raycast_num_ > std::numeric_limits<uint16_t>::max())
+  {
+    fill(cache_rayend_.begin(), cache_rayend_.end(), 0);
+    fill(cache_traverse_.begin(), cache_traverse_.end(), 0);
+    raycast_num_ = 1;
+  }
 
-//   ROS_INFO_STREAM("proj_points_ size: " << proj_points_cnt_);
+//   ROS_INFO_STREAM("proj_points_ size: " << points_cnt);
+  auto t_raycast = std::chrono::high_resolution_clock::now();
 
-  /* ---------- iterate projected points ---------- */
-  int set_cache_idx;
-  for (int i = 0; i < proj_points_cnt_; ++i)
+  if (fusion_threads_ > 1)
   {
-    /* ---------- occupancy of ray end ---------- */
-    Eigen::Vector3d pt_w = proj_points_[i];
-    double length = (pt_w - t_wc).norm();
-// 		ROS_INFO_STREAM("len: " << length);
-    if (length < min_ray_length_)
-      continue;
-    else if (length > max_ray_length_)
-    {
-      pt_w = (pt_w - t_wc) / length * max_ray_length_ + t_wc;
-      set_cache_idx = setCacheOccupancy(pt_w, 0);
-    }
-    else
-      set_cache_idx = setCacheOccupancy(pt_w, 1);
-
-    /* ---------- raycast will ignore close end ray ---------- */
-    if (set_cache_idx != INVALID_IDX)
+    int n_threads = min(fusion_threads_, points_cnt);
+    ray_visits_.resize(n_threads);
+    raycast_pool_->parallelFor(n_threads, [&](int, int t) {
+      castRays(t_wc, points, points_cnt * t / n_threads, points_cnt * (t + 1) / n_threads, ray_visits_[t]);
+    });
+    for (const auto &visits : ray_visits_)
+      for (const RayVisit &visit : visits)
+        addCacheOccupancy(visit.id, visit.address, visit.occ);
+  }
+  else
+  {
+    /* ---------- iterate projected points ---------- */
+    int set_cache_idx;
+    for (int i = 0; i < points_cnt; ++i)
     {
-      if (cache_rayend_[set_cache_idx] == raycast_num_)
-      {
+      /* ---------- occupancy of ray end ---------- */
+      Eigen::Vector3d pt_w = points[i];
+      double length = (pt_w - t_wc).norm();
+// 		ROS_INFO_STREAM("len: " << length);
+      if (length < min_ray_length_)
         continue;
+      else if (length > max_ray_length_)
+      {
+        pt_w = (pt_w - t_wc) / length * max_ray_length_ + t_wc;
+        set_cache_idx = setCacheOccupancy(pt_w, 0);
       }
       else
-        cache_rayend_[set_cache_idx] = raycast_num_;
-    }
+        set_cache_idx = setCacheOccupancy(pt_w, 1);
 
-    //ray casting backwards from point in world frame to camera pos, 
-    //the backwards way skips the overlap grids in each ray end by recording cache_traverse_.
-    RayCaster raycaster;
-    bool need_ray = raycaster.setInput(pt_w / resolution_, t_wc / resolution_); //(ray start, ray end)
-    if (!need_ray)
-      continue;
-    Eigen::Vector3d half = Eigen::Vector3d(0.5, 0.5, 0.5);
-    Eigen::Vector3d ray_pt;
-    if (!raycaster.step(ray_pt)) // skip the ray start point since it's the projected point.
-      continue;
-    while (raycaster.step(ray_pt))
-    {
-      Eigen::Vector3d tmp = (ray_pt + half) * resolution_;
-      set_cache_idx = setCacheOccupancy(tmp, 0);
+      /* ---------- raycast will ignore close end ray ---------- */
       if (set_cache_idx != INVALID_IDX)
       {
-        //skip overlap grids in each ray
-        if (cache_traverse_[set_cache_idx] == raycast_num_)
-          break;
+        if (cache_rayend_[set_cache_idx] == raycast_num_)
+        {
+          continue;
+        }
         else
-          cache_traverse_[set_cache_idx] = raycast_num_;
+          cache_rayend_[set_cache_idx] = raycast_num_;
+      }
+
+      //ray casting backwards from point in world frame to camera pos, 
+      //the backwards way skips the overlap grids in each ray end by recording cache_traverse_.
+      RayCaster raycaster;
+      bool need_ray = raycaster.setInput(pt_w / resolution_, t_wc / resolution_); //(ray start, ray end)
+      if (!need_ray)
+        continue;
+      Eigen::Vector3d half = Eigen::Vector3d(0.5, 0.5, 0.5);
+      Eigen::Vector3d ray_pt;
+      if (!raycaster.step(ray_pt)) // skip the ray start point since it's the projected point.
+        continue;
+      while (raycaster.step(ray_pt))
+      {
+        Eigen::Vector3d tmp = (ray_pt + half) * resolution_;
+        set_cache_idx = setCacheOccupancy(tmp, 0);
+        if (set_cache_idx != INVALID_IDX)
+        {
+          //skip overlap grids in each ray
+          if (cache_traverse_[set_cache_idx] == raycast_num_)
+            break;
+          else
+            cache_traverse_[set_cache_idx] = raycast_num_;
+        }
       }
     }
   }
 
+  auto t_update = std::chrono::high_resolution_clock::now();
+  stage_time_[STAGE_RAYCAST] += std::chrono::duration<double, std::milli>(t_update - t_raycast).count();
+
   /* ---------- update occupancy in batch ---------- */
   while (!cache_voxel_.empty())
   {
@@ -465,10 +586,124 @@ void OccMap::raycastProcess(const Eigen::Vector3d& t_wc)
     //   occupancy_buffer_[idx_ctns] = clamp_min_log_;
     // }
 
+    bool was_occupied = occupancy_buffer_[idx_ctns] > min_occupancy_log_;
     occupancy_buffer_[idx_ctns] = std::min(std::max(occupancy_buffer_[idx_ctns] + log_odds_update, clamp_min_log_), clamp_max_log_);
+    if (was_occupied != (occupancy_buffer_[idx_ctns] > min_occupancy_log_))
+      voxelStateChanged(idx, !was_occupied);
+  }
+  stage_time_[STAGE_UPDATE] += std::chrono::duration<double, std::milli>(
+                                 std::chrono::high_resolution_clock::now() - t_update).count();
+}
+
+// The rays of points [begin, end) for one fusion thread. The voxels they visit go to visits instead of 
+// the shared caches, only the stamps that end a ray at voxels already visited in this frame are shared
+void OccMap::castRays(const Eigen::Vector3d& t_wc, const vector<Eigen::Vector3d>& points, int begin, int end, vector<RayVisit>& visits)
+{
+  visits.clear();
+  Eigen::Vector3d half = Eigen::Vector3d(0.5, 0.5, 0.5);
+  Eigen::Vector3d ray_pt;
+  for (int i = begin; i < end; ++i)
+  {
+    Eigen::Vector3d pt_w = points[i];
+    double length = (pt_w - t_wc).norm();
+    if (length < min_ray_length_)
+      continue;
+    int occ = 1;
+    if (length > max_ray_length_)
+    {
+      pt_w = (pt_w - t_wc) / length * max_ray_length_ + t_wc;
+      occ = 0;
+    }
+    int address = visitVoxel(pt_w, occ, visits);
+    if (address != INVALID_IDX && stampVisit(cache_rayend_, address))
+      continue;
+
+    RayCaster raycaster;
+    if (!raycaster.setInput(pt_w / resolution_, t_wc / resolution_))
+      continue;
+    if (!raycaster.step(ray_pt))
+      continue;
+    while (raycaster.step(ray_pt))
+    {
+      address = visitVoxel((ray_pt + half) * resolution_, 0, visits);
+      if (address != INVALID_IDX && stampVisit(cache_traverse_, address))
+        break;
+    }
+  }
+}
+
+inline int OccMap::visitVoxel(const Eigen::Vector3d &pos, int occ, vector<RayVisit>& visits)
+{
+  RayVisit visit;
+  posToIndex(pos, visit.id);
+  if (!isInMap(visit.id))
+    return INVALID_IDX;
+  visit.address = idxToAddress(visit.id);
+  visit.occ = occ;
+  visits.push_back(visit);
+  return visit.address;
+}
+
+// true if a ray of this frame has been there already, otherwise the voxel is stamped. Relaxed atomic
+// accesses since all fusion threads stamp, a visit missed between the load and the store only makes
+// a ray run a bit longer
+inline bool OccMap::stampVisit(vector<uint16_t> &stamps, int address)
+{
+  uint16_t stamp = raycast_num_;
+  if (__atomic_load_n(&stamps[address], __ATOMIC_RELAXED) == stamp)
+    return true;
+  __atomic_store_n(&stamps[address], stamp, __ATOMIC_RELAXED);
+  return false;
+}
+
+void OccMap::integrateFrame(const Eigen::Vector3d &center, const Eigen::Vector3d &t_wc, 
+                            const vector<Eigen::Vector3d> &points, int points_cnt)
+{
+  WriteLock map_lock(map_mutex_);
+  if (rolling_)
+    moveWindow(center);
+  raycastProcess(t_wc, points, points_cnt);
+  auto t_esdf = std::chrono::high_resolution_clock::now();
+  if (use_esdf_)
+    updateESDF();
+  stage_time_[STAGE_ESDF] += std::chrono::duration<double, std::milli>(
+                               std::chrono::high_resolution_clock::now() - t_esdf).count();
+}
+
+// integrates the frames handed over by depthOdomCallback, one at a time
+void OccMap::fusionLoop()
+{
+  std::unique_lock<std::mutex> lock(fusion_mutex_);
+  while (true)
+  {
+    fusion_cv_.wait(lock, [this] { return fusion_pending_ || fusion_stop_; });
+    if (fusion_stop_)
+      return;
+    lock.unlock();
+    integrateFrame(fusion_center_, fusion_t_wc_, fusion_points_, fusion_points_cnt_);
+    lock.lock();
+    fusion_pending_ = false;
+    fusion_cv_.notify_all();
   }
 }
 
+// mean time per frame of each fusion stage, every 100 frames
+void OccMap::reportFusionLatency()
+{
+  if (++stage_frames_ < 100)
+    return;
+  if (show_fusion_latency_)
+  {
+    static const char *stage_names[STAGE_NUM] = {"convert", "project", "wait", "raycast", "update", "esdf"};
+    std::ostringstream ss;
+    for (int i = 0; i < STAGE_NUM; ++i)
+      ss << (i == 0 ? "" : ", ") << stage_names[i] << " " << stage_time_[i] / stage_frames_;
+    ROS_INFO_STREAM("[occ_map] fusion latency (ms): " << ss.str());
+  }
+  std::fill(stage_time_, stage_time_ + STAGE_NUM, 0.0);
+  stage_frames_ = 0;
+}
+
 inline int OccMap::setCacheOccupancy(const Eigen::Vector3d &pos, int occ)
 {
   if (occ != 1 && occ != 0)
@@ -485,7 +720,15 @@ inline int OccMap::setCacheOccupancy(const Eigen::Vector3d &pos, int occ)
   }
 
   int idx_ctns = idxToAddress(id);
+  addCacheOccupancy(id, idx_ctns, occ);
+  return idx_ctns;
+}
 
+inline void OccMap::addCacheOccupancy(const Eigen::Vector3i &id, int idx_ctns, int occ)
+{
+  // the counters saturate, only the share of hits is used
+  if (cache_all_[idx_ctns] == std::numeric_limits<uint16_t>::max())
+    return;
   cache_all_[idx_ctns] += 1;
 
   if (cache_all_[idx_ctns] == 1)
@@ -497,7 +740,6 @@ inline int OccMap::setCacheOccupancy(const Eigen::Vector3d &pos, int occ)
   {
     cache_hit_[idx_ctns] += 1;
   }
-  return idx_ctns;
 }
 
 void OccMap::inflate(const Eigen::Vector3i &min_idx, const Eigen::Vector3i &max_idx)
@@ -531,11 +773,183 @@ void OccMap::inflate(const Eigen::Vector3i &min_idx, const Eigen::Vector3i &max_
   }
 }
 
+// Only voxels within esdf_max_dist_ of a changed voxel can get a different (clamped) distance, and
+// their closest site lies within another esdf_max_dist_. So the transform runs on the changed box
+// grown by twice that and only the box grown once is written back.
+void OccMap::updateESDF()
+{
+  if (!esdf_need_update_)
+    return;
+  esdf_need_update_ = false;
+
+  int margin = ceil(esdf_max_dist_ * resolution_inv_);
+  Eigen::Vector3i inner_min, inner_max, box_min, box_max;
+  for (int i = 0; i < 3; ++i)
+  {
+    inner_min[i] = max(esdf_update_min_[i] - margin, 0);
+    inner_max[i] = min(esdf_update_max_[i] + margin, grid_size_[i] - 1);
+    box_min[i] = max(esdf_update_min_[i] - 2 * margin, 0);
+    box_max[i] = min(esdf_update_max_[i] + 2 * margin, grid_size_[i] - 1);
+  }
+  Eigen::Vector3i box_size = box_max - box_min + Eigen::Vector3i::Ones();
+  computeSqrDist(box_min, box_size, true, esdf_sqr_pos_);
+  computeSqrDist(box_min, box_size, false, esdf_sqr_neg_);
+
+  for (int x = inner_min[0]; x <= inner_max[0]; ++x)
+    for (int y = inner_min[1]; y <= inner_max[1]; ++y)
+    {
+      int box_addr = ((x - box_min[0]) * box_size[1] + (y - box_min[1])) * box_size[2] + (inner_min[2] - box_min[2]);
+      for (int z = inner_min[2]; z <= inner_max[2]; ++z, ++box_addr)
+      {
+        double dist = sqrt(esdf_sqr_pos_[box_addr]) * resolution_;
+        // occupied voxel, zero on the obstacle surface
+        if (esdf_sqr_neg_[box_addr] > 0.0)
+          dist += resolution_ - sqrt(esdf_sqr_neg_[box_addr]) * resolution_;
+        distance_buffer_[idxToAddress(x, y, z)] = max(-esdf_max_dist_, min(dist, esdf_max_dist_));
+      }
+    }
+}
+
+// squared distance in voxels from each voxel of the box to the closest occupied (or free) voxel in it,
+// exact and separable, one pass of fillESDFLine() along z, y and x
+void OccMap::computeSqrDist(const Eigen::Vector3i &box_min, const Eigen::Vector3i &box_size, bool to_occupied, std::vector<double> &sqr_dist)
+{
+  // larger than any squared distance in the map, keeps the parabola intersections finite
+  const double no_site = 1e10;
+  int nx = box_size[0], ny = box_size[1], nz = box_size[2];
+  sqr_dist.resize(nx * ny * nz);
+  int n_max = box_size.maxCoeff();
+  esdf_line_f_.resize(n_max);
+  esdf_line_d_.resize(n_max);
+  esdf_line_v_.resize(n_max);
+  esdf_line_z_.resize(n_max + 1);
+
+  for (int x = 0; x < nx; ++x)
+    for (int y = 0; y < ny; ++y)
+    {
+      for (int z = 0; z < nz; ++z)
+      {
+        bool occupied = occupancy_buffer_[idxToAddress(box_min[0] + x, box_min[1] + y, box_min[2] + z)] > min_occupancy_log_;
+        esdf_line_f_[z] = occupied == to_occupied ? 0.0 : no_site;
+      }
+      fillESDFLine(nz);
+      std::copy(esdf_line_d_.begin(), esdf_line_d_.begin() + nz, sqr_dist.begin() + (x * ny + y) * nz);
+    }
+
+  for (int x = 0; x < nx; ++x)
+    for (int z = 0; z < nz; ++z)
+    {
+      for (int y = 0; y < ny; ++y)
+        esdf_line_f_[y] = sqr_dist[(x * ny + y) * nz + z];
+      fillESDFLine(ny);
+      for (int y = 0; y < ny; ++y)
+        sqr_dist[(x * ny + y) * nz + z] = esdf_line_d_[y];
+    }
+
+  for (int y = 0; y < ny; ++y)
+    for (int z = 0; z < nz; ++z)
+    {
+      for (int x = 0; x < nx; ++x)
+        esdf_line_f_[x] = sqr_dist[(x * ny + y) * nz + z];
+      fillESDFLine(nx);
+      for (int x = 0; x < nx; ++x)
+        sqr_dist[(x * ny + y) * nz + z] = esdf_line_d_[x];
+    }
+}
+
+// 1D squared distance transform of esdf_line_f_ into esdf_line_d_ (Felzenszwalb and Huttenlocher),
+// lower envelope of the parabolas rooted at each q with height f(q)
+void OccMap::fillESDFLine(int n)
+{
+  const vector<double> &f = esdf_line_f_;
+  vector<int> &v = esdf_line_v_;
+  vector<double> &z = esdf_line_z_;
+  int k = 0;
+  v[0] = 0;
+  z[0] = -std::numeric_limits<double>::max();
+  z[1] = std::numeric_limits<double>::max();
+  for (int q = 1; q < n; ++q)
+  {
+    double s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    while (s <= z[k])
+    {
+      --k;
+      s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    }
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = std::numeric_limits<double>::max();
+  }
+
+  k = 0;
+  for (int q = 0; q < n; ++q)
+  {
+    while (z[k + 1] < q)
+      ++k;
+    esdf_line_d_[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+}
+
+double OccMap::getDistWithGrad(const Eigen::Vector3d &pos, Eigen::Vector3d &grad)
+{
+  if (!use_esdf_)
+  {
+    grad.setZero();
+    return esdf_max_dist_;
+  }
+
+  /* interpolate between the 8 voxel centers around pos */
+  Eigen::Vector3d pos_m = pos - 0.5 * resolution_ * Eigen::Vector3d::Ones();
+  Eigen::Vector3i idx;
+  Eigen::Vector3d idx_pos;
+  posToIndex(pos_m, idx);
+  indexToPos(idx, idx_pos);
+  Eigen::Vector3d diff = (pos - idx_pos) * resolution_inv_;
+
+  double values[2][2][2];
+  for (int x = 0; x < 2; x++)
+    for (int y = 0; y < 2; y++)
+      for (int z = 0; z < 2; z++)
+        values[x][y][z] = getDistance(Eigen::Vector3i(idx + Eigen::Vector3i(x, y, z)));
+
+  double v00 = (1 - diff[0]) * values[0][0][0] + diff[0] * values[1][0][0];
+  double v01 = (1 - diff[0]) * values[0][0][1] + diff[0] * values[1][0][1];
+  double v10 = (1 - diff[0]) * values[0][1][0] + diff[0] * values[1][1][0];
+  double v11 = (1 - diff[0]) * values[0][1][1] + diff[0] * values[1][1][1];
+  double v0 = (1 - diff[1]) * v00 + diff[1] * v10;
+  double v1 = (1 - diff[1]) * v01 + diff[1] * v11;
+  double dist = (1 - diff[2]) * v0 + diff[2] * v1;
+
+  grad[2] = (v1 - v0) * resolution_inv_;
+  grad[1] = ((1 - diff[2]) * (v10 - v00) + diff[2] * (v11 - v01)) * resolution_inv_;
+  grad[0] = (1 - diff[2]) * (1 - diff[1]) * (values[1][0][0] - values[0][0][0]);
+  grad[0] += (1 - diff[2]) * diff[1] * (values[1][1][0] - values[0][1][0]);
+  grad[0] += diff[2] * (1 - diff[1]) * (values[1][0][1] - values[0][0][1]);
+  grad[0] += diff[2] * diff[1] * (values[1][1][1] - values[0][1][1]);
+  grad[0] *= resolution_inv_;
+
+  return dist;
+}
+
 /*
 * return squared distance
 */
 float OccMap::nearestObs(const double &x, const double &y, const double &z, float &x_obs, float &y_obs, float &z_obs)
 {
+  if (use_esdf_)
+  {
+    // the obstacle lies down the gradient, distances beyond esdf_max_dist_ are reported as esdf_max_dist_
+    Eigen::Vector3d pos(x, y, z), grad;
+    double dist = max(getDistWithGrad(pos, grad), 0.0);
+    double grad_norm = grad.norm();
+    Eigen::Vector3d obs = grad_norm > 1e-6 ? Eigen::Vector3d(pos - grad / grad_norm * dist) : pos;
+    x_obs = obs[0];
+    y_obs = obs[1];
+    z_obs = obs[2];
+    return dist * dist;
+  }
+
   pcl::PointXYZ searchPoint;
   searchPoint.x = x;
   searchPoint.y = y;
@@ -557,6 +971,139 @@ float OccMap::nearestObs(const double &x, const double &y, const double &z, floa
   }
 }
 
+// The window moves in whole voxels once center is rolling_shift_dist_ off its middle. The slices scrolling
+// out release their obstacles and their slots of the ring are reused, cleared, for the slices scrolling in.
+void OccMap::moveWindow(const Eigen::Vector3d &center)
+{
+  Eigen::Vector3i center_id;
+  posToIndex(center, center_id);
+  Eigen::Vector3i shift(center_id[0] - grid_size_[0] / 2, center_id[1] - grid_size_[1] / 2, 0);
+  if (abs(shift[0]) < rolling_shift_num_ && abs(shift[1]) < rolling_shift_num_)
+    return;
+
+  /* ranges [lo, hi) per axis of the voxels leaving and kept (indices before the move), 
+   * entering and kept (indices after the move) */
+  int out_lo[2], out_hi[2], keep_lo[2], keep_hi[2], in_lo[2], in_hi[2], kept_lo[2], kept_hi[2];
+  for (int i = 0; i < 2; ++i)
+  {
+    int n = grid_size_[i], s = max(-n, min(shift[i], n));
+    if (s >= 0)
+    {
+      out_lo[i] = 0;       out_hi[i] = s;
+      keep_lo[i] = s;      keep_hi[i] = n;
+      in_lo[i] = n - s;    in_hi[i] = n;
+      kept_lo[i] = 0;      kept_hi[i] = n - s;
+    }
+    else
+    {
+      out_lo[i] = n + s;   out_hi[i] = n;
+      keep_lo[i] = 0;      keep_hi[i] = n + s;
+      in_lo[i] = 0;        in_hi[i] = -s;
+      kept_lo[i] = -s;     kept_hi[i] = n;
+    }
+  }
+  // the x slab, then the y slab over the x range that stays
+  Eigen::Vector3i box_lo[2], box_hi[2];
+  box_lo[0] = Eigen::Vector3i(out_lo[0], 0, 0);
+  box_hi[0] = Eigen::Vector3i(out_hi[0], grid_size_[1], grid_size_[2]);
+  box_lo[1] = Eigen::Vector3i(keep_lo[0], out_lo[1], 0);
+  box_hi[1] = Eigen::Vector3i(keep_hi[0], out_hi[1], grid_size_[2]);
+
+  /* obstacles leaving first, so that the layers derived from them are released while the slots are still valid */
+  for (int b = 0; b < 2; ++b)
+    for (int x = box_lo[b][0]; x < box_hi[b][0]; ++x)
+      for (int y = box_lo[b][1]; y < box_hi[b][1]; ++y)
+        for (int z = box_lo[b][2]; z < box_hi[b][2]; ++z)
+          if (occupancy_buffer_[idxToAddress(x, y, z)] > min_occupancy_log_)
+            voxelStateChanged(Eigen::Vector3i(x, y, z), false);
+  for (int b = 0; b < 2; ++b)
+    for (int x = box_lo[b][0]; x < box_hi[b][0]; ++x)
+      for (int y = box_lo[b][1]; y < box_hi[b][1]; ++y)
+        for (int z = box_lo[b][2]; z < box_hi[b][2]; ++z)
+        {
+          int address = idxToAddress(x, y, z);
+          occupancy_buffer_[address] = clamp_min_log_;
+          cache_hit_[address] = cache_all_[address] = 0;
+          cache_rayend_[address] = cache_traverse_[address] = 0;
+          inflate_occupancy_[address] = false;
+          if (incremental_inflation_)
+            inflate_count_[address] = 0;
+          if (use_esdf_)
+            distance_buffer_[address] = esdf_max_dist_;
+        }
+
+  /* move */
+  for (int i = 0; i < 2; ++i)
+  {
+    window_min_id_[i] += shift[i];
+    ring_offset_[i] = (window_min_id_[i] % grid_size_[i] + grid_size_[i]) % grid_size_[i];
+    origin_[i] = window_min_id_[i] * resolution_;
+    min_range_[i] = origin_[i];
+    max_range_[i] = origin_[i] + map_size_[i];
+  }
+  if (esdf_need_update_)
+  {
+    esdf_update_min_ -= shift;
+    esdf_update_max_ -= shift;
+  }
+
+  /* entering slices, all free but for the floor */
+  box_lo[0] = Eigen::Vector3i(in_lo[0], 0, 0);
+  box_hi[0] = Eigen::Vector3i(in_hi[0], grid_size_[1], grid_size_[2]);
+  box_lo[1] = Eigen::Vector3i(kept_lo[0], in_lo[1], 0);
+  box_hi[1] = Eigen::Vector3i(kept_hi[0], in_hi[1], grid_size_[2]);
+  for (int b = 0; b < 2; ++b)
+  {
+    if ((box_lo[b].array() >= box_hi[b].array()).any())
+      continue;
+    if (incremental_inflation_)
+      countInflation(box_lo[b], box_hi[b]);
+    markESDFUpdate(box_lo[b]);
+    markESDFUpdate(box_hi[b] - Eigen::Vector3i::Ones());
+  }
+  for (int b = 0; b < 2; ++b)
+    for (int x = box_lo[b][0]; x < box_hi[b][0]; ++x)
+      for (int y = box_lo[b][1]; y < box_hi[b][1]; ++y)
+      {
+        occupancy_buffer_[idxToAddress(x, y, 0)] = clamp_max_log_;
+        voxelStateChanged(Eigen::Vector3i(x, y, 0), true);
+      }
+}
+
+// inflation counters of the voxels in [box_lo, box_hi) from scratch
+void OccMap::countInflation(const Eigen::Vector3i &box_lo, const Eigen::Vector3i &box_hi)
+{
+  for (int x = box_lo[0]; x < box_hi[0]; ++x)
+    for (int y = box_lo[1]; y < box_hi[1]; ++y)
+      for (int z = box_lo[2]; z < box_hi[2]; ++z)
+      {
+        int count = 0;
+        for (int nx = max(x - inflate_num_, 0); nx <= min(x + inflate_num_, grid_size_[0] - 1); ++nx)
+          for (int ny = max(y - inflate_num_, 0); ny <= min(y + inflate_num_, grid_size_[1] - 1); ++ny)
+            for (int nz = max(z - inflate_num_, 0); nz <= min(z + inflate_num_, grid_size_[2] - 1); ++nz)
+              count += occupancy_buffer_[idxToAddress(nx, ny, nz)] > min_occupancy_log_;
+        int address = idxToAddress(x, y, z);
+        inflate_count_[address] = count;
+        inflate_occupancy_[address] = count > 0;
+      }
+}
+
+void OccMap::getMemoryUsage(vector<pair<string, size_t>> &layers)
+{
+  layers.clear();
+  layers.emplace_back("occupancy", occupancy_buffer_.capacity() * sizeof(float));
+  layers.emplace_back("raycast caches", (cache_hit_.capacity() + cache_all_.capacity() + 
+                                         cache_traverse_.capacity() + cache_rayend_.capacity()) * sizeof(uint16_t));
+  layers.emplace_back("inflated occupancy", inflate_occupancy_.capacity() / 8);
+  layers.emplace_back("inflation counters", inflate_count_.capacity() * sizeof(uint16_t));
+  size_t ray_visits = 0;
+  for (const auto &visits : ray_visits_)
+    ray_visits += visits.capacity() * sizeof(RayVisit);
+  layers.emplace_back("fusion buffers", (proj_points_.capacity() + fusion_points_.capacity()) * sizeof(Eigen::Vector3d) + ray_visits);
+  layers.emplace_back("esdf", distance_buffer_.capacity() * sizeof(float) + 
+                              (esdf_sqr_pos_.capacity() + esdf_sqr_neg_.capacity()) * sizeof(double));
+}
+
 void OccMap::indepOdomCallback(const nav_msgs::OdometryConstPtr& odom)
 {
 	latest_odom_time_ = odom->header.stamp;
@@ -573,6 +1120,13 @@ void OccMap::indepOdomCallback(const nav_msgs::OdometryConstPtr& odom)
 	have_odom_ = true;
   local_range_min_ = curr_posi_ - sensor_range_;
   local_range_max_ = curr_posi_ + sensor_range_;
+  if (rolling_)
+  {
+    WriteLock map_lock(map_mutex_);
+    moveWindow(curr_posi_);
+    if (use_esdf_)
+      updateESDF();
+  }
 
   index_xyz[0] = ceil((curr_posi_[0]-min_range_[0])/resolution_);
   index_xyz[1] = ceil((curr_posi_[1]-min_range_[1])/resolution_);
@@ -643,6 +1197,8 @@ void OccMap::globalCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
   if (global_cloud.points.size() == 0)
     return;
 
+  // occupancy, esdf, inflation and kd-tree are all rebuilt, planners wait for the whole of it
+  WriteLock map_lock(map_mutex_);
   pcl::PointXYZ pt;
   Eigen::Vector3d p3d;
   for (size_t i = 0; i < global_cloud.points.size(); ++i)
@@ -651,6 +1207,8 @@ void OccMap::globalCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
     p3d(0) = pt.x; p3d(1) = pt.y; p3d(2) = pt.z;
     this->setOccupancy(p3d);
   }
+  if (use_esdf_)
+    updateESDF();
   //has_global_cloud_ = true;
   //global_cloud_sub_.shutdown();     //这里原本是没有注释的  这里会结束回调  后面点云图更新后  却没有膨胀
 
@@ -660,10 +1218,14 @@ void OccMap::globalCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
   //inflate_idx_lower = index_xyz - Eigen::Vector3i((inflate_radius_/resolution_),(inflate_radius_/resolution_),10);
   //inflate_idx_upper = index_xyz + Eigen::Vector3i((inflate_radius_/resolution_),(inflate_radius_/resolution_),20);
   
-  setupInflationRange(index_xyz);
-  //ROS_INFO("lower:%d %d %d", inflate_idx_lower[0],inflate_idx_lower[1],inflate_idx_lower[2]);
-  //ROS_INFO("upper:%d %d %d", inflate_idx_upper[0],inflate_idx_upper[1],inflate_idx_upper[2]);
-  inflate(inflate_idx_lower, inflate_idx_upper);
+  // the incremental inflation is up to date already, the kd-tree below is still needed
+  if (!incremental_inflation_)
+  {
+    setupInflationRange(index_xyz);
+    //ROS_INFO("lower:%d %d %d", inflate_idx_lower[0],inflate_idx_lower[1],inflate_idx_lower[2]);
+    //ROS_INFO("upper:%d %d %d", inflate_idx_upper[0],inflate_idx_upper[1],inflate_idx_upper[2]);
+    inflate(inflate_idx_lower, inflate_idx_upper);
+  }
   //inflate(Eigen::Vector3i(0,0,0), grid_size_);   //看这里   改膨胀系数
   auto te_global_inflate = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> diff_global_inflate = te_global_inflate - ts_global_inflate;
@@ -711,6 +1273,19 @@ void OccMap::globalCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
   // std::cout << ": " << diff1.count() << " us\n";
 }
 
+OccMap::~OccMap()
+{
+  if (fusion_worker_.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(fusion_mutex_);
+      fusion_stop_ = true;
+    }
+    fusion_cv_.notify_all();
+    fusion_worker_.join();
+  }
+}
+
 void OccMap::init(const ros::NodeHandle& nh)
 {
   node_ = nh;
@@ -748,6 +1323,15 @@ void OccMap::init(const ros::NodeHandle& nh)
   node_.param("occ_map/min_occupancy_log", min_occupancy_log_, 0.80);
   node_.param("occ_map/inflate_length", inflate_length_, 0.0);
   node_.param("occ_map/inflate_radius", inflate_radius_, 100.0);
+  node_.param("occ_map/incremental_inflation", incremental_inflation_, false);
+  node_.param("occ_map/use_esdf", use_esdf_, false);
+  node_.param("occ_map/bricked_layout", bricked_layout_, false);
+  node_.param("occ_map/rolling", rolling_, false);
+  node_.param("occ_map/rolling_shift_dist", rolling_shift_dist_, 1.0);
+  node_.param("occ_map/esdf_max_dist", esdf_max_dist_, 2.0);
+  node_.param("occ_map/fusion_threads", fusion_threads_, 1);
+  node_.param("occ_map/pipelined_fusion", pipelined_fusion_, false);
+  node_.param("occ_map/show_fusion_latency", show_fusion_latency_, false);
 
 
   node_.param("occ_map/fx", fx_, -1.0);
@@ -770,6 +1354,17 @@ void OccMap::init(const ros::NodeHandle& nh)
 	cout << "sensor_range: " << sensor_range_.transpose() << endl;
   cout << "inflate_length_: " << inflate_length_ << endl;
   cout << "inflate_radius_: " << inflate_radius_ << endl;
+  cout << "incremental_inflation_: " << incremental_inflation_ << endl;
+  cout << "use_esdf_: " << use_esdf_ << endl;
+  cout << "esdf_max_dist_: " << esdf_max_dist_ << endl;
+  cout << "bricked_layout_: " << bricked_layout_ << endl;
+  cout << "rolling_: " << rolling_ << endl;
+  cout << "rolling_shift_dist_: " << rolling_shift_dist_ << endl;
+  // 0 takes one thread per core
+  if (fusion_threads_ <= 0)
+    fusion_threads_ = max(1, (int)std::thread::hardware_concurrency());
+  cout << "fusion_threads_: " << fusion_threads_ << endl;
+  cout << "pipelined_fusion_: " << pipelined_fusion_ << endl;
 
   /* ---------- setting ---------- */
   have_odom_ = false;
@@ -777,6 +1372,7 @@ void OccMap::init(const ros::NodeHandle& nh)
   local_map_valid_ = false;
   has_global_cloud_ = false;
   has_first_depth_ = false;
+  esdf_need_update_ = false;
 
   resolution_inv_ = 1 / resolution_;
   for (int i = 0; i < 3; ++i)
@@ -785,6 +1381,19 @@ void OccMap::init(const ros::NodeHandle& nh)
     sensor_range_grid_cnt_[i] = floor(sensor_range_[i] * resolution_inv_);
   }
   cout << "grid size: " << grid_size_.transpose() << endl;
+  if (rolling_)
+  {
+    // voxels stay on the world grid while the window moves, map_size_x/y give the window size
+    rolling_shift_num_ = max(1, (int)floor(rolling_shift_dist_ * resolution_inv_));
+    window_min_id_ = Eigen::Vector3i::Zero();
+    ring_offset_ = Eigen::Vector3i::Zero();
+    for (int i = 0; i < 2; ++i)
+    {
+      window_min_id_[i] = floor(origin_(i) * resolution_inv_ + 0.5);
+      ring_offset_[i] = (window_min_id_[i] % grid_size_[i] + grid_size_[i]) % grid_size_[i];
+      origin_(i) = window_min_id_[i] * resolution_;
+    }
+  }
   curr_view_cloud_ptr_ = boost::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
   history_view_cloud_ptr_ = boost::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
   T_ic0_ << 0.0, 0.0, 1.0, 0.0,
@@ -812,6 +1421,13 @@ void OccMap::init(const ros::NodeHandle& nh)
   // initialize size of buffer
   grid_size_y_multiply_z_ = grid_size_(1) * grid_size_(2);
   int buffer_size = grid_size_(0) * grid_size_y_multiply_z_;
+  if (bricked_layout_)
+  {
+    // whole bricks, the grid is padded up to a multiple of 8 voxels
+    brick_num_z_ = (grid_size_(2) + 7) / 8;
+    brick_num_yz_ = ((grid_size_(1) + 7) / 8) * brick_num_z_;
+    buffer_size = ((grid_size_(0) + 7) / 8) * brick_num_yz_ * 512;
+  }
   cout << "buffer size: " << buffer_size << endl;
   occupancy_buffer_.resize(buffer_size);
   cache_all_.resize(buffer_size);
@@ -820,39 +1436,73 @@ void OccMap::init(const ros::NodeHandle& nh)
   cache_traverse_.resize(buffer_size);
   raycast_num_ = 0;
   proj_points_cnt_ = 0;
+  fusion_points_cnt_ = 0;
+  fusion_pending_ = false;
+  fusion_stop_ = false;
+  std::fill(stage_time_, stage_time_ + STAGE_NUM, 0.0);
+  stage_frames_ = 0;
 
   fill(occupancy_buffer_.begin(), occupancy_buffer_.end(), clamp_min_log_);
   fill(cache_all_.begin(), cache_all_.end(), 0);
   fill(cache_hit_.begin(), cache_hit_.end(), 0);
-  fill(cache_rayend_.begin(), cache_rayend_.end(), -1);
-  fill(cache_traverse_.begin(), cache_traverse_.end(), -1);
+  fill(cache_rayend_.begin(), cache_rayend_.end(), 0);
+  fill(cache_traverse_.begin(), cache_traverse_.end(), 0);
 
   inflate_occupancy_.resize(buffer_size);
   fill(inflate_occupancy_.begin(), inflate_occupancy_.end(), false);
 
-  //set x-y boundary occ
-  for (double cx = min_range_[0]+resolution_/2; cx <= max_range_[0]-resolution_/2; cx += resolution_)
-    for (double cz = min_range_[2]+resolution_/2; cz <= max_range_[2]-resolution_/2; cz += resolution_)
-    {
-      this->setOccupancy(Eigen::Vector3d(cx, min_range_[1]+resolution_/2, cz));
-      this->setOccupancy(Eigen::Vector3d(cx, max_range_[1]-resolution_/2, cz));
-    }
-  for (double cy = min_range_[1]+resolution_/2; cy <= max_range_[1]-resolution_/2; cy += resolution_)
-    for (double cz = min_range_[2]+resolution_/2; cz <= max_range_[2]-resolution_/2; cz += resolution_)
-    {
-      this->setOccupancy(Eigen::Vector3d(min_range_[0]+resolution_/2, cy, cz));
-      this->setOccupancy(Eigen::Vector3d(max_range_[0]-resolution_/2, cy, cz));
-    }
+  inflate_num_ = ceil(inflate_length_ * resolution_inv_);
+  if (incremental_inflation_ && (2 * inflate_num_ + 1) * (2 * inflate_num_ + 1) * (2 * inflate_num_ + 1) > std::numeric_limits<uint16_t>::max())
+  {
+    ROS_WARN("[occ_map] inflate_length too large for the inflation counters, inflating from the global cloud only");
+    incremental_inflation_ = false;
+  }
+  if (incremental_inflation_)
+    inflate_count_.resize(buffer_size, 0);
+
+  if (use_esdf_)
+    distance_buffer_.resize(buffer_size, esdf_max_dist_);
+
+  //set x-y boundary occ, the window border of a rolling map is no wall
+  if (!rolling_)
+  {
+    for (double cx = min_range_[0]+resolution_/2; cx <= max_range_[0]-resolution_/2; cx += resolution_)
+      for (double cz = min_range_[2]+resolution_/2; cz <= max_range_[2]-resolution_/2; cz += resolution_)
+      {
+        this->setOccupancy(Eigen::Vector3d(cx, min_range_[1]+resolution_/2, cz));
+        this->setOccupancy(Eigen::Vector3d(cx, max_range_[1]-resolution_/2, cz));
+      }
+    for (double cy = min_range_[1]+resolution_/2; cy <= max_range_[1]-resolution_/2; cy += resolution_)
+      for (double cz = min_range_[2]+resolution_/2; cz <= max_range_[2]-resolution_/2; cz += resolution_)
+      {
+        this->setOccupancy(Eigen::Vector3d(min_range_[0]+resolution_/2, cy, cz));
+        this->setOccupancy(Eigen::Vector3d(max_range_[0]-resolution_/2, cy, cz));
+      }
+  }
   //set z-low boundary occ
   for (double cx = min_range_[0]+resolution_/2; cx <= max_range_[0]-resolution_/2; cx += resolution_)
     for (double cy = min_range_[1]+resolution_/2; cy <= max_range_[1]-resolution_/2; cy += resolution_)
     {
       this->setOccupancy(Eigen::Vector3d(cx, cy, min_range_[2]+resolution_/2));
     }
+  if (use_esdf_)
+  {
+    // the walls cover the whole map, no need to keep scratch buffers of that size
+    updateESDF();
+    vector<double>().swap(esdf_sqr_pos_);
+    vector<double>().swap(esdf_sqr_neg_);
+  }
 
     /* ---------- sub and pub ---------- */
 	if (!use_global_map_)
 	{
+    project_pool_.reset(new ThreadPool(fusion_threads_));
+    raycast_pool_ = project_pool_;
+    if (pipelined_fusion_)
+    {
+      raycast_pool_.reset(new ThreadPool(fusion_threads_));
+      fusion_worker_ = std::thread(&OccMap::fusionLoop, this);
+    }
     depth_sub_.reset(new message_filters::Subscriber<sensor_msgs::Image>(node_, "/depth_topic", 1, ros::TransportHints().tcpNoDelay()));
     odom_sub_.reset(new message_filters::Subscriber<nav_msgs::Odometry>(node_, "/odom_topic", 1, ros::TransportHints().tcpNoDelay()));
     sync_image_odom_.reset(new message_filters::Synchronizer<SyncPolicyImageOdom>(SyncPolicyImageOdom(100), *depth_sub_, *odom_sub_));
@@ -872,6 +1522,10 @@ void OccMap::init(const ros::NodeHandle& nh)
 	origin_pcl_pub_ = node_.advertise<sensor_msgs::PointCloud2>("/occ_map/raw_pcl", 1);
   projected_pc_pub_ = node_.advertise<sensor_msgs::PointCloud2>("/occ_map/filtered_pcl", 1);
 
+  vector<pair<string, size_t>> layers;
+  getMemoryUsage(layers);
+  for (const auto &layer : layers)
+    cout << "memory of " << layer.first << ": " << layer.second / 1048576.0 << " MB" << endl;
   cout << "map initialized: " << endl;
 }
 
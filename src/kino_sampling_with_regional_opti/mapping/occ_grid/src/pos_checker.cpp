@@ -3,6 +3,14 @@
 
 namespace kino_planner
 {
+// Candidate segments are checked from the planner's worker threads,
+// so each thread keeps its own sample buffers
+static TrajSamples &sampleBuffer()
+{
+  static thread_local TrajSamples samples;
+  return samples;
+}
+
 bool PosChecker::validateASample(const StatePVA &sample)
 {
   /* test time usage */
@@ -150,12 +158,14 @@ bool PosChecker::checkPolySeg(const Piece &seg)
   double tau = seg.getDuration();
   Vector3d head_vel = seg.getVel(0.0);
   Vector3d tail_vel = seg.getVel(tau);
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  seg.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
     Vector3d pos, vel, acc;
-    pos = seg.getPos(t);
-    vel = seg.getVel(t);
-    acc = seg.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
     if (!checkState(pos, vel, acc))
       return false;
       
@@ -175,12 +185,14 @@ bool PosChecker::checkPolySeg(const Piece &seg, double t_s, double t_e)
   }
   Vector3d head_vel = seg.getVel(t_s);
   Vector3d tail_vel = seg.getVel(t_e);
-  for (double t = t_s; t <= t_e; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  seg.sampleBatch(t_s, dt_, stampNum(t_s, t_e), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
     Vector3d pos, vel, acc;
-    pos = seg.getPos(t);
-    vel = seg.getVel(t);
-    acc = seg.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
     if (!checkState(pos, vel, acc))
       return false;
     
@@ -201,12 +213,14 @@ bool PosChecker::checkPolySeg(const Piece &seg, vector<pair<Vector3d, Vector3d>>
   Vector3d head_vel = seg.getVel(0.0);
   Vector3d tail_vel = seg.getVel(tau);
 
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  seg.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
     Eigen::Vector3d pos, vel, acc;
-    pos = seg.getPos(t);
-    vel = seg.getVel(t);
-    acc = seg.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
     if (!zigzag)
     {
       if (vel.dot(head_vel) < 0 && vel.dot(tail_vel) < 0)
@@ -250,14 +264,17 @@ bool PosChecker::checkPolySeg(const Piece &seg, pair<Vector3d, Vector3d> &collid
 
   //ROS_INFO("head_vel: %lf,%lf,%lf", head_vel[0],head_vel[1],head_vel[2]);
   //ROS_INFO("tail_vel: %lf,%lf,%lf", tail_vel[0],tail_vel[1],tail_vel[2]);
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  seg.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
+    double t = samples.t(i);
     //Eigen::Vector3d testvec(1,2,3);
     //ROS_INFO("testvec:%lf", testvec.dot());
     Eigen::Vector3d pos, vel, acc;
-    pos = seg.getPos(t);
-    vel = seg.getVel(t);
-    acc = seg.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
 
     //ROS_INFO("vel:%lf, %lf, %lf", vel[0], vel[1], vel[2]);
     //ROS_INFO("veldot:%lf, %lf", vel.dot(head_vel), vel.dot(tail_vel));
@@ -316,11 +333,14 @@ bool PosChecker::checkPolyTraj(const Trajectory &traj, double t_s, double t_e, V
     ROS_WARN_STREAM("Check time violates duration, tau: " << tau << ", t_s: " << t_s << ", t_e: " << t_e);
     return false;
   }
-  for (double t = t_s; t <= t_e; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  traj.sampleBatch(t_s, dt_, stampNum(t_s, t_e), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
+    double t = samples.t(i);
     Vector3d pos, vel, acc;
-    pos = traj.getPos(t);
-    vel = traj.getVel(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
     if (!checkState(pos, vel, acc))
     {
       remain_safe_time = t - t_s;
@@ -335,11 +355,13 @@ bool PosChecker::checkPolyTraj(const Trajectory &traj, double t_s, double t_e, V
 bool PosChecker::checkPolyTraj(const Trajectory &traj)
 {
   double tau = traj.getTotalDuration();
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  traj.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
     Vector3d pos, vel, acc;
-    pos = traj.getPos(t);
-    vel = traj.getVel(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
     if (!checkState(pos, vel, acc))
     {
       return false;
@@ -356,12 +378,14 @@ bool PosChecker::checkPolyTraj(const Trajectory &traj, vector<pair<Vector3d, Vec
   bool result(true);
   Vector3d last_pos = traj.getPos(0.0);
 
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  traj.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
     Eigen::Vector3d pos, vel, acc;
-    pos = traj.getPos(t);
-    vel = traj.getVel(t);
-    acc = traj.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
     if (is_valid && !checkState(pos, vel, acc))
     {
       result = false;
@@ -388,12 +412,15 @@ bool PosChecker::checkPolyTraj(const Trajectory &traj, vector<pair<Vector3d, Vec
   bool result(true);
   Vector3d last_pos = traj.getPos(0.0);
 
-  for (double t = 0.0; t <= tau; t += dt_)
+  TrajSamples &samples = sampleBuffer();
+  traj.sampleBatch(0.0, dt_, stampNum(0.0, tau), samples);
+  for (int i = 0; i < samples.size(); ++i)
   {
+    double t = samples.t(i);
     Eigen::Vector3d pos, vel, acc;
-    pos = traj.getPos(t);
-    vel = traj.getVel(t);
-    acc = traj.getAcc(t);
+    pos = samples.getPos(i);
+    vel = samples.getVel(i);
+    acc = samples.getAcc(i);
     if (is_valid && !checkState(pos, vel, acc))
     {
       result = false;
@@ -420,14 +447,17 @@ bool PosChecker::getPolyTrajCollision(const Trajectory &traj, std::vector<int> &
 {
   bool result(true);
   int n_seg = traj.getPieceNum();
+  TrajSamples &samples = sampleBuffer();
   Vector3d pos, vel, acc;
   for (int i = 0; i < n_seg; ++i)
   {
     double tau = traj[i].getDuration();
-    for (double t = 0.0; t < tau; t += dt_)
+    traj[i].sampleBatch(0.0, dt_, (int)ceil(tau / dt_), samples);
+    for (int k = 0; k < samples.size(); ++k)
     {
-      pos = traj[i].getPos(t);
-      vel = traj[i].getVel(t);
+      double t = samples.t(k);
+      pos = samples.getPos(k);
+      vel = samples.getVel(k);
       if (!checkState(pos, vel, acc))
       {
         result = false;
@@ -448,7 +478,8 @@ bool PosChecker::getPolyTrajAttractPts(const Trajectory &front_traj, const Traje
 {
   bool result(true);
   int n_seg = traj.getPieceNum();
-  Vector3d pos, attract_pt, front_traj_pt;
+  TrajSamples &samples = sampleBuffer();
+  Vector3d pos, attract_pt, front_traj_pt, grad;
   pair<int, int> snos;
   for (int i = 0; i < n_seg; ++i)
   {
@@ -457,9 +488,11 @@ bool PosChecker::getPolyTrajAttractPts(const Trajectory &front_traj, const Traje
     double tau = traj[i].getDuration();
     double collide_t_last = 0.0;
     bool first_obs(true);
-    for (double t = 0.0; t < tau; t += dt_)
+    traj[i].sampleBatch(0.0, dt_, (int)ceil(tau / dt_), samples);
+    for (int k = 0; k < samples.size(); ++k)
     {
-      pos = traj[i].getPos(t);
+      double t = samples.t(k);
+      pos = samples.getPos(k);
       if (!validatePosSurround(pos))
       {
         result = false;
@@ -470,6 +503,13 @@ bool PosChecker::getPolyTrajAttractPts(const Trajectory &front_traj, const Traje
           front_traj_pt = front_traj[i].getPos(t);
           double len = (front_traj_pt - pos).norm();
           attract_pt = front_traj_pt + (front_traj_pt - pos) * max(len, 2.0);
+          // with a distance field the point is pulled up its gradient, away from the obstacle, just as far
+          if (occ_map_->hasESDF())
+          {
+            occ_map_->getDistWithGrad(pos, grad);
+            if (grad.norm() > 1e-6)
+              attract_pt = pos + grad.normalized() * (attract_pt - pos).norm();
+          }
           att_pts.emplace_back(attract_pt[0], attract_pt[1], attract_pt[2]);
           t_s.emplace_back(std::max(t - 0.2, 0.0));
           t_e.emplace_back(std::min(t + 0.2, tau));
@@ -495,6 +535,7 @@ bool PosChecker::getRegionalAttractPts(const Trajectory &front_traj, const Traje
   t_e.clear();
   bool result(true);
   int n_seg = traj.getPieceNum();
+  TrajSamples &samples = sampleBuffer();
   Vector3d pos, vel, acc, attract_pt, front_traj_pt;
   pair<int, int> snos;
   for (int i = 0; i < n_seg; ++i)
@@ -504,10 +545,12 @@ bool PosChecker::getRegionalAttractPts(const Trajectory &front_traj, const Traje
     double tau = traj[i].getDuration();
     double collide_t_last = 0.0;
     bool first_obs(true);
-    for (double t = 0.0; t < tau; t += dt_)
+    traj[i].sampleBatch(0.0, dt_, (int)ceil(tau / dt_), samples);
+    for (int k = 0; k < samples.size(); ++k)
     {
-      pos = traj[i].getPos(t);
-      vel = traj[i].getVel(t);
+      double t = samples.t(k);
+      pos = samples.getPos(k);
+      vel = samples.getVel(k);
       if (!checkState(pos, vel, acc))
       {
         result = false;
@@ -0,0 +1,85 @@
+#include "occ_grid/thread_pool.h"
+
+namespace kino_planner
+{
+ThreadPool::ThreadPool(int num_threads)
+  : task_(nullptr), n_tasks_(0), next_task_(0), busy_workers_(0), generation_(0), stop_(false)
+{
+  for (int i = 1; i < num_threads; ++i)
+  {
+    workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void ThreadPool::parallelFor(int n, const std::function<void(int, int)> &task)
+{
+  if (n <= 0)
+    return;
+  if (workers_.empty() || n == 1)
+  {
+    for (int i = 0; i < n; ++i)
+      task(0, i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    task_ = &task;
+    n_tasks_ = n;
+    next_task_ = 0;
+    busy_workers_ = workers_.size();
+    ++generation_;
+  }
+  start_cv_.notify_all();
+
+  runTasks(0);
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker_id)
+{
+  unsigned long seen_generation(0);
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      start_cv_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+      if (stop_)
+        return;
+      seen_generation = generation_;
+    }
+
+    runTasks(worker_id);
+
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (--busy_workers_ == 0)
+        done_cv_.notify_one();
+    }
+  }
+}
+
+inline void ThreadPool::runTasks(int worker_id)
+{
+  int i;
+  while ((i = next_task_.fetch_add(1)) < n_tasks_)
+  {
+    (*task_)(worker_id, i);
+  }
+}
+
+} // namespace kino_planner
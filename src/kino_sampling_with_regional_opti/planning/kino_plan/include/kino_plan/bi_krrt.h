@@ -2,17 +2,24 @@
 #define _BIKRRT_H_
 
 #include "node_utils.h"
-#include "kdtree.h"
+#include "grid_index.h"
+#include "reach_radius_table.h"
 #include "visualization_utils/visualization_utils.h"
 #include "occ_grid/pos_checker.h"
 #include "poly_traj_utils/traj_utils.hpp"
 #include "bvp_solver.h"
 #include "bias_sampler.h"
+#include "parent_selector.h"
 #include "poly_opt/traj_optimizer.h"
 #include "r3_plan/a_star_search.h"
+#include "occ_grid/thread_pool.h"
 
 #include <vector>
 #include <stack>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 using Eigen::Matrix2d;
 using Eigen::Matrix3d;
@@ -92,12 +99,70 @@ public:
   {
     return valid_start_tree_node_nums_;
   };
+  // checkPolySeg calls of the last search, and the ones lazy collision checking saved
+  void getPosCheckNum(int &checked, int &skipped)
+  {
+    checked = pos_check_nums_;
+    skipped = pos_check_skipped_nums_;
+  };
+  // neighbour BVPs solved in the last search, and the ones skipped by their cost lower bound
+  void getBVPSolveNum(int &solved, int &skipped)
+  {
+    solved = bvp_solve_nums_;
+    skipped = bvp_skipped_nums_;
+  };
+  // anytime planning: plan() runs on a background thread, every improved
+  // solution is stored (and passed to the callback if set) so that the
+  // caller can fetch the current best one or stop the search at any time
+  typedef std::function<void(const Trajectory &traj, double cost)> SolutionCallback;
+  void setSolutionCallback(const SolutionCallback &cb)
+  {
+    solution_cb_ = cb;
+  };
+  // returns false if a search is still running
+  bool planAsync(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
+                 Vector3d end_pos, Vector3d end_vel, Vector3d end_acc,
+                 double search_time);
+  void cancel()
+  {
+    cancel_ = true;
+  };
+  bool isPlanning() const
+  {
+    return planning_;
+  };
+  // joins the background search and returns what plan() returned
+  int waitForResult();
+  bool getBestTraj(Trajectory &traj, double &cost);
+  // tree portfolio: with bikrrt/portfolio_size K > 1, plan() grows K independently
+  // seeded tree pairs on separate threads within the same search_time. All members
+  // prune with the best cost any of them has found and the cheapest solution is kept.
+  // Member 0 is this planner, the stats are those of the last portfolio search
+  struct PortfolioMemberStats
+  {
+    int result;
+    double cost;            // DBL_MAX if no solution
+    double first_traj_time; // -1 if no solution
+    int samples, tree_nodes;
+    int bvp_solves, pos_checks;
+  };
+  void getPortfolioStats(vector<PortfolioMemberStats> &stats)
+  {
+    stats = portfolio_stats_;
+  };
   void getConvergenceInfo(vector<Trajectory>& traj_list, vector<double>& solution_cost_list, vector<double>& solution_time_list)
   {
     traj_list = traj_list_;
     solution_time_list = solution_time_list_;
     solution_cost_list = solution_cost_list_;
   };
+  // solution_source_list tells what lowered the cost: CONNECTION, START_TREE_REWIRE or GOAL_TREE_REWIRE
+  void getConvergenceInfo(vector<Trajectory>& traj_list, vector<double>& solution_cost_list, vector<double>& solution_time_list, 
+                          vector<int>& solution_source_list)
+  {
+    getConvergenceInfo(traj_list, solution_cost_list, solution_time_list);
+    solution_source_list = solution_source_list_;
+  };
 
   // evaluation
   double evaluateTraj(const Trajectory& traj, double &traj_duration, double &traj_length, int &seg_nums, double &acc_integral, double &jerk_integral);
@@ -111,6 +176,12 @@ public:
     SUCCESS = 1, 
     SUCCESS_CLOSE_GOAL = 2
   };
+  enum
+  {
+    CONNECTION = 0,
+    START_TREE_REWIRE = 1,
+    GOAL_TREE_REWIRE = 2
+  };
   typedef shared_ptr<BIKRRT> BIKRRTPtr;
 
 private:
@@ -126,6 +197,9 @@ private:
                         const double& cost_from_parent, const double& tau_from_parent);
   void changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent, const Piece& piece, 
                         const double& cost_from_parent, const double& tau_from_parent);
+  int reuseTrees(const StatePVA &x_start);
+  int pruneTrees(double cost_bound, double index_cell_size, RRTNodePtr &bridge_node_start_tree, RRTNodePtr &bridge_node_goal_tree);
+  void initTrees(const StatePVA &x_start, const StatePVA &x_goal);
   bool regionalOpt(const Piece& oringin_seg, const pair<Vector3d, Vector3d>& collide_pts_one_seg, const pair<double, double>& t_s_e);
 
   struct regionalCandidate
@@ -145,37 +219,100 @@ private:
     }
   };
   
+  parentCandidates bcwd_candidates_, fwd_candidates_;
+  void evaluateCandidates(parentCandidates &cands, const StatePVA &x_rand, bool backward);
+  // scratch of one batched evaluation, one per worker
+  struct candidateBatch
+  {
+    BVPSolver::StateBatch starts, goals;
+    BVPSolver::BatchSolution sol;
+  };
+  candidateBatch batch_;
+  void evaluateCandidateRange(BVPSolver::IntegratorBVP &bvp, candidateBatch &batch, const StatePVA &x_rand, 
+                              bool backward, parentCandidates &cands, int begin, int end);
+  ParentSelector parent_selector_;
+
   // vis
   ros::Time t_start_, t_end_;
   bool debug_vis_;
   VisualRviz::Ptr vis_ptr_;
   void sampleWholeTree(const RRTNodePtr &root, vector<StatePVA> *vis_x, vector<Vector3d>& knots);
 
-  RRTNodePtrVector node_pool_; //pre allocated in Constructor
+  RRTNodePool node_pool_; //pre allocated in init()
   Trajectory traj_;
   Trajectory first_traj_; //initialized when first path found
   RRTNodePtr start_node_, goal_node_, close_goal_node_;
   int valid_start_tree_node_nums_, valid_sample_nums_;
+  int pos_check_nums_, pos_check_skipped_nums_;
+  int bvp_solve_nums_, bvp_skipped_nums_;
   double final_traj_use_time_, first_traj_use_time_;
   bool test_convergency_;
   vector<Trajectory> traj_list_;
   vector<double> solution_cost_list_;
   vector<double> solution_time_list_;
+  vector<int> solution_source_list_;
+  int start_tree_rewire_nums_, goal_tree_rewire_nums_;
+  void recordSolution(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr &bridge_node_goal_tree, double cost, int source);
+
+  // warm start, the connection found by the last search
+  RRTNodePtr last_bridge_start_tree_, last_bridge_goal_tree_;
+
+  // anytime planning
+  void publishSolution(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr &bridge_node_goal_tree, double cost);
+  std::thread plan_thread_;
+  std::atomic<bool> planning_, cancel_;
+  int plan_result_;
+  std::mutex best_mtx_;
+  Trajectory best_traj_;
+  double best_cost_;
+  bool has_best_;
+  SolutionCallback solution_cb_;
+
+  // tree portfolio, members are created in init() and only run inside plan()
+  int portfolioSearch(int n, double search_time);
+  void startMember(const BIKRRT &owner);
+  double pruneCost(double own_cost) const;
+  bool cancelled() const
+  {
+    return cancel_ || (portfolio_owner_ && portfolio_owner_->cancel_);
+  };
+  vector<BIKRRTPtr> portfolio_;
+  BIKRRT *portfolio_owner_;              // set on members, nullptr on the planner that owns them
+  std::atomic<double> incumbent_cost_;   // best cost published by any member of the running search
+  vector<PortfolioMemberStats> portfolio_stats_;
 
   // radius for for/backward search
   double getForwardRadius(double tau, double cost);
   double getBackwardRadius(double tau, double cost);
-  struct kdres *getForwardNeighbour(const StatePVA &x1, struct kdtree *kd_tree, double tau, double radius_p);
-  struct kdres *getBackwardNeighbour(const StatePVA &x1, struct kdtree *kd_tree, double tau, double radius_p);
+  void getForwardNeighbour(const StatePVA &x1, double tau, double radius_p, vector<RRTNodePtr> &nbrs);
+  void getBackwardNeighbour(const StatePVA &x1, double tau, double radius_p, vector<RRTNodePtr> &nbrs);
+  ReachRadiusTable reach_radius_table_; //built in init()
+
+  // spatial index of tree nodes, rebuilt in every rrtStar()
+  GridIndex node_index_;
+  vector<RRTNodePtr> nbrs_; //range query buffer
+
+  // branch and bound, buffers of pruneTrees()
+  vector<RRTNodePtr> prune_keep_;
+  vector<int> prune_new_ids_, prune_indexed_ids_;
+  vector<char> prune_on_path_;
+  int pruned_node_nums_;
 
   // nodehandle params
   double radius_cost_between_two_states_;
+  bool shrink_radius_;
+  int shrink_radius_node_nums_;
   double rho_;
   double v_mag_sample_;
   double vel_limit_, acc_limit_, jerk_limit_;
   bool allow_close_goal_, stop_after_first_traj_found_, rewire_, use_regional_opt_;
+  bool warm_start_, lazy_collision_;
+  bool prune_trees_;
+  int prune_interval_;
   double search_time_;
   int tree_node_nums_;
+  int num_threads_;
+  int portfolio_size_;
 
   // environment
   PosChecker::Ptr pos_checker_ptr_;
@@ -185,6 +322,11 @@ private:
   // bvp_solver
   BVPSolver::IntegratorBVP bvp_;
 
+  // parallel parent selection, one bvp solver per worker
+  ThreadPool::Ptr thread_pool_;
+  vector<BVPSolver::IntegratorBVP, Eigen::aligned_allocator<BVPSolver::IntegratorBVP>> worker_bvps_;
+  vector<candidateBatch> worker_batches_;
+
   // // bias_sampler
   // BiasSampler sampler_;
 
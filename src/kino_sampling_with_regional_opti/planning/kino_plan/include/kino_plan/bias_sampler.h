@@ -3,6 +3,7 @@
 
 #include "occ_grid/pos_checker.h"
 #include "node_utils.h"
+#include "bvp_solver.h"
 #include <ros/ros.h>
 #include <Eigen/Eigen>
 #include <vector>
@@ -28,12 +29,16 @@ public:
     nh.param("sampler/vel_mag_var", vel_mag_var_, 0.0);
     nh.param("sampler/vel_dir_var", vel_dir_var_, 0.0);
     nh.param("sampler/resolution", resolution_, 0.0);
+    nh.param("sampler/informed", informed_, false);
+    nh.param("sampler/informed_tries", informed_tries_, 10);
     ROS_WARN_STREAM("[sampler] param: vel_mag_mean: " << vel_mag_mean_);
     ROS_WARN_STREAM("[sampler] param: pos_hrz_var: " << pos_hrz_var_);
     ROS_WARN_STREAM("[sampler] param: pos_vtc_var: " << pos_vtc_var_);
     ROS_WARN_STREAM("[sampler] param: vel_mag_var: " << vel_mag_var_);
     ROS_WARN_STREAM("[sampler] param: vel_dir_var: " << vel_dir_var_);
     ROS_WARN_STREAM("[sampler] param: resolution: " << resolution_);
+    ROS_WARN_STREAM("[sampler] param: informed: " << informed_);
+    ROS_WARN_STREAM("[sampler] param: informed_tries: " << informed_tries_);
 
     std::random_device rd;
     gen_ = std::mt19937_64(rd());
@@ -42,8 +47,14 @@ public:
     pos_ver_rand_ = std::normal_distribution<double>(0.0, pos_vtc_var_);
     vel_mag_rand_ = std::normal_distribution<double>(vel_mag_mean_, vel_mag_var_);
     vel_hor_dir_rand_ = std::normal_distribution<double>(0.0, vel_dir_var_);
+    unit_rand_ = std::uniform_real_distribution<double>(0.0, 1.0);
+    std_normal_rand_ = std::normal_distribution<double>(0.0, 1.0);
 
     use_external_topo_ = false;
+    informed_bvp_ = nullptr;
+    informed_cost_ = DBL_MAX;
+    informed_rejected_nums_ = 0;
+    spheroid_sample_nums_ = 0;
   };
 
   void setPosChecker(const PosChecker::Ptr &checker)
@@ -51,6 +62,13 @@ public:
     pos_checker_ = checker;
   };
 
+  // the generator is seeded from std::random_device on construction, 
+  // copies of a sampler need a new seed to draw different samples
+  void seed(unsigned long s)
+  {
+    gen_.seed(s);
+  };
+
   void topoSetup(const vector<pair<Vector3d, Vector3d>> &segs, const Vector3d &init_pt, const Vector3d &goal_pt)
   {
     init_pos_ = init_pt;
@@ -100,6 +118,25 @@ public:
 
   bool samplingOnce(int idx, StatePVA &rand_state);
 
+  // informed sampling (sampler/informed): once a solution of cost c exists, a state x
+  // can only improve it if lb(x_start, x) + lb(x, x_goal) < c, lb being the BVP cost 
+  // lower bound. Samples on the tracks are redrawn until one passes, after
+  // informed_tries failures one is drawn in the prolate spheroid around the foci
+  // x_start and x_goal that contains every passing position
+  void setInformedQuery(const StatePVA &x_start, const StatePVA &x_goal, const BVPSolver::IntegratorBVP *bvp, 
+                        double max_vel, double max_acc, double max_jerk);
+  // DBL_MAX (no solution yet) samples as if informed sampling was off
+  void setInformedCost(double cost)
+  {
+    informed_cost_ = cost;
+  };
+  // samples rejected by the cost lower bound, and the ones drawn in the spheroid
+  void getInformedNums(int &rejected, int &spheroid)
+  {
+    rejected = informed_rejected_nums_;
+    spheroid = spheroid_sample_nums_;
+  };
+
 private:
   PosChecker::Ptr pos_checker_;
   vector<Vector3d> unit_tracks_, p_head_, tracks_, rotated_unit_tracks_;
@@ -119,6 +156,20 @@ private:
   double resolution_;
   bool use_external_topo_;
 
+  // informed sampling
+  bool informed_;
+  int informed_tries_;
+  const BVPSolver::IntegratorBVP *informed_bvp_;
+  StatePVA informed_start_, informed_goal_;
+  double informed_vel_, informed_acc_, informed_jerk_;
+  double informed_cost_;
+  int informed_rejected_nums_, spheroid_sample_nums_;
+  std::uniform_real_distribution<double> unit_rand_;
+  std::normal_distribution<double> std_normal_rand_;
+  bool sampleOnTrack(int idx, StatePVA &rand_state);
+  bool sampleInSpheroid(StatePVA &rand_state);
+  double informedLowerBound(const StatePVA &x);
+
   void findSamplingSpace(const vector<pair<Vector3d, Vector3d>> &segs,
                          vector<pair<Vector3d, Vector3d>> &all_corners);
 
@@ -3,6 +3,7 @@
 
 #include "poly_traj_utils/traj_utils.hpp"
 #include <Eigen/Eigen>
+#include <vector>
 
 #define DOUBLE_INTEGRATOR 2
 #define TRIPLE_INTEGRATOR 3
@@ -17,11 +18,23 @@ using Eigen::Vector3d;
 using Eigen::Vector2d;
 using Eigen::VectorXd;
 
+// triple integrator states of many pairs, column i is pair i. Row major so
+// that each state component is contiguous over the pairs
+typedef Eigen::Matrix<double, 9, Eigen::Dynamic, Eigen::RowMajor> StateBatch;
+
+struct BatchSolution
+{
+  Eigen::ArrayXd tau_star, cost_star;
+  std::vector<bool> solved;
+  std::vector<CoefficientMat, Eigen::aligned_allocator<CoefficientMat>> coeff;
+};
+
 class IntegratorBVP {
 public:
   void init(int model)
   {
     model_ = model;
+    tau_star_ = DBL_MAX;
     if (model_ == DOUBLE_INTEGRATOR)
     {
       x0_ = Eigen::Matrix<double, 6, 1>::Zero();
@@ -86,6 +99,15 @@ public:
     coeff = coeff_;
   };
 
+  // solves starts.col(i) -> goals.col(i) for all pairs at once, triple integrator only.
+  // Returns the number of pairs solved, getTauStar() etc. are left untouched
+  int solveBatch(const StateBatch &starts, const StateBatch &goals, int type, BatchSolution &sol);
+
+  // lower bound of the optimal cost of start -> goal that holds for every solution 
+  // within the vel / acc / jerk limits, far cheaper than solve()
+  double costLowerBound(const VectorXd &start, const VectorXd &goal, int type, 
+                        double max_vel, double max_acc, double max_jerk) const;
+
   void calCoeffFromTau(double tau, CoefficientMat &coeff);
   double calCostAccKnown(const VectorXd &x0, const VectorXd &x1, double T);
 
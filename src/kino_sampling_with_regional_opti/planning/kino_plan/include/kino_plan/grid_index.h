@@ -0,0 +1,51 @@
+#ifndef _GRID_INDEX_H_
+#define _GRID_INDEX_H_
+
+#include "node_utils.h"
+#include <Eigen/Eigen>
+#include <vector>
+
+namespace kino_planner
+{
+
+// Incremental spatial index for tree nodes.
+// Points live in contiguous arrays and are chained into a fixed-size
+// hash table of grid cells, so insert is O(1) and a range query only
+// walks the cells overlapping the query box. After reset() has sized the
+// buckets once, neither insert nor rangeQuery allocates.
+class GridIndex
+{
+public:
+  GridIndex();
+
+  // drop all points; cell_size should be close to the usual query radius
+  void reset(double cell_size, int capacity);
+  void insert(const Eigen::Vector3d &pos, RRTNodePtr node);
+  // nodes within radius of center are written to nbrs (cleared first)
+  int rangeQuery(const Eigen::Vector3d &center, double radius, std::vector<RRTNodePtr> &nbrs) const;
+
+  int size() const
+  {
+    return (int)nodes_.size();
+  };
+  // indexed nodes in insertion order
+  const std::vector<RRTNodePtr> &nodes() const
+  {
+    return nodes_;
+  };
+
+private:
+  inline int bucketOf(int x, int y, int z) const;
+
+  double cell_size_, cell_size_inv_;
+  unsigned int bucket_mask_;
+  std::vector<int> bucket_head_; // first point of each bucket, -1 if empty
+  std::vector<int> next_;        // next point in the same bucket
+  std::vector<Eigen::Vector3i> cells_;
+  std::vector<Eigen::Vector3d> pts_;
+  std::vector<RRTNodePtr> nodes_;
+};
+
+} // namespace kino_planner
+
+#endif //_GRID_INDEX_H_
@@ -2,12 +2,14 @@
 #define _KRRTPLANNER_H_
 
 #include "node_utils.h"
-#include "kdtree.h"
+#include "grid_index.h"
+#include "reach_radius_table.h"
 #include "visualization_utils/visualization_utils.h"
 #include "occ_grid/pos_checker.h"
 #include "poly_traj_utils/traj_utils.hpp"
 #include "bvp_solver.h"
 #include "bias_sampler.h"
+#include "parent_selector.h"
 #include "poly_opt/traj_optimizer.h"
 #include "r3_plan/a_star_search.h"
 
@@ -77,6 +79,18 @@ public:
   {
     return valid_start_tree_node_nums_;
   };
+  // checkPolySeg calls of the last search, and the ones lazy collision checking saved
+  void getPosCheckNum(int &checked, int &skipped)
+  {
+    checked = pos_check_nums_;
+    skipped = pos_check_skipped_nums_;
+  };
+  // neighbour BVPs solved in the last search, and the ones skipped by their cost lower bound
+  void getBVPSolveNum(int &solved, int &skipped)
+  {
+    solved = bvp_solve_nums_;
+    skipped = bvp_skipped_nums_;
+  };
   void getConvergenceInfo(vector<Trajectory>& traj_list, vector<double>& solution_cost_list, vector<double>& solution_time_list)
   {
     traj_list = traj_list_;
@@ -112,16 +126,24 @@ private:
                         const double& cost_from_parent, const double& tau_from_parent);
   bool regionalOpt(const Piece& oringin_seg, const pair<Vector3d, Vector3d>& collide_pts_one_seg, const pair<double, double>& t_s_e);
 
+  parentCandidates candidates_;
+  void evaluateCandidates(parentCandidates &cands, const StatePVA &x_rand);
+  BVPSolver::StateBatch batch_starts_, batch_goals_;
+  BVPSolver::BatchSolution batch_sol_;
+  ParentSelector parent_selector_;
+
   // vis
   bool debug_vis_;
   VisualRviz::Ptr vis_ptr_;
   void sampleWholeTree(const RRTNodePtr &root, vector<StatePVA> *vis_x, vector<Vector3d>& knots);
 
-  RRTNodePtrVector start_tree_; //pre allocated in Constructor
+  RRTNodePool start_tree_; //pre allocated in init()
   Trajectory traj_;
   Trajectory first_traj_; //initialized when first path found
   RRTNodePtr start_node_, goal_node_, close_goal_node_;
   int valid_start_tree_node_nums_, valid_sample_nums_;
+  int pos_check_nums_, pos_check_skipped_nums_;
+  int bvp_solve_nums_, bvp_skipped_nums_;
   double final_traj_use_time_, first_traj_use_time_;
   bool test_convergency_;
   vector<Trajectory> traj_list_;
@@ -131,15 +153,23 @@ private:
   // radius for for/backward search
   double getForwardRadius(double tau, double cost);
   double getBackwardRadius(double tau, double cost);
-  struct kdres *getForwardNeighbour(const StatePVA &x1, struct kdtree *kd_tree, double tau, double radius_p);
-  struct kdres *getBackwardNeighbour(const StatePVA &x1, struct kdtree *kd_tree, double tau, double radius_p);
+  void getForwardNeighbour(const StatePVA &x1, double tau, double radius_p, vector<RRTNodePtr> &nbrs);
+  void getBackwardNeighbour(const StatePVA &x1, double tau, double radius_p, vector<RRTNodePtr> &nbrs);
+  ReachRadiusTable reach_radius_table_; //built in init()
+
+  // spatial index of tree nodes, rebuilt in every rrtStar()
+  GridIndex node_index_;
+  vector<RRTNodePtr> nbrs_; //range query buffer
 
   // nodehandle params
   double radius_cost_between_two_states_;
+  bool shrink_radius_;
+  int shrink_radius_node_nums_;
   double rho_;
   double v_mag_sample_;
   double vel_limit_, acc_limit_, jerk_limit_;
   bool allow_close_goal_, stop_after_first_traj_found_, rewire_, use_regional_opt_;
+  bool lazy_collision_;
   double search_time_;
   int tree_node_nums_;
 
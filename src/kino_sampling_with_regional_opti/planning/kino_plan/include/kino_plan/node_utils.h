@@ -23,6 +23,9 @@ typedef vector< BOUND > BOUNDS;
 struct RRTNode {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
   RRTNode* parent;
+  //intrusive children list, children of a node are chained by next_sibling
+  RRTNode* first_child;
+  RRTNode* next_sibling;
   StatePVA x;
   //cost is the distance from the start
   double cost_from_start;
@@ -30,14 +33,28 @@ struct RRTNode {
   double tau_from_start;
   double cost_from_parent;
   double tau_from_parent;
-  Piece poly_seg;
-  list<RRTNode*> children;
+  //slot in the owning RRTNodePool, also indexes the pool's poly_seg array
+  int id;
   char tree_type;
-  RRTNode(): parent(NULL), cost_from_start(DBL_MAX), tau_from_start(DBL_MAX), cost_from_parent(0.0), tau_from_parent(0.0), tree_type(START_TREE) {};
+  RRTNode(): parent(NULL), first_child(NULL), next_sibling(NULL), cost_from_start(DBL_MAX), tau_from_start(DBL_MAX), cost_from_parent(0.0), tau_from_parent(0.0), id(-1), tree_type(START_TREE) {};
+  void addChild(RRTNode* child)
+  {
+    child->next_sibling = first_child;
+    first_child = child;
+  };
+  void removeChild(RRTNode* child)
+  {
+    RRTNode** link = &first_child;
+    while (*link && *link != child)
+      link = &(*link)->next_sibling;
+    if (*link)
+      *link = child->next_sibling;
+    child->next_sibling = NULL;
+  };
   int countDescendant()
   {
     int n(0);
-    for (const auto &child : children)
+    for (RRTNode* child = first_child; child; child = child->next_sibling)
     {
       n += child->countDescendant();
     }
@@ -48,6 +65,88 @@ typedef RRTNode* RRTNodePtr;
 typedef vector<RRTNodePtr, Eigen::aligned_allocator<RRTNodePtr>> RRTNodePtrVector;
 typedef vector<RRTNode, Eigen::aligned_allocator<RRTNode>> RRTNodeVector;
 
+// Fixed-capacity arena of tree nodes.
+// Nodes live in one contiguous array and never move, so RRTNodePtr stays
+// valid for the life of the pool. The polynomial segment from a node's
+// parent is only read when a path is extracted or the tree is drawn, so it
+// is kept in a parallel array instead of inside the node.
+// Nodes are (re)initialized when handed out by newNode(), which makes
+// dropping a whole tree O(1).
+class RRTNodePool
+{
+public:
+  void init(int capacity)
+  {
+    nodes_.resize(capacity);
+    segs_.resize(capacity);
+    for (int i = 0; i < capacity; ++i)
+      nodes_[i].id = i;
+  };
+  // clears the links of slot i and returns it
+  RRTNodePtr newNode(int i)
+  {
+    RRTNodePtr node = &nodes_[i];
+    node->parent = NULL;
+    node->first_child = NULL;
+    node->next_sibling = NULL;
+    node->tree_type = START_TREE;
+    return node;
+  };
+  RRTNodePtr operator[](int i)
+  {
+    return &nodes_[i];
+  };
+  Piece& polySeg(const RRTNode* node)
+  {
+    return segs_[node->id];
+  };
+  int capacity() const
+  {
+    return (int)nodes_.size();
+  };
+  // moves the nodes in keep to the front of the pool in the given order and
+  // rebuilds their links, links to nodes that are not kept are cut.
+  // new_ids maps an old slot to its new one, -1 if the node is dropped
+  void compact(const vector<RRTNodePtr>& keep, vector<int>& new_ids)
+  {
+    int n = (int)keep.size();
+    new_ids.assign(nodes_.size(), -1);
+    for (int i = 0; i < n; ++i)
+      new_ids[keep[i]->id] = i;
+
+    RRTNodeVector kept_nodes;
+    vector<Piece, Eigen::aligned_allocator<Piece>> kept_segs;
+    vector<int> parent_ids(n, -1);
+    kept_nodes.reserve(n);
+    kept_segs.reserve(n);
+    for (int i = 0; i < n; ++i)
+    {
+      kept_nodes.push_back(*keep[i]);
+      kept_segs.push_back(segs_[keep[i]->id]);
+      if (keep[i]->parent)
+        parent_ids[i] = new_ids[keep[i]->parent->id];
+    }
+    for (int i = 0; i < n; ++i)
+    {
+      nodes_[i] = kept_nodes[i];
+      nodes_[i].id = i;
+      nodes_[i].parent = parent_ids[i] >= 0 ? &nodes_[parent_ids[i]] : NULL;
+      nodes_[i].first_child = NULL;
+      nodes_[i].next_sibling = NULL;
+      segs_[i] = kept_segs[i];
+    }
+    for (int i = 0; i < n; ++i)
+    {
+      if (nodes_[i].parent)
+        nodes_[i].parent->addChild(&nodes_[i]);
+    }
+  };
+
+private:
+  RRTNodeVector nodes_;
+  vector<Piece, Eigen::aligned_allocator<Piece>> segs_;
+};
+
 
 struct FMTNode 
 {
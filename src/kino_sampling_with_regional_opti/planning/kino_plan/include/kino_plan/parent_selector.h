@@ -0,0 +1,62 @@
+#ifndef _PARENT_SELECTOR_H_
+#define _PARENT_SELECTOR_H_
+
+#include "occ_grid/pos_checker.h"
+#include "node_utils.h"
+#include <Eigen/Eigen>
+#include <vector>
+
+using std::pair;
+using std::vector;
+using Eigen::Vector3d;
+
+namespace kino_planner
+{
+
+// parent candidate of a new sample, filled by the planner's evaluateCandidates()
+struct parentCandidate
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  RRTNodePtr node;
+  bool solved, dyn_feasible, pos_checked, connected, need_region_opt;
+  double cost, tau;
+  Piece seg;
+  pair<Vector3d, Vector3d> collide_pts;
+  pair<double, double> t_s_e;
+};
+typedef vector<parentCandidate, Eigen::aligned_allocator<parentCandidate>> parentCandidates;
+
+// Checks the parent candidates of a new sample and picks the cheapest feasible one,
+// shared by BIKRRT and KRRTPlanner. Solving the bvps is left to the planners.
+class ParentSelector
+{
+public:
+  ParentSelector();
+
+  void init(double vel_limit, double acc_limit, double jerk_limit, bool lazy_collision);
+  void setPosChecker(const PosChecker::Ptr &checker)
+  {
+    pos_checker_ = checker;
+  };
+
+  // clears the check results before cand is solved
+  static void resetCandidate(parentCandidate &cand);
+  // cand.cost and cand.tau are set, builds the segment and runs the checks.
+  // Only touches cand, so it can be called from any worker thread.
+  // With lazy collision checking the collision check is left to selectParentLazily()
+  void checkCandidateSeg(parentCandidate &cand, const CoefficientMat &coeff) const;
+  void checkCandidatePos(parentCandidate &cand) const;
+  int selectParentLazily(parentCandidates &cands, bool keep_region_info);
+  // adds the collision checks run and skipped for cands
+  void countPosChecks(const parentCandidates &cands, int &checked, int &skipped) const;
+
+private:
+  PosChecker::Ptr pos_checker_;
+  double vel_limit_, acc_limit_, jerk_limit_;
+  bool lazy_collision_;
+  vector<int> lazy_order_;
+};
+
+} // namespace kino_planner
+
+#endif //_PARENT_SELECTOR_H_
@@ -0,0 +1,32 @@
+#ifndef _REACH_RADIUS_TABLE_H_
+#define _REACH_RADIUS_TABLE_H_
+
+#include <vector>
+
+namespace kino_planner
+{
+
+// Position radius of the states reachable within a cost, for the neighbour queries of the planners.
+// The reachable set is the ellipsoid of G(tau) * 3 * rho / (cost - tau), so the radius 
+// is sqrt((cost - tau) / (3 * rho)) times the radius of G(tau) alone. Only the latter 
+// needs an eigen decomposition, it is tabulated over tau once in init().
+class ReachRadiusTable
+{
+public:
+  ReachRadiusTable();
+
+  // tabulate tau in [0, max_tau] at size points
+  void init(double max_tau, int size);
+  double radius(double tau, double cost, double rho) const;
+
+  // radius of the ellipsoid of G(tau), computed directly
+  static double unitRadius(double tau);
+
+private:
+  double max_tau_, step_inv_;
+  std::vector<double> unit_radius_;
+};
+
+} // namespace kino_planner
+
+#endif //_REACH_RADIUS_TABLE_H_
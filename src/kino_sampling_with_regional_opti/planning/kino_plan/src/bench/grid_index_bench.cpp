@@ -0,0 +1,76 @@
+// Insert and range query throughput of GridIndex at 1k / 10k / 100k nodes, spread over
+// a 40x40x5 m map, against a linear scan of the same points.
+//   rosrun kino_plan grid_index_bench
+#include "kino_plan/grid_index.h"
+#include <chrono>
+#include <random>
+#include <cstdio>
+
+using namespace kino_planner;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double usSince(const Clock::time_point &t)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - t).count();
+}
+
+static void benchNodeNums(int n_nodes, int n_queries, double radius, std::mt19937 &gen)
+{
+  std::uniform_real_distribution<double> rand_xy(-20.0, 20.0), rand_z(0.0, 5.0);
+  vector<RRTNode, Eigen::aligned_allocator<RRTNode>> nodes(n_nodes);
+  for (RRTNode &node : nodes)
+    node.x.head(3) = Eigen::Vector3d(rand_xy(gen), rand_xy(gen), rand_z(gen));
+  vector<Eigen::Vector3d> centers(n_queries);
+  for (Eigen::Vector3d &c : centers)
+    c = Eigen::Vector3d(rand_xy(gen), rand_xy(gen), rand_z(gen));
+
+  /* insert, the buckets are sized once by reset() like in rrtStar() */
+  GridIndex index;
+  auto t = Clock::now();
+  index.reset(radius, n_nodes);
+  for (RRTNode &node : nodes)
+    index.insert(node.x.head(3), &node);
+  double insert_us = usSince(t);
+
+  /* range query into one reused buffer */
+  vector<RRTNodePtr> nbrs;
+  nbrs.reserve(n_nodes);
+  long found = 0;
+  t = Clock::now();
+  for (const Eigen::Vector3d &c : centers)
+    found += index.rangeQuery(c, radius, nbrs);
+  double query_us = usSince(t);
+
+  /* linear scan baseline, also checks the number of neighbours found */
+  long scanned = 0;
+  double sqr_radius = radius * radius;
+  t = Clock::now();
+  for (const Eigen::Vector3d &c : centers)
+  {
+    nbrs.clear();
+    for (RRTNode &node : nodes)
+    {
+      if ((node.x.head(3) - c).squaredNorm() <= sqr_radius)
+        nbrs.push_back(&node);
+    }
+    scanned += nbrs.size();
+  }
+  double scan_us = usSince(t);
+
+  printf("%7d nodes: insert %6.1f ns/node, range query %8.2f us (%6.1f nbrs), linear scan %9.2f us, %s\n",
+         n_nodes, insert_us * 1e3 / n_nodes, query_us / n_queries, (double)found / n_queries,
+         scan_us / n_queries, found == scanned ? "same neighbours" : "NEIGHBOURS DIFFER");
+}
+
+int main()
+{
+  // about the neighbour radius rrtStar() queries with
+  const double radius = 2.0;
+  std::mt19937 gen(1);
+  printf("query radius %.1f m\n", radius);
+  benchNodeNums(1000, 10000, radius, gen);
+  benchNodeNums(10000, 10000, radius, gen);
+  benchNodeNums(100000, 1000, radius, gen);
+  return 0;
+}
@@ -0,0 +1,183 @@
+// Optimal tau of the triple integrator bvp (final acc known) on random boundary states:
+//  - the fixed degree root solver against the generic RootFinder::solvePolynomial(),
+//    on the same polynomials and picking the same root
+//  - IntegratorBVP::solve() against a dense search of calCostAccKnown() over tau
+// Returns 1 if either check fails.
+//   rosrun kino_plan tau_root_bench
+#include "kino_plan/bvp_solver.h"
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <array>
+#include <set>
+#include <vector>
+
+using namespace BVPSolver;
+using std::vector;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double usSince(const Clock::time_point &t)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - t).count();
+}
+
+// T^6 * dJ/dT of J(T) = calCostAccKnown(x0, x1, T), the optimal tau is one of its roots
+static void tauPolynomial(const VectorXd &x0, const VectorXd &x1, double rho, double (&p)[7])
+{
+  double t1 = 3*(x0[6]*x0[6] + x0[7]*x0[7] + x0[8]*x0[8] + x1[6]*x1[6] + x1[7]*x1[7] + x1[8]*x1[8]);
+  double t2 = t1 - 2*(x0[6]*x1[6] + x0[7]*x1[7] + x0[8]*x1[8]);
+  double t3 = 3*(x0[3]*x0[6] + x0[4]*x0[7] + x0[5]*x0[8] - x1[3]*x1[6] - x1[4]*x1[7] - x1[5]*x1[8]);
+  double t4 = t3 + 2*(x0[6]*x1[3] + x0[7]*x1[4] + x0[8]*x1[5] - x0[3]*x1[6] - x0[4]*x1[7] - x0[5]*x1[8]);
+  double t5 = 8*(x0[3]*x0[3] + x0[4]*x0[4] + x0[5]*x0[5] + x1[3]*x1[3] + x1[4]*x1[4] + x1[5]*x1[5]);
+  double t6 = t5 + 5*((x0[0]-x1[0])*(x0[6]-x1[6]) + (x0[1]-x1[1])*(x0[7]-x1[7]) + (x0[2]-x1[2])*(x0[8]-x1[8]));
+  double t7 = t6 + 14*(x0[3]*x1[3] + x0[4]*x1[4] + x0[5]*x1[5]);
+  double t8 = (x0[0]-x1[0])*(x0[3]+x1[3]) + (x0[1]-x1[1])*(x0[4]+x1[4]) + (x0[2]-x1[2])*(x0[5]+x1[5]);
+  double t9 = (x0[0]-x1[0])*(x0[0]-x1[0]) + (x0[1]-x1[1])*(x0[1]-x1[1]) + (x0[2]-x1[2])*(x0[2]-x1[2]);
+  p[0] = 1.0;
+  p[1] = 0.0;
+  p[2] = -3*rho*t2;
+  p[3] = -48*rho*t4;
+  p[4] = -72*rho*t7;
+  p[5] = -2880*rho*t8;
+  p[6] = -3600*rho*t9;
+}
+
+// the root of least cost, DBL_MAX if there is none
+template <class Roots>
+static double bestRoot(IntegratorBVP &bvp, const VectorXd &x0, const VectorXd &x1, const Roots &roots)
+{
+  double tau = DBL_MAX, cost = DBL_MAX;
+  for (double root : roots)
+  {
+    double c = bvp.calCostAccKnown(x0, x1, root);
+    if (c < cost)
+    {
+      tau = root;
+      cost = c;
+    }
+  }
+  return tau;
+}
+
+// least cost over [0.01, 100]: a log spaced scan, then golden section around the best sample
+static double denseMinCost(IntegratorBVP &bvp, const VectorXd &x0, const VectorXd &x1)
+{
+  const int n = 4000;
+  const double lo = std::log(0.01), hi = std::log(100.0), step = (hi - lo) / n;
+  int best = 0;
+  double best_cost = DBL_MAX;
+  for (int i = 0; i <= n; ++i)
+  {
+    double c = bvp.calCostAccKnown(x0, x1, std::exp(lo + i * step));
+    if (c < best_cost)
+    {
+      best = i;
+      best_cost = c;
+    }
+  }
+  double a = std::exp(lo + std::max(best - 1, 0) * step), b = std::exp(lo + std::min(best + 1, n) * step);
+  const double g = (std::sqrt(5.0) - 1) / 2;
+  for (int it = 0; it < 100; ++it)
+  {
+    double m1 = b - g * (b - a), m2 = a + g * (b - a);
+    if (bvp.calCostAccKnown(x0, x1, m1) < bvp.calCostAccKnown(x0, x1, m2))
+      b = m2;
+    else
+      a = m1;
+  }
+  return std::min(best_cost, bvp.calCostAccKnown(x0, x1, (a + b) / 2));
+}
+
+int main()
+{
+  const int n_pairs = 20000;
+  const double rho = 0.01; // rho_time in planning.launch
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> rand_xy(-20.0, 20.0), rand_z(0.0, 5.0), rand_va(-3.0, 3.0);
+
+  vector<VectorXd> starts(n_pairs, VectorXd(9)), goals(n_pairs, VectorXd(9));
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    for (VectorXd *x : {&starts[i], &goals[i]})
+    {
+      (*x) << rand_xy(gen), rand_xy(gen), rand_z(gen),
+              rand_va(gen), rand_va(gen), rand_va(gen), rand_va(gen), rand_va(gen), rand_va(gen);
+    }
+  }
+  vector<std::array<double, 7>> polys(n_pairs);
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    double p[7];
+    tauPolynomial(starts[i], goals[i], rho, p);
+    std::copy(p, p + 7, polys[i].begin());
+  }
+
+  IntegratorBVP bvp;
+  bvp.init(TRIPLE_INTEGRATOR);
+  bvp.setRho(rho);
+
+  /* generic path, Sturm isolation into a std::set */
+  vector<double> generic_tau(n_pairs);
+  double generic_us = 0.0;
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    Eigen::VectorXd coeffs = Eigen::Map<const Eigen::VectorXd>(polys[i].data(), 7);
+    auto t = Clock::now();
+    std::set<double> roots = RootFinder::solvePolynomial(coeffs, 0.01, 100, 1e-6);
+    generic_us += usSince(t);
+    generic_tau[i] = bestRoot(bvp, starts[i], goals[i], roots);
+  }
+
+  /* fixed degree path, stack only */
+  vector<double> fixed_tau(n_pairs);
+  double fixed_us = 0.0;
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    double p[7], roots[6];
+    std::copy(polys[i].begin(), polys[i].end(), p);
+    auto t = Clock::now();
+    int n_roots = RootFinder::solveFixedDegree<6>(p, 0.01, 100, 1e-6, roots, std::pow(std::fabs(p[6]), 1.0 / 6));
+    fixed_us += usSince(t);
+    fixed_tau[i] = bestRoot(bvp, starts[i], goals[i], vector<double>(roots, roots + n_roots));
+  }
+
+  int tau_differ = 0;
+  double max_dtau = 0.0;
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    if ((generic_tau[i] == DBL_MAX) != (fixed_tau[i] == DBL_MAX))
+    {
+      ++tau_differ;
+      continue;
+    }
+    if (generic_tau[i] == DBL_MAX)
+      continue;
+    double dtau = std::fabs(generic_tau[i] - fixed_tau[i]);
+    max_dtau = std::max(max_dtau, dtau);
+    if (dtau > 1e-4 * generic_tau[i])
+      ++tau_differ;
+  }
+  printf("root finding: solvePolynomial %.3f us, solveFixedDegree<6> %.3f us per pair\n",
+         generic_us / n_pairs, fixed_us / n_pairs);
+  printf("  best tau differs in %d of %d pairs, max |dtau| %.3g\n", tau_differ, n_pairs, max_dtau);
+
+  /* the whole solve against the dense search */
+  int not_optimal = 0;
+  double solve_us = 0.0, max_excess = 0.0;
+  for (int i = 0; i < n_pairs; ++i)
+  {
+    auto t = Clock::now();
+    bool solved = bvp.solve(starts[i], goals[i], ACC_KNOWN);
+    solve_us += usSince(t);
+    double dense_cost = denseMinCost(bvp, starts[i], goals[i]);
+    double excess = solved ? bvp.getCostStar() - dense_cost : DBL_MAX;
+    max_excess = std::max(max_excess, excess / dense_cost);
+    if (excess > 1e-9 * dense_cost)
+      ++not_optimal;
+  }
+  printf("IntegratorBVP::solve() %.3f us per pair, above the dense search minimum in %d of %d pairs (max %.3g relative)\n",
+         solve_us / n_pairs, not_optimal, n_pairs, max_excess);
+
+  return (tau_differ == 0 && not_optimal == 0) ? 0 : 1;
+}
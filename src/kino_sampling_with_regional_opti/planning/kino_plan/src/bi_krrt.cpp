@@ -1,17 +1,20 @@
 #include "kino_plan/bi_krrt.h"
 #include <queue>
-#include <unordered_set>
+#include <algorithm>
 
 namespace kino_planner
 {
-BIKRRT::BIKRRT(const ros::NodeHandle& nh): sampler_(nh)
+BIKRRT::BIKRRT(const ros::NodeHandle& nh): sampler_(nh), planning_(false), cancel_(false), plan_result_(FAILURE), 
+                                             best_cost_(DBL_MAX), has_best_(false), 
+                                             portfolio_owner_(nullptr), incumbent_cost_(DBL_MAX)
 {
 }
 
 BIKRRT::~BIKRRT()
 {
-  for (int i = 0; i < tree_node_nums_; i++) 
-    delete node_pool_[i];
+  cancel_ = true;
+  if (plan_thread_.joinable())
+    plan_thread_.join();
 }
 
 void BIKRRT::init(const ros::NodeHandle& nh)
@@ -28,6 +31,14 @@ nh.param("bikrrt/allow_close_goal", allow_close_goal_, true);
   nh.param("bikrrt/rewire", rewire_, true);
   nh.param("bikrrt/use_regional_opt", use_regional_opt_, false);
   nh.param("bikrrt/test_convergency", test_convergency_, false);
+  nh.param("bikrrt/num_threads", num_threads_, 1);
+  nh.param("bikrrt/warm_start", warm_start_, false);
+  nh.param("bikrrt/lazy_collision", lazy_collision_, false);
+  nh.param("bikrrt/shrink_radius", shrink_radius_, false);
+  nh.param("bikrrt/shrink_radius_node_nums", shrink_radius_node_nums_, 100);
+  nh.param("bikrrt/portfolio_size", portfolio_size_, 1);
+  nh.param("bikrrt/prune_trees", prune_trees_, false);
+  nh.param("bikrrt/prune_interval", prune_interval_, 100);
   
   ROS_WARN_STREAM("[bikrrt] param: vel_limit: " << vel_limit_);
   ROS_WARN_STREAM("[bikrrt] param: acc_limit: " << acc_limit_);
@@ -41,17 +52,61 @@ nh.param("bikrrt/allow_close_goal", allow_close_goal_, true);
   ROS_WARN_STREAM("[bikrrt] param: rewire: " << rewire_);
   ROS_WARN_STREAM("[bikrrt] param: use_regional_opt: " << use_regional_opt_);
   ROS_WARN_STREAM("[bikrrt] param: test_convergency: " << test_convergency_);
+  ROS_WARN_STREAM("[bikrrt] param: num_threads: " << num_threads_);
+  ROS_WARN_STREAM("[bikrrt] param: warm_start: " << warm_start_);
+  ROS_WARN_STREAM("[bikrrt] param: lazy_collision: " << lazy_collision_);
+  ROS_WARN_STREAM("[bikrrt] param: shrink_radius: " << shrink_radius_);
+  ROS_WARN_STREAM("[bikrrt] param: shrink_radius_node_nums: " << shrink_radius_node_nums_);
+  ROS_WARN_STREAM("[bikrrt] param: portfolio_size: " << portfolio_size_);
+  ROS_WARN_STREAM("[bikrrt] param: prune_trees: " << prune_trees_);
+  ROS_WARN_STREAM("[bikrrt] param: prune_interval: " << prune_interval_);
 
+  parent_selector_.init(vel_limit_, acc_limit_, jerk_limit_, lazy_collision_);
   bvp_.init(TRIPLE_INTEGRATOR);
   bvp_.setRho(rho_);
+  shrink_radius_node_nums_ = max(shrink_radius_node_nums_, 2);
+  // neighbour radii for every tau up to the largest one rrtStar() asks for
+  reach_radius_table_.init(radius_cost_between_two_states_ * 0.75, 512);
+
+  if (num_threads_ > 1)
+  {
+    thread_pool_.reset(new ThreadPool(num_threads_));
+    worker_bvps_.resize(num_threads_);
+    worker_batches_.resize(num_threads_);
+    for (auto &bvp : worker_bvps_)
+    {
+      bvp.init(TRIPLE_INTEGRATOR);
+      bvp.setRho(rho_);
+    }
+  }
 
   valid_start_tree_node_nums_ = 0;
+  last_bridge_start_tree_ = nullptr;
+  last_bridge_goal_tree_ = nullptr;
   
   //pre allocate memory
-  node_pool_.resize(tree_node_nums_);
-  for (int i = 0; i < tree_node_nums_; i++) 
+  node_pool_.init(tree_node_nums_);
+  nbrs_.reserve(tree_node_nums_);
+  prune_keep_.reserve(tree_node_nums_);
+  prune_indexed_ids_.reserve(tree_node_nums_);
+
+  portfolio_.clear();
+  if (portfolio_owner_ == nullptr)
   {
-    node_pool_[i] = new RRTNode;
+    for (int i = 1; i < portfolio_size_; ++i)
+    {
+      BIKRRTPtr member(new BIKRRT(nh));
+      member->portfolio_owner_ = this;
+      member->init(nh);
+      // the regional optimizer, A* searcher and visualizer are not thread safe,
+      // so they stay with this planner; members only grow trees
+      member->use_regional_opt_ = false;
+      member->debug_vis_ = false;
+      member->allow_close_goal_ = false;
+      member->warm_start_ = false;
+      member->setPosChecker(pos_checker_ptr_);
+      portfolio_.push_back(member);
+    }
   }
 }
 
@@ -59,6 +114,9 @@ void BIKRRT::setPosChecker(const PosChecker::Ptr &checker)
 {
   pos_checker_ptr_ = checker;
   sampler_.setPosChecker(checker);
+  parent_selector_.setPosChecker(checker);
+  for (auto &member : portfolio_)
+    member->setPosChecker(checker);
 }
 
 void BIKRRT::setVisualizer(const VisualRviz::Ptr &vis)
@@ -67,14 +125,179 @@ void BIKRRT::setVisualizer(const VisualRviz::Ptr &vis)
 }
 
 // reset() is called every time before plan();
+// with warm start the trees are kept, plan() decides whether they can be reused
 void BIKRRT::reset()
 {
-  for (int i = 0; i <= valid_start_tree_node_nums_; i++) 
+  // nodes are re-initialized when taken from the pool, nothing to walk here
+  if (!warm_start_)
+    valid_start_tree_node_nums_ = 0;
+  std::lock_guard<std::mutex> lock(best_mtx_);
+  has_best_ = false;
+  best_cost_ = DBL_MAX;
+}
+
+bool BIKRRT::planAsync(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc, 
+                       Vector3d end_pos, Vector3d end_vel, Vector3d end_acc, 
+                       double search_time)
+{
+  if (planning_)
   {
-    node_pool_[i]->parent = nullptr;
-    node_pool_[i]->children.clear();
+    ROS_ERROR("[BIKRRT]: last search still running");
+    return false;
   }
-  valid_start_tree_node_nums_ = 0;
+  if (plan_thread_.joinable())
+    plan_thread_.join();
+
+  cancel_ = false;
+  planning_ = true;
+  plan_thread_ = std::thread([=]() {
+    plan_result_ = plan(start_pos, start_vel, start_acc, end_pos, end_vel, end_acc, search_time);
+    planning_ = false;
+  });
+  return true;
+}
+
+int BIKRRT::waitForResult()
+{
+  if (plan_thread_.joinable())
+    plan_thread_.join();
+  cancel_ = false;
+  return plan_result_;
+}
+
+bool BIKRRT::getBestTraj(Trajectory &traj, double &cost)
+{
+  std::lock_guard<std::mutex> lock(best_mtx_);
+  if (!has_best_)
+    return false;
+  traj = best_traj_;
+  cost = best_cost_;
+  return true;
+}
+
+// members of a portfolio publish to the planner that owns them, 
+// where only solutions better than the incumbent of the running search are kept
+void BIKRRT::publishSolution(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr &bridge_node_goal_tree, double cost)
+{
+  BIKRRT &owner = portfolio_owner_ ? *portfolio_owner_ : *this;
+  bool in_portfolio = !owner.portfolio_.empty();
+  if (in_portfolio && cost >= owner.incumbent_cost_)
+    return;
+  Trajectory traj;
+  if (bridge_node_goal_tree)
+    fillTraj(bridge_node_start_tree, bridge_node_goal_tree, traj);
+  else
+    fillTraj(bridge_node_start_tree, traj);
+  {
+    std::lock_guard<std::mutex> lock(owner.best_mtx_);
+    if (in_portfolio && cost >= owner.incumbent_cost_)
+      return;
+    owner.best_traj_ = traj;
+    owner.best_cost_ = cost;
+    owner.has_best_ = true;
+    owner.incumbent_cost_ = cost;
+  }
+  // with a portfolio this may run on any member's thread
+  if (owner.solution_cb_)
+    owner.solution_cb_(traj, cost);
+}
+
+inline double BIKRRT::pruneCost(double own_cost) const
+{
+  const BIKRRT &owner = portfolio_owner_ ? *portfolio_owner_ : *this;
+  if (owner.portfolio_.empty())
+    return own_cost;
+  return min(own_cost, owner.incumbent_cost_.load());
+}
+
+void BIKRRT::initTrees(const StatePVA &x_start, const StatePVA &x_goal)
+{
+  start_node_ = node_pool_.newNode(1); //init ptr
+  start_node_->x = x_start;
+  start_node_->cost_from_start = 0.0;
+  start_node_->tau_from_start = 0.0;
+  goal_node_ = node_pool_.newNode(0); //init ptr
+  goal_node_->x = x_goal;
+  goal_node_->cost_from_start = 0; //important
+  goal_node_->tau_from_start = 0; //important
+  goal_node_->tree_type = GOAL_TREE;
+  valid_start_tree_node_nums_ = 2; //start and goal already in node_pool_
+  last_bridge_start_tree_ = nullptr;
+  last_bridge_goal_tree_ = nullptr;
+}
+
+// a member searches the owner's query from fresh trees, 
+// its sampler is a copy of the owner's (same topology) with its own seed
+void BIKRRT::startMember(const BIKRRT &owner)
+{
+  t_start_ = owner.t_start_;
+  cancel_ = false;
+  initTrees(owner.start_node_->x, owner.goal_node_->x);
+  sampler_ = owner.sampler_;
+  std::random_device rd;
+  sampler_.seed(rd());
+}
+
+int BIKRRT::portfolioSearch(int n, double search_time)
+{
+  int n_members = portfolio_.size() + 1;
+  vector<int> results(n_members, FAILURE);
+  for (auto &member : portfolio_)
+    member->startMember(*this);
+
+  vector<std::thread> threads;
+  for (int i = 1; i < n_members; ++i)
+  {
+    BIKRRT *member = portfolio_[i - 1].get();
+    threads.emplace_back([member, n, search_time, &results, i]() {
+      results[i] = member->rrtStar(member->start_node_->x, member->goal_node_->x, n, search_time, 
+                                   member->radius_cost_between_two_states_, member->rewire_);
+    });
+  }
+  results[0] = rrtStar(start_node_->x, goal_node_->x, n, search_time, radius_cost_between_two_states_, rewire_);
+  for (auto &thread : threads)
+    thread.join();
+
+  /* member statistics, then keep the cheapest solution */
+  portfolio_stats_.resize(n_members);
+  int best_member(-1), first_member(-1);
+  for (int i = 0; i < n_members; ++i)
+  {
+    const BIKRRT &member = i == 0 ? *this : *portfolio_[i - 1];
+    PortfolioMemberStats &stats = portfolio_stats_[i];
+    stats.result = results[i];
+    stats.cost = DBL_MAX;
+    stats.first_traj_time = -1.0;
+    if (results[i] == SUCCESS)
+    {
+      stats.cost = member.last_bridge_start_tree_->cost_from_start + member.last_bridge_goal_tree_->cost_from_start;
+      stats.first_traj_time = member.first_traj_use_time_;
+      if (best_member < 0 || stats.cost < portfolio_stats_[best_member].cost)
+        best_member = i;
+      if (first_member < 0 || stats.first_traj_time < portfolio_stats_[first_member].first_traj_time)
+        first_member = i;
+    }
+    stats.samples = member.valid_sample_nums_;
+    stats.tree_nodes = member.valid_start_tree_node_nums_;
+    stats.bvp_solves = member.bvp_solve_nums_;
+    stats.pos_checks = member.pos_check_nums_;
+    ROS_INFO_STREAM("[BIKRRT]: portfolio member " << i << ": result " << stats.result << ", cost " << stats.cost 
+                    << ", first solution after " << stats.first_traj_time << " s, valid samples " << stats.samples 
+                    << ", tree nodes " << stats.tree_nodes);
+  }
+  if (best_member < 0)
+    return results[0];
+
+  if (best_member > 0)
+    traj_ = portfolio_[best_member - 1]->traj_;
+  if (first_member > 0)
+  {
+    first_traj_ = portfolio_[first_member - 1]->first_traj_;
+    first_traj_use_time_ = portfolio_[first_member - 1]->first_traj_use_time_;
+  }
+  final_traj_use_time_ = (ros::Time::now() - t_start_).toSec();
+  ROS_INFO_STREAM("[BIKRRT]: portfolio of " << n_members << " trees, best solution from member " << best_member);
+  return SUCCESS;
 }
 
 int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc, 
@@ -82,6 +305,9 @@ int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
                       double search_time)
 {
   t_start_ = ros::Time::now();
+  incumbent_cost_ = DBL_MAX;
+  // released before the search, which locks the map once per iteration
+  OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
 
   if (pos_checker_ptr_->getVoxelState(start_pos) != 0) 
   {
@@ -121,25 +347,23 @@ int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
   }
   
   /* construct start and goal nodes */
-  start_node_ = node_pool_[1]; //init ptr
-  start_node_->x.head(3) = start_pos;
-  start_node_->x.segment(3, 3) = start_vel;
-  start_node_->x.tail(3) = start_acc;
-  start_node_->cost_from_start = 0.0;
-  start_node_->tau_from_start = 0.0;
-  goal_node_ = node_pool_[0]; //init ptr
-  goal_node_->x.head(3) = end_pos;
   if (end_vel.norm() >= vel_limit_)
   {
     end_vel.normalize();
     end_vel = end_vel * vel_limit_;
   }
-  goal_node_->x.segment(3, 3) = end_vel;
-  goal_node_->x.tail(3) = end_acc;
-  goal_node_->cost_from_start = 0; //important
-  goal_node_->tau_from_start = 0; //important
-  goal_node_->tree_type = GOAL_TREE;
-  valid_start_tree_node_nums_ = 2; //start and goal already in node_pool_
+  StatePVA x_start, x_goal;
+  x_start << start_pos, start_vel, start_acc;
+  x_goal << end_pos, end_vel, end_acc;
+  if (warm_start_ && valid_start_tree_node_nums_ > 2 && (goal_node_->x - x_goal).norm() < 1e-3)
+  {
+    int reused_nums = reuseTrees(x_start);
+    ROS_INFO_STREAM("[BIKRRT]: warm start, " << reused_nums << " tree nodes reused");
+  }
+  else
+  {
+    initTrees(x_start, x_goal);
+  }
 
   /* init sampling space */
   vector<pair<Vector3d, Vector3d>> traversal_lines;
@@ -158,11 +382,9 @@ int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
     // poly_seg.sampleOneSeg(&vis_x);
     // vis_ptr_->visualizeStates(vis_x, BLUE, pos_checker_ptr_->getLocalTime());
 
-    bool vel_cons = poly_seg.checkMaxVelRate(vel_limit_);
-    bool acc_cons = poly_seg.checkMaxAccRate(acc_limit_);
-    bool jerk_cons = poly_seg.checkMaxJerkRate(jerk_limit_);
+    bool dyn_cons = poly_seg.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_);
     bool pos_cons = getTraversalLines(poly_seg, traversal_lines);
-    if (vel_cons && acc_cons && jerk_cons && pos_cons)
+    if (dyn_cons && pos_cons)
     {
       ROS_WARN("Best traj collision free, one shot connected");
       RRTNodePtr goal_node_ptr = addTreeNode(start_node_, goal_node_->x, poly_seg, best_cost, best_tau);
@@ -175,6 +397,9 @@ int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
       // goal_node_ptr->tau_from_parent = best_tau;
       fillTraj(goal_node_ptr, traj_);
       fillTraj(goal_node_ptr, first_traj_);
+      publishSolution(goal_node_ptr, nullptr, best_cost);
+      last_bridge_start_tree_ = nullptr;
+      last_bridge_goal_tree_ = nullptr;
       final_traj_use_time_ = (ros::Time::now() - t_start_).toSec();
       first_traj_use_time_ = final_traj_use_time_;
   
@@ -205,6 +430,9 @@ int BIKRRT::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc,
   vis_ptr_->visualizeTopo(p_head, tracks, pos_checker_ptr_->getLocalTime());
 
   int n = tree_node_nums_ - 20; // reserved for new node when two trees connects
+  map_lock.unlock();
+  if (!portfolio_.empty())
+    return portfolioSearch(n, search_time);
   return rrtStar(start_node_->x, goal_node_->x, n, search_time, radius_cost_between_two_states_, rewire_);
 }
 
@@ -218,7 +446,6 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
   double first_general_cost(0.0);
   double curr_best_solution_cost(DBL_MAX);
   RRTNodePtr bridge_node_start_tree(nullptr), bridge_node_goal_tree(nullptr);
-  unordered_set<RRTNodePtr> curr_traj_node_set_start_tree, curr_traj_node_set_goal_tree;
   
   /* local variables */
   valid_sample_nums_ = 0; //random samples in obs free area
@@ -232,27 +459,65 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
   traj_list_.clear();
   solution_cost_list_.clear();
   solution_time_list_.clear();
+  solution_source_list_.clear();
+  start_tree_rewire_nums_ = 0;
+  goal_tree_rewire_nums_ = 0;
+  pos_check_nums_ = 0;
+  pos_check_skipped_nums_ = 0;
+  bvp_solve_nums_ = 0;
+  bvp_skipped_nums_ = 0;
+  pruned_node_nums_ = 0;
+  double last_prune_cost(DBL_MAX);
+  int last_prune_sample_nums(0);
 
-  /* kd tree init */
-  kdtree *kd_tree = kd_create(3);
-  //Add start and goal nodes to kd tree
-  kd_insert3(kd_tree, start_node_->x[0], start_node_->x[1], start_node_->x[2], start_node_);
-  kd_insert3(kd_tree, goal_node_->x[0], goal_node_->x[1], goal_node_->x[2], goal_node_);
-
-  //TODO changable radius
+  // radius is the largest cost radius, it shrinks with the tree if shrink_radius_ is set
+  const double max_radius = radius;
+  int radius_node_nums = 0;
   double tau_for_instance = radius * 0.75; //maximum
   double fwd_radius_p = getForwardRadius(tau_for_instance, radius);  
   double bcwd_radius_p = getBackwardRadius(tau_for_instance, radius);
+
+  /* spatial index init, cells sized to the neighbour query radius */
+  const double index_cell_size = max(fwd_radius_p, bcwd_radius_p);
+  node_index_.reset(index_cell_size, tree_node_nums_);
+  //Add start and goal nodes, and the nodes kept by a warm start, to spatial index
+  for (int i = 0; i < valid_start_tree_node_nums_; ++i)
+  {
+    node_index_.insert(node_pool_[i]->x.head(3), node_pool_[i]);
+  }
+
+  /* the connection of the last search survived, start from it */
+  if (last_bridge_start_tree_ && last_bridge_goal_tree_)
+  {
+    bridge_node_start_tree = last_bridge_start_tree_;
+    bridge_node_goal_tree = last_bridge_goal_tree_;
+    curr_best_solution_cost = bridge_node_start_tree->cost_from_start + bridge_node_goal_tree->cost_from_start;
+    goal_found = true;
+    first_time_find_goal = false;
+    first_general_cost = curr_best_solution_cost;
+    first_goal_found_time = ros::Time::now();
+    first_traj_use_time_ = (first_goal_found_time - t_start_).toSec();
+    fillTraj(bridge_node_start_tree, bridge_node_goal_tree, first_traj_);
+    publishSolution(bridge_node_start_tree, bridge_node_goal_tree, curr_best_solution_cost);
+  }
    //ROS_INFO_STREAM("bcwd_radius_p: " << bcwd_radius_p);
    //ROS_INFO_STREAM("fwd_radius_p: " << fwd_radius_p);
 
+  sampler_.setInformedQuery(x_init, x_final, &bvp_, vel_limit_, acc_limit_, jerk_limit_);
+
   /* main loop */
   vector<StatePVA> samples, valid_samples;
   int idx = 0;
-  for (idx = 0; (ros::Time::now() - rrt_start_time).toSec() < search_time && valid_start_tree_node_nums_ < n ; ++idx) 
+  for (idx = 0; (ros::Time::now() - rrt_start_time).toSec() < search_time && valid_start_tree_node_nums_ < n && !cancelled(); ++idx) 
   {
-    /* biased random sampling */
+    /* the map fusion may only update the map between two iterations */
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
+    /* samples that cannot beat the incumbent, own or of another portfolio member, are rejected */
+    double prune_cost = pruneCost(curr_best_solution_cost);
+
+    /* biased random sampling, informed by the incumbent if enabled */
     StatePVA x_rand;
+    sampler_.setInformedCost(prune_cost);
     bool good_sample = sampler_.samplingOnce(idx, x_rand);
     // samples.push_back(x_rand);
     if (!good_sample) 
@@ -260,26 +525,17 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
       continue;
     }
     /* make sure that nearby nodes are in different lattices */
-    struct kdres *p_nbr_set = kd_nearest_range3(kd_tree, x_rand[0], x_rand[1], x_rand[2], 0.1);
-    if (p_nbr_set == nullptr)
-    {
-      ROS_ERROR("kd range query error");
-      break;
-    }
-    while(!kd_res_end(p_nbr_set)) 
+    node_index_.rangeQuery(x_rand.head(3), 0.1, nbrs_);
+    for (const RRTNodePtr &curr_node : nbrs_)
     {
-      RRTNodePtr curr_node = (RRTNodePtr)kd_res_item_data(p_nbr_set);
       Vector3d dir1(x_rand[3], x_rand[4], x_rand[5]);
       Vector3d dir2(curr_node->x[3], curr_node->x[4], curr_node->x[5]);
-      double angle_diff();
       if (dir1.dot(dir2) > 0) 
       {
         good_sample = false;
         break;
       }
-      kd_res_next(p_nbr_set);
     }
-    kd_res_free(p_nbr_set); 
     if (!good_sample) 
     {
       continue;
@@ -288,8 +544,20 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
 
     valid_samples.push_back(x_rand);
     ++valid_sample_nums_;
+
+    /* neighbourhood shrinks as the tree grows, cost radius ~ (log(n) / n)^(1 / d) with state dimension d = 9 */
+    if (shrink_radius_ && valid_start_tree_node_nums_ > shrink_radius_node_nums_ && valid_start_tree_node_nums_ != radius_node_nums)
+    {
+      radius_node_nums = valid_start_tree_node_nums_;
+      double n_nodes = valid_start_tree_node_nums_, n_0 = shrink_radius_node_nums_;
+      radius = max_radius * pow(log(n_nodes) / n_nodes * n_0 / log(n_0), 1.0 / 9.0);
+      tau_for_instance = radius * 0.75;
+      fwd_radius_p = getForwardRadius(tau_for_instance, radius);
+      bcwd_radius_p = getBackwardRadius(tau_for_instance, radius);
+    }
     
-    /* choose parent from kd tree range query result*/
+    /* choose parent from range query result*/
+    bool rewired_start_tree(false), rewired_goal_tree(false);
     double min_dist_start_tree(DBL_MAX), min_dist_goal_tree(DBL_MAX);
     double tau_from_s_start_tree(DBL_MAX), tau_from_s_goal_tree(DBL_MAX);
     double cost_from_p_start_tree(0.0), cost_from_p_goal_tree(0.0);
@@ -302,125 +570,62 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
     // vector<pair<double, double>> collide_timestamp_start_tree, collide_timestamp_goal_tree;
     // vector<Piece> regional_seg_start_tree, regional_seg_goal_tree;
      
-    /* kd_tree bounds search for parent */
-    struct kdres *p_bcwd_nbr_set;
-    p_bcwd_nbr_set = getBackwardNeighbour(x_rand, kd_tree, radius - tau_for_instance, bcwd_radius_p);
-    if (p_bcwd_nbr_set == nullptr)
-    {
-      ROS_ERROR("bkwd kd range query error");
-      break;
-    }
-    while(!kd_res_end(p_bcwd_nbr_set)) 
+    /* bounds search for parent in spatial index */
+    getBackwardNeighbour(x_rand, radius - tau_for_instance, bcwd_radius_p, nbrs_);
+    bcwd_candidates_.clear();
+    for (RRTNodePtr curr_node : nbrs_)
     {
-      RRTNodePtr curr_node = (RRTNodePtr)kd_res_item_data(p_bcwd_nbr_set);
       if (curr_node->tree_type == START_TREE) 
       { 
-        if (bvp_.solve(curr_node->x, x_rand, ACC_KNOWN))    // 第一个突破口curr_node   x_rand   ACC_KNOWN
+        // a parent this expensive gets the sample rejected anyway
+        if (prune_cost < DBL_MAX && curr_node->cost_from_start + bvp_.costLowerBound(curr_node->x, x_rand, ACC_KNOWN, vel_limit_, acc_limit_, jerk_limit_) >= prune_cost)
         {
-          CoefficientMat coeff;
-          bvp_.getCoeff(coeff);
-          Piece seg_from_parent = Piece(bvp_.getTauStar(), coeff);
-          // bool connected = checkSegmentConstraints(seg_from_parent);
-          bool vel_cons = seg_from_parent.checkMaxVelRate(vel_limit_);
-          bool acc_cons = seg_from_parent.checkMaxAccRate(acc_limit_);
-          bool jerk_cons = seg_from_parent.checkMaxJerkRate(jerk_limit_);
-          pair<Vector3d, Vector3d> collide_pts_one_seg;
-          pair<double, double> t_s_e;
-          bool need_region_opt(false);
-          bool pos_cons = pos_checker_ptr_->checkPolySeg(seg_from_parent, collide_pts_one_seg, t_s_e, need_region_opt);    //起点到终点的碰撞检测  把这个看明白
-          bool connected = vel_cons && acc_cons && jerk_cons && pos_cons;
-          //ROS_INFO("cons: %d, %d, %d, %d", vel_cons, acc_cons, jerk_cons, pos_cons);
-          if (connected) 
-          {
-            if (min_dist_start_tree > (curr_node->cost_from_start + bvp_.getCostStar()))
-            {
-              cost_from_p_start_tree = bvp_.getCostStar();
-              tau_from_p_start_tree = bvp_.getTauStar();
-              min_dist_start_tree = curr_node->cost_from_start + cost_from_p_start_tree;
-              tau_from_s_start_tree = curr_node->tau_from_start + tau_from_p_start_tree;
-              find_parent_seg_start_tree = seg_from_parent;
-              x_near_start_tree = curr_node;
-            } 
-          }
+          ++bvp_skipped_nums_;
+          continue;
+        }
+        bcwd_candidates_.emplace_back();
+        bcwd_candidates_.back().node = curr_node;
+      }
+    }
+    bvp_solve_nums_ += bcwd_candidates_.size();
 
+    /* candidates are evaluated independently (in parallel if num_threads > 1), 
+     * then reduced in range query order so the chosen parent matches the serial search. 
+     * This relies on a pair's bvp solution not depending on which worker or batch 
+     * solved it, see evaluateCandidateRange() and tauSeed() in bvp_solver.cpp */
+    evaluateCandidates(bcwd_candidates_, x_rand, true);
+    if (lazy_collision_)
+      parent_selector_.selectParentLazily(bcwd_candidates_, !goal_found && use_regional_opt_);
+    parent_selector_.countPosChecks(bcwd_candidates_, pos_check_nums_, pos_check_skipped_nums_);
 
-          
-          else if (!goal_found && need_region_opt && use_regional_opt_ && seg_from_parent.getAcc(bvp_.getTauStar()).norm() < acc_limit_)
-          //else
-          {
-            // double dis = (curr_node->x - x_rand).head(3).norm();
-            // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
-            // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_init).head(3).norm() - (curr_node->x-x_init).head(3).norm()) > 3) 
-            {
-              //find segs to be regionally optimized
-              regional_candidate_queue_start_tree.emplace(curr_node, collide_pts_one_seg, t_s_e, seg_from_parent, bvp_.getCostStar());
-              // regional_parents_start_tree.push_back(curr_node);
-              // collide_pts_start_tree.push_back(collide_pts_one_seg);
-              // regional_seg_start_tree.push_back(seg_from_parent);
-              // collide_timestamp_start_tree.push_back(t_s_e);
-              // ROS_WARN_STREAM("region parent: " << curr_node->x.transpose());
-              // ROS_WARN_STREAM("collides: " << collide_pts_one_seg.first.transpose() << ",  " << collide_pts_one_seg.second.transpose());
-            }
-          }
-        }
-        else
+    int n_bcwd_candidates = bcwd_candidates_.size();
+    for (int i = 0; i < n_bcwd_candidates; ++i)
+    {
+      const parentCandidate &cand = bcwd_candidates_[i];
+      RRTNodePtr curr_node = cand.node;
+      if (!cand.solved)
+      {
+        ROS_ERROR("sth. wrong with the bvp solver");
+        continue;
+      }
+      if (cand.connected) 
+      {
+        if (min_dist_start_tree > (curr_node->cost_from_start + cand.cost))
         {
-          ROS_ERROR("sth. wrong with the bvp solver");
-        }
+          cost_from_p_start_tree = cand.cost;
+          tau_from_p_start_tree = cand.tau;
+          min_dist_start_tree = curr_node->cost_from_start + cost_from_p_start_tree;
+          tau_from_s_start_tree = curr_node->tau_from_start + tau_from_p_start_tree;
+          find_parent_seg_start_tree = cand.seg;
+          x_near_start_tree = curr_node;
+        } 
+      }
+      else if (!goal_found && cand.need_region_opt && use_regional_opt_ && cand.seg.getAcc(cand.tau).norm() < acc_limit_)
+      {
+        //find segs to be regionally optimized
+        regional_candidate_queue_start_tree.emplace(curr_node, cand.collide_pts, cand.t_s_e, cand.seg, cand.cost);
       }
-      // else 
-      // {
-      //   if (bvp_.solve(x_rand, curr_node->x, ACC_KNOWN))
-      //   {
-      //     CoefficientMat coeff;
-      //     bvp_.getCoeff(coeff);
-      //     Piece seg_to_parent = Piece(bvp_.getTauStar(), coeff);
-      //     // bool connected = checkSegmentConstraints(seg_to_parent);
-      //     bool vel_cons = seg_to_parent.checkMaxVelRate(vel_limit_);
-      //     bool acc_cons = seg_to_parent.checkMaxAccRate(acc_limit_);
-      //     bool jerk_cons = seg_to_parent.checkMaxJerkRate(jerk_limit_);
-      //     pair<Vector3d, Vector3d> collide_pts_one_seg;
-      //     pair<double, double> t_s_e;
-      //     bool need_region_opt(false);
-      //     bool pos_cons = pos_checker_ptr_->checkPolySeg(seg_to_parent, collide_pts_one_seg, t_s_e, need_region_opt);
-      //     bool connected = vel_cons && acc_cons && jerk_cons && pos_cons;
-      //     if (connected) 
-      //     {
-      //       if (min_dist_goal_tree > (curr_node->cost_from_start + bvp_.getCostStar()))
-      //       {
-      //         cost_from_p_goal_tree = bvp_.getCostStar();
-      //         tau_from_p_goal_tree = bvp_.getTauStar();
-      //         min_dist_goal_tree = curr_node->cost_from_start + cost_from_p_goal_tree;
-      //         tau_from_s_goal_tree = curr_node->tau_from_start + tau_from_p_goal_tree;
-      //         find_parent_seg_goal_tree = seg_to_parent;
-      //         x_near_goal_tree = curr_node;
-      //       } 
-      //     }
-      //     else if (!goal_found && need_region_opt && use_regional_opt_)
-      //     {
-      //       // double dis = (curr_node->x - x_rand).head(3).norm();
-      //       // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
-      //       // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_final).head(3).norm() - (curr_node->x-x_final).head(3).norm()) > 3) 
-      //       {
-      //         //find segs to be regionally optimized
-      //         regional_candidate_queue_goal_tree.emplace(curr_node, collide_pts_one_seg, t_s_e, seg_to_parent, bvp_.getTauStar());
-      //         // regional_parents_goal_tree.push_back(curr_node);
-      //         // collide_pts_goal_tree.push_back(collide_pts_one_seg);
-      //         // regional_seg_goal_tree.push_back(seg_to_parent);
-      //         // collide_timestamp_goal_tree.push_back(t_s_e);
-      //         // ROS_WARN_STREAM("region parent: " << curr_node->x.transpose());
-      //         // ROS_WARN_STREAM("collides: " << collide_pts_one_seg.first.transpose() << ",  " << collide_pts_one_seg.second.transpose());
-      //       }
-      //     }
-      //   }
-      //   else
-      //   {
-      //     ROS_ERROR("sth. wrong with the bvp solver");
-      //   }
-      // }
-      kd_res_next(p_bcwd_nbr_set); //go to next in kd tree range query result
     }
-    kd_res_free(p_bcwd_nbr_set); //reset kd tree range query
 
     // size_t n_r_p_start_tree = regional_parents_start_tree.size();
     RRTNode* sampled_node_start_tree(nullptr);
@@ -451,7 +656,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
           optimizer_ptr_->getTraj(local_opt_traj);
 
           /* regional optimization succeeds when find parent, then:
-           * 1. add nodes of the local traj to rrt and kd_tree; 
+           * 1. add nodes of the local traj to rrt and spatial index; 
            */
           //sample rejection
           int n_mid_with_last_pt = local_opt_traj.getPieceNum();
@@ -460,7 +665,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
           if(bvp_.solve(x_rand, goal_node_->x, ACC_KNOWN))
           {
             double regional_traj_cost = local_opt_traj.calCost(rho_, cost);
-            if (curr_regional_candidate.parent->cost_from_start + regional_traj_cost + bvp_.getCostStar() >= curr_best_solution_cost) 
+            if (curr_regional_candidate.parent->cost_from_start + regional_traj_cost + bvp_.getCostStar() >= prune_cost) 
             {
               //ROS_INFO("ENTER 456");
               // ROS_WARN("regionally optimized but sample rejected");
@@ -503,8 +708,8 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
               }
               last_node = curr_node_in_regional_traj;
             }
-            /* 1.2 add the randomly sampled node to kd_tree */
-            kd_insert3(kd_tree, mid_x[0], mid_x[1], mid_x[2], curr_node_in_regional_traj);
+            /* 1.2 add the randomly sampled node to spatial index */
+            node_index_.insert(mid_x.head(3), curr_node_in_regional_traj);
             sampled_node_start_tree = curr_node_in_regional_traj;
             break;
           }
@@ -514,7 +719,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
     else if (x_near_start_tree != nullptr)
     {
       //ROS_INFO("enter 504");
-      /* parent found within radius, then add a node to rrt and kd_tree */
+      /* parent found within radius, then add a node to rrt and spatial index */
       //sample rejection
       bool promising_node(true);
       Vector3d calculated_acc = find_parent_seg_start_tree.getAcc(tau_from_p_start_tree);
@@ -523,7 +728,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
       x_rand.tail(3) = calculated_acc;
       if(bvp_.solve(x_rand, goal_node_->x, ACC_KNOWN))
       {
-        if (min_dist_start_tree + bvp_.getCostStar() >= curr_best_solution_cost) 
+        if (min_dist_start_tree + bvp_.getCostStar() >= prune_cost) 
         {
           // ROS_WARN("parent found but sample rejected");
           promising_node = false;
@@ -540,75 +745,64 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
         sampled_node_start_tree = addTreeNode(x_near_start_tree, x_rand, find_parent_seg_start_tree, min_dist_start_tree, tau_from_s_start_tree, cost_from_p_start_tree, tau_from_p_start_tree);
         sampled_node_start_tree->tree_type = START_TREE;
 
-        /* 1.2 add the randomly sampled node to kd_tree */
-        kd_insert3(kd_tree, x_rand[0], x_rand[1], x_rand[2], sampled_node_start_tree);
+        /* 1.2 add the randomly sampled node to spatial index */
+        node_index_.insert(x_rand.head(3), sampled_node_start_tree);
       }
     }
 
-    /* kd_tree bounds search for parent */
-    struct kdres *p_fwd_nbr_set;
-    p_fwd_nbr_set = getForwardNeighbour(x_rand, kd_tree, tau_for_instance, fwd_radius_p);
-    if (p_fwd_nbr_set == nullptr)
-    {
-      ROS_ERROR("search parent in goal tree, fwd kd range query error");
-      break;
-    }
-    while(!kd_res_end(p_fwd_nbr_set)) 
+    /* bounds search for parent in spatial index */
+    getForwardNeighbour(x_rand, tau_for_instance, fwd_radius_p, nbrs_);
+    fwd_candidates_.clear();
+    for (RRTNodePtr curr_node : nbrs_)
     {
-      RRTNodePtr curr_node = (RRTNodePtr)kd_res_item_data(p_fwd_nbr_set);
       if (curr_node->tree_type == GOAL_TREE)
       {
-        if (bvp_.solve(x_rand, curr_node->x, INITIAL_ACC_UNKNOWN))
+        if (prune_cost < DBL_MAX && curr_node->cost_from_start + bvp_.costLowerBound(x_rand, curr_node->x, INITIAL_ACC_UNKNOWN, vel_limit_, acc_limit_, jerk_limit_) >= prune_cost)
         {
-          CoefficientMat coeff;
-          bvp_.getCoeff(coeff);
-          Piece seg_to_parent = Piece(bvp_.getTauStar(), coeff);
-          // bool connected = checkSegmentConstraints(seg_to_parent);
-          bool vel_cons = seg_to_parent.checkMaxVelRate(vel_limit_);
-          bool acc_cons = seg_to_parent.checkMaxAccRate(acc_limit_);
-          bool jerk_cons = seg_to_parent.checkMaxJerkRate(jerk_limit_);
-          pair<Vector3d, Vector3d> collide_pts_one_seg;
-          pair<double, double> t_s_e;
-          bool need_region_opt(false);
-          bool pos_cons = pos_checker_ptr_->checkPolySeg(seg_to_parent, collide_pts_one_seg, t_s_e, need_region_opt);
-          bool connected = vel_cons && acc_cons && jerk_cons && pos_cons;
-          if (connected) 
-          {
-            if (min_dist_goal_tree > (curr_node->cost_from_start + bvp_.getCostStar()))
-            {
-              cost_from_p_goal_tree = bvp_.getCostStar();
-              tau_from_p_goal_tree = bvp_.getTauStar();
-              min_dist_goal_tree = curr_node->cost_from_start + cost_from_p_goal_tree;
-              tau_from_s_goal_tree = curr_node->tau_from_start + tau_from_p_goal_tree;
-              find_parent_seg_goal_tree = seg_to_parent;
-              x_near_goal_tree = curr_node;
-            } 
-          }
-          else if (!goal_found && need_region_opt && use_regional_opt_)
-          {
-            // double dis = (curr_node->x - x_rand).head(3).norm();
-            // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
-            // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_final).head(3).norm() - (curr_node->x-x_final).head(3).norm()) > 3) 
-            {
-              //find segs to be regionally optimized
-              regional_candidate_queue_goal_tree.emplace(curr_node, collide_pts_one_seg, t_s_e, seg_to_parent, bvp_.getTauStar());
-              // regional_parents_goal_tree.push_back(curr_node);
-              // collide_pts_goal_tree.push_back(collide_pts_one_seg);
-              // regional_seg_goal_tree.push_back(seg_to_parent);
-              // collide_timestamp_goal_tree.push_back(t_s_e);
-              // ROS_WARN_STREAM("region parent: " << curr_node->x.transpose());
-              // ROS_WARN_STREAM("collides: " << collide_pts_one_seg.first.transpose() << ",  " << collide_pts_one_seg.second.transpose());
-            }
-          }
+          ++bvp_skipped_nums_;
+          continue;
         }
-        else
+        fwd_candidates_.emplace_back();
+        fwd_candidates_.back().node = curr_node;
+      }
+    }
+    bvp_solve_nums_ += fwd_candidates_.size();
+    evaluateCandidates(fwd_candidates_, x_rand, false);
+    if (lazy_collision_)
+      parent_selector_.selectParentLazily(fwd_candidates_, !goal_found && use_regional_opt_);
+    parent_selector_.countPosChecks(fwd_candidates_, pos_check_nums_, pos_check_skipped_nums_);
+
+    for (const parentCandidate &cand : fwd_candidates_)
+    {
+      RRTNodePtr curr_node = cand.node;
+      if (!cand.solved)
+      {
+        ROS_ERROR("sth. wrong with the bvp solver");
+        continue;
+      }
+      if (cand.connected) 
+      {
+        if (min_dist_goal_tree > (curr_node->cost_from_start + cand.cost))
         {
-          ROS_ERROR("sth. wrong with the bvp solver");
+          cost_from_p_goal_tree = cand.cost;
+          tau_from_p_goal_tree = cand.tau;
+          min_dist_goal_tree = curr_node->cost_from_start + cost_from_p_goal_tree;
+          tau_from_s_goal_tree = curr_node->tau_from_start + tau_from_p_goal_tree;
+          find_parent_seg_goal_tree = cand.seg;
+          x_near_goal_tree = curr_node;
+        } 
+      }
+      else if (!goal_found && cand.need_region_opt && use_regional_opt_)
+      {
+        // double dis = (curr_node->x - x_rand).head(3).norm();
+        // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
+        // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_final).head(3).norm() - (curr_node->x-x_final).head(3).norm()) > 3) 
+        {
+          //find segs to be regionally optimized
+          regional_candidate_queue_goal_tree.emplace(curr_node, cand.collide_pts, cand.t_s_e, cand.seg, cand.tau);
         }
       }
-      kd_res_next(p_fwd_nbr_set); //go to next in kd tree range query result
     }
-    kd_res_free(p_fwd_nbr_set); //reset kd tree range query
 
     RRTNode *sampled_node_goal_tree(nullptr);
     // size_t n_r_p_goal_tree = regional_parents_goal_tree.size();
@@ -634,7 +828,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
           optimizer_ptr_->getTraj(local_opt_traj);
 
           /* regional optimization succeeds when find parent, then:
-           * 1. add nodes of the local traj to rrt and kd_tree; 
+           * 1. add nodes of the local traj to rrt and spatial index; 
            */
           //sample rejection
           int n_first_pt_with_mid = local_opt_traj.getPieceNum();
@@ -643,7 +837,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
           if(bvp_.solve(start_node_->x, x_rand, ACC_KNOWN))
           {
             double regional_traj_cost = local_opt_traj.calCost(rho_, cost);
-            if (curr_regional_candidate.parent->cost_from_start + regional_traj_cost + bvp_.getCostStar() >= curr_best_solution_cost) 
+            if (curr_regional_candidate.parent->cost_from_start + regional_traj_cost + bvp_.getCostStar() >= prune_cost) 
             {
               // ROS_WARN("regionally optimized but sample rejected");
               promising_node = false;
@@ -684,8 +878,8 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
               }
               last_node = curr_node_in_regional_traj;
             }
-            /* 1.2 add the randomly sampled node to kd_tree */
-            kd_insert3(kd_tree, mid_x[0], mid_x[1], mid_x[2], curr_node_in_regional_traj);
+            /* 1.2 add the randomly sampled node to spatial index */
+            node_index_.insert(mid_x.head(3), curr_node_in_regional_traj);
             sampled_node_goal_tree = curr_node_in_regional_traj;
             break;
           }
@@ -694,7 +888,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
     } 
     else if (x_near_goal_tree != nullptr)
     {
-      /* parent found within radius, then add a node to rrt and kd_tree */
+      /* parent found within radius, then add a node to rrt and spatial index */
       //sample rejection
       //ROS_INFO("Enter 685");
       bool promising_node(true);
@@ -708,7 +902,7 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
       x_rand.tail(3) = calculated_acc;
       if(bvp_.solve(start_node_->x, x_rand, ACC_KNOWN))
       {
-        if (min_dist_goal_tree + bvp_.getCostStar() >= curr_best_solution_cost) 
+        if (min_dist_goal_tree + bvp_.getCostStar() >= prune_cost) 
         {
           // ROS_WARN("parent found but sample rejected");
           //ROS_INFO("promising_node2!!!");
@@ -726,8 +920,8 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
         sampled_node_goal_tree = addTreeNode(x_near_goal_tree, x_rand, find_parent_seg_goal_tree, min_dist_goal_tree, tau_from_s_goal_tree, cost_from_p_goal_tree, tau_from_p_goal_tree);
         sampled_node_goal_tree->tree_type = GOAL_TREE;
         //ROS_INFO("sampled_node_goal_tree is null?: %d", sampled_node_goal_tree == nullptr);
-        /* 1.2 add the randomly sampled node to kd_tree */
-        kd_insert3(kd_tree, x_rand[0], x_rand[1], x_rand[2], sampled_node_goal_tree);
+        /* 1.2 add the randomly sampled node to spatial index */
+        node_index_.insert(x_rand.head(3), sampled_node_goal_tree);
       }
     }
 
@@ -735,22 +929,20 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
     {
       if (rewire) 
       {
-        //kd_tree bounds search
-        struct kdres *p_fwd_nbr_set;
-        p_fwd_nbr_set = getBackwardNeighbour(x_rand, kd_tree, radius - tau_for_instance, bcwd_radius_p);
-        if (p_fwd_nbr_set == nullptr)
-        {
-          ROS_ERROR("fwd kd range query error");
-          break;
-        }
-        while(!kd_res_end(p_fwd_nbr_set)) 
+        //spatial index bounds search
+        getBackwardNeighbour(x_rand, radius - tau_for_instance, bcwd_radius_p, nbrs_);
+        for (RRTNodePtr curr_node : nbrs_)
         {
-          RRTNode* curr_node = (RRTNode*)kd_res_item_data(p_fwd_nbr_set);
           if (curr_node->tree_type == START_TREE || curr_node == goal_node_) 
           {
-            kd_res_next(p_fwd_nbr_set);
             continue;
           }
+          if (sampled_node_goal_tree->cost_from_start + bvp_.costLowerBound(curr_node->x, x_rand, ACC_KNOWN, vel_limit_, acc_limit_, jerk_limit_) >= curr_node->cost_from_start)
+          {
+            ++bvp_skipped_nums_;
+            continue;
+          }
+          ++bvp_solve_nums_;
           Piece seg_rewire;
           if(bvp_.solve(curr_node->x, x_rand, ACC_KNOWN))
           {
@@ -761,37 +953,89 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
           else
           {
             ROS_ERROR("sth. wrong with the bvp solver");
+            continue;
           }
+          // lazy: only edges that would improve the node are collision checked
+          if (lazy_collision_ && sampled_node_goal_tree->cost_from_start + bvp_.getCostStar() >= curr_node->cost_from_start)
+          {
+            ++pos_check_skipped_nums_;
+            continue;
+          }
+          ++pos_check_nums_;
           bool connected = checkSegmentConstraints(seg_rewire);
           if (connected && sampled_node_goal_tree->cost_from_start + bvp_.getCostStar() < curr_node->cost_from_start) 
           {
             // If we can get to a node via the sampled_node faster than via it's existing parent then change the parent
-            RRTNodePtr old_parent(curr_node->parent);
             changeNodeParent(curr_node, sampled_node_goal_tree, seg_rewire, bvp_.getCostStar(), bvp_.getTauStar());
-            if (test_convergency_ && goal_found)
-            {
-              if (curr_traj_node_set_goal_tree.count(curr_node) > 0) // rewire a node in curr best traj
-              {
-                curr_traj_node_set_goal_tree.insert(sampled_node_goal_tree);
-                curr_traj_node_set_goal_tree.erase(old_parent);
-                curr_best_solution_cost = bridge_node_start_tree->cost_from_start + bridge_node_goal_tree->cost_from_start;
-                ros::Time curr_goal_found_time = ros::Time::now();
-                double curr_traj_use_time_ = (ros::Time::now() - t_start_).toSec();
-                Trajectory traj;
-                fillTraj(bridge_node_start_tree, bridge_node_goal_tree, traj);
-                traj_list_.emplace_back(traj);
-                solution_cost_list_.emplace_back(curr_best_solution_cost);
-                solution_time_list_.emplace_back(curr_traj_use_time_);
-                ROS_WARN_STREAM("curr cost: " << curr_best_solution_cost);
-              }
-            }
+            ++goal_tree_rewire_nums_;
+            rewired_goal_tree = true;
           }
-          /* go to the next entry */
-          kd_res_next(p_fwd_nbr_set);
         }
-        kd_res_free(p_fwd_nbr_set);
       }/* end of rewire */
     }
+
+    if (sampled_node_start_tree != nullptr && rewire)
+    {
+      /* rewire the start tree, nodes reachable from the sampled node get it as parent if that is cheaper.
+       * The start tree part of the state is used, x_rand may carry the acc of the goal tree by now */
+      const StatePVA &x_sampled = sampled_node_start_tree->x;
+      getForwardNeighbour(x_sampled, tau_for_instance, fwd_radius_p, nbrs_);
+      for (RRTNodePtr curr_node : nbrs_)
+      {
+        if (curr_node->tree_type == GOAL_TREE || curr_node == start_node_ || curr_node == sampled_node_start_tree) 
+        {
+          continue;
+        }
+        if (sampled_node_start_tree->cost_from_start + bvp_.costLowerBound(x_sampled, curr_node->x, ACC_KNOWN, vel_limit_, acc_limit_, jerk_limit_) >= curr_node->cost_from_start)
+        {
+          ++bvp_skipped_nums_;
+          continue;
+        }
+        ++bvp_solve_nums_;
+        Piece seg_rewire;
+        if (bvp_.solve(x_sampled, curr_node->x, ACC_KNOWN))
+        {
+          CoefficientMat coeff;
+          bvp_.getCoeff(coeff);
+          seg_rewire = Piece(bvp_.getTauStar(), coeff);
+        }
+        else
+        {
+          ROS_ERROR("sth. wrong with the bvp solver");
+          continue;
+        }
+        // lazy: only edges that would improve the node are collision checked
+        if (lazy_collision_ && sampled_node_start_tree->cost_from_start + bvp_.getCostStar() >= curr_node->cost_from_start)
+        {
+          ++pos_check_skipped_nums_;
+          continue;
+        }
+        ++pos_check_nums_;
+        bool connected = checkSegmentConstraints(seg_rewire);
+        if (connected && sampled_node_start_tree->cost_from_start + bvp_.getCostStar() < curr_node->cost_from_start) 
+        {
+          // the subtree of curr_node follows in changeNodeParent(), bridge nodes in it included
+          changeNodeParent(curr_node, sampled_node_start_tree, seg_rewire, bvp_.getCostStar(), bvp_.getTauStar());
+          ++start_tree_rewire_nums_;
+          rewired_start_tree = true;
+        }
+      }
+    }/* end of rewire */
+
+    /* a rewire upstream of a bridge node lowers the cost of the current solution */
+    if (goal_found && (rewired_start_tree || rewired_goal_tree))
+    {
+      double bridged_cost = bridge_node_start_tree->cost_from_start + bridge_node_goal_tree->cost_from_start;
+      if (bridged_cost < curr_best_solution_cost)
+      {
+        curr_best_solution_cost = bridged_cost;
+        publishSolution(bridge_node_start_tree, bridge_node_goal_tree, curr_best_solution_cost);
+        if (test_convergency_)
+          recordSolution(bridge_node_start_tree, bridge_node_goal_tree, curr_best_solution_cost, 
+                         rewired_start_tree ? START_TREE_REWIRE : GOAL_TREE_REWIRE);
+      }
+    }
+
     /* end of find parent */
     //ROS_INFO("222sampled_node_goal_tree is null?: %d", sampled_node_goal_tree == nullptr);
     //ROS_INFO("222sampled_node_start_tree is null?: %d", sampled_node_start_tree == nullptr);
@@ -807,33 +1051,10 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
       bridge_node_start_tree = sampled_node_start_tree;
       bridge_node_goal_tree = sampled_node_goal_tree;
       goal_found = true;
+      publishSolution(bridge_node_start_tree, bridge_node_goal_tree, curr_best_solution_cost);
 
       if (test_convergency_)
-      {
-        ros::Time curr_goal_found_time = ros::Time::now();
-        double curr_traj_use_time_ = (ros::Time::now() - t_start_).toSec();
-        Trajectory traj;
-        fillTraj(bridge_node_start_tree, bridge_node_goal_tree, traj);
-        traj_list_.emplace_back(traj);
-        solution_cost_list_.emplace_back(curr_best_solution_cost);
-        solution_time_list_.emplace_back(curr_traj_use_time_);
-        ROS_WARN_STREAM("curr cost: " << curr_best_solution_cost);
-
-        curr_traj_node_set_start_tree.clear();
-        curr_traj_node_set_goal_tree.clear();
-        RRTNodePtr node(bridge_node_start_tree);
-        while (node->parent)
-        {
-          curr_traj_node_set_start_tree.insert(node);
-          node = node->parent;
-        }
-        node = bridge_node_goal_tree;
-        while (node->parent)
-        {
-          curr_traj_node_set_goal_tree.insert(node);
-          node = node->parent;
-        }
-      }
+        recordSolution(bridge_node_start_tree, bridge_node_goal_tree, curr_best_solution_cost, CONNECTION);
       if (first_time_find_goal) 
       {
         first_general_cost = curr_best_solution_cost;
@@ -841,25 +1062,24 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
         first_traj_use_time_ = (first_goal_found_time - t_start_).toSec();
         first_time_find_goal = false;
         fillTraj(bridge_node_start_tree, bridge_node_goal_tree, first_traj_);
-
-        RRTNodePtr node(bridge_node_start_tree);
-        while (node->parent)
-        {
-          curr_traj_node_set_start_tree.insert(node);
-          node = node->parent;
-        }
-        node = bridge_node_goal_tree;
-        while (node->parent)
-        {
-          curr_traj_node_set_goal_tree.insert(node);
-          node = node->parent;
-        }
       }
       if (stop_after_first_traj_found_) 
         break; //stop searching after first time find the goal?
     }
     /* end of try to connect to goal */
 
+    /* branch and bound, drop the nodes that cannot lead to a better solution any more */
+    if (prune_trees_ && goal_found && valid_sample_nums_ - last_prune_sample_nums >= prune_interval_)
+    {
+      double cost_bound = pruneCost(curr_best_solution_cost);
+      if (cost_bound < last_prune_cost)
+      {
+        last_prune_cost = cost_bound;
+        last_prune_sample_nums = valid_sample_nums_;
+        pruned_node_nums_ += pruneTrees(cost_bound, index_cell_size, bridge_node_start_tree, bridge_node_goal_tree);
+      }
+    }
+
     // vis_x.clear();
     // vector<Vector3d> knots;
     // sampleWholeTree(start_node_, &vis_x, knots);
@@ -868,6 +1088,27 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
 
   }/* end of sample once */
   t_end_ = ros::Time::now();
+  if (prune_trees_)
+    ROS_INFO_STREAM("[BIKRRT]: tree nodes removed by branch and bound: " << pruned_node_nums_);
+  if (rewire)
+    ROS_INFO_STREAM("[BIKRRT]: rewired start tree nodes: " << start_tree_rewire_nums_ << ", goal tree nodes: " << goal_tree_rewire_nums_);
+  if (test_convergency_)
+  {
+    // cost over time, one curve per kind of improvement
+    const char *source_names[] = {"connection", "start tree rewire", "goal tree rewire"};
+    for (size_t i = 0; i < solution_cost_list_.size(); ++i)
+      ROS_INFO_STREAM("[BIKRRT]: convergence: " << solution_time_list_[i] << " s, cost " << solution_cost_list_[i] 
+                      << ", " << source_names[solution_source_list_[i]]);
+  }
+  ROS_INFO_STREAM("[BIKRRT]: checkPolySeg calls: " << pos_check_nums_ << ", avoided by lazy collision checking: " << pos_check_skipped_nums_);
+  ROS_INFO_STREAM("[BIKRRT]: neighbour BVP solves: " << bvp_solve_nums_ << ", skipped by cost lower bound: " << bvp_skipped_nums_ 
+                  << " (" << 100.0 * bvp_skipped_nums_ / max(1, bvp_solve_nums_ + bvp_skipped_nums_) << "%)");
+  int informed_rejected_nums, spheroid_sample_nums;
+  sampler_.getInformedNums(informed_rejected_nums, spheroid_sample_nums);
+  if (informed_rejected_nums + spheroid_sample_nums > 0)
+    ROS_INFO_STREAM("[BIKRRT]: samples redrawn by informed sampling: " << informed_rejected_nums << ", drawn in the informed spheroid: " << spheroid_sample_nums);
+  last_bridge_start_tree_ = goal_found ? bridge_node_start_tree : nullptr;
+  last_bridge_goal_tree_ = goal_found ? bridge_node_goal_tree : nullptr;
 
   // vis_x.clear();
   // vector<Vector3d> knots;
@@ -942,59 +1183,15 @@ int BIKRRT::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n, doub
 
 double BIKRRT::getForwardRadius(double tau, double cost)
 {
-  MatrixXd G(3, 3);
-  G.setZero();
-  double tau_2 = tau * tau;
-  double tau_3 = tau_2 * tau;
-  double tau_4 = tau_3 * tau;
-  double tau_5 = tau_4 * tau;
-  G(0, 0) = 720.0 / tau_5;
-  G(1, 1) = 192.0 / tau_3;
-  G(2, 2) = 9.0 / tau;
-  G(0, 1) = G(1, 0) = -360.0 / tau_4;
-  G(0, 2) = G(2, 0) = 60.0 / tau_3;
-  G(1, 2) = G(2, 1) = -36.0 / tau_2;
-  G = G * rho_ / (cost - tau) * 3.0;
-  // ROS_INFO_STREAM("G: \n" << G);
-  Eigen::EigenSolver<MatrixXd> es(G);
-  // cout << "The eigenvalues of G are:" << endl << es.eigenvalues() << endl;
-  // cout << "The matrix of eigenvectors, V, is:" << endl << es.eigenvectors() << endl << endl;
-  double radius_p(0.0);
-  for (int i = 0; i < 3; ++i)
-  {
-    radius_p = max(radius_p, sqrt(1.0 / es.eigenvalues()[i].real()) * fabs(es.eigenvectors().col(i)[i]));
-  }
-  return radius_p * 1.732;
+  return reach_radius_table_.radius(tau, cost, rho_);
 }
 
 double BIKRRT::getBackwardRadius(double tau, double cost)
 {
-  MatrixXd G(3, 3);
-  G.setZero();
-  double tau_2 = tau * tau;
-  double tau_3 = tau_2 * tau;
-  double tau_4 = tau_3 * tau;
-  double tau_5 = tau_4 * tau;
-  G(0, 0) = 720.0 / tau_5;
-  G(1, 1) = 192.0 / tau_3;
-  G(2, 2) = 9.0 / tau;
-  G(0, 1) = G(1, 0) = -360.0 / tau_4;
-  G(0, 2) = G(2, 0) = 60.0 / tau_3;
-  G(1, 2) = G(2, 1) = -36.0 / tau_2;
-  G = G * rho_ / (cost - tau) * 3.0;
-  // ROS_INFO_STREAM("G: \n" << G);
-  Eigen::EigenSolver<MatrixXd> es(G);
-  // cout << "The eigenvalues of G are:" << endl << es.eigenvalues() << endl;
-  // cout << "The matrix of eigenvectors, V, is:" << endl << es.eigenvectors() << endl << endl;
-  double radius_p(0.0);
-  for (int i = 0; i < 3; ++i)
-  {
-    radius_p = max(radius_p, sqrt(1.0 / es.eigenvalues()[i].real()) * fabs(es.eigenvectors().col(i)[i]));
-  }
-  return radius_p * 1.732;
+  return reach_radius_table_.radius(tau, cost, rho_);
 }
 
-struct kdres *BIKRRT::getForwardNeighbour(const StatePVA& x0, struct kdtree *kd_tree, double tau, double radius_p)
+void BIKRRT::getForwardNeighbour(const StatePVA& x0, double tau, double radius_p, vector<RRTNodePtr>& nbrs)
 {
   double half_tau_square = tau * tau / 2;
   StatePVA x_ba_tau;
@@ -1014,10 +1211,10 @@ struct kdres *BIKRRT::getForwardNeighbour(const StatePVA& x0, struct kdtree *kd_
     // vis_ptr_->visualizeReachVel(1, x_ba_tau.head(3) + x_ba_tau.tail(3), 2 * radius_v, pos_checker_ptr_->getLocalTime());
     // getchar();
   }
-  return kd_nearest_range3(kd_tree, x_ba_tau[0], x_ba_tau[1], x_ba_tau[2], radius_p);
+  node_index_.rangeQuery(x_ba_tau.head(3), radius_p, nbrs);
 }
 
-struct kdres *BIKRRT::getBackwardNeighbour(const StatePVA& x1, struct kdtree *kd_tree, double tau, double radius_p)
+void BIKRRT::getBackwardNeighbour(const StatePVA& x1, double tau, double radius_p, vector<RRTNodePtr>& nbrs)
 {
   StatePVA expNegATau_x1;
   double half_tau_square = tau * tau / 2;
@@ -1037,18 +1234,18 @@ struct kdres *BIKRRT::getBackwardNeighbour(const StatePVA& x1, struct kdtree *kd
     // vis_ptr_->visualizeReachVel(1, expNegATau_x1.head(3) + expNegATau_x1.tail(3), 2 * radius_v, pos_checker_ptr_->getLocalTime());
     // getchar();
   }
-  return kd_nearest_range3(kd_tree, expNegATau_x1[0], expNegATau_x1[1], expNegATau_x1[2], radius_p);
+  node_index_.rangeQuery(expNegATau_x1.head(3), radius_p, nbrs);
 }
 
 inline RRTNodePtr BIKRRT::addTreeNode(RRTNodePtr& parent, const StatePVA& state, const Piece& piece, 
                                            const double& cost_from_start, const double& tau_from_start, 
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
-  RRTNodePtr new_node_ptr = node_pool_[valid_start_tree_node_nums_++];
+  RRTNodePtr new_node_ptr = node_pool_.newNode(valid_start_tree_node_nums_++);
   new_node_ptr->parent = parent;
-  parent->children.push_back(new_node_ptr);
+  parent->addChild(new_node_ptr);
   new_node_ptr->x = state;
-  new_node_ptr->poly_seg = piece;
+  node_pool_.polySeg(new_node_ptr) = piece;
   new_node_ptr->cost_from_start = cost_from_start;
   new_node_ptr->tau_from_start = tau_from_start;
   new_node_ptr->cost_from_parent = cost_from_parent;
@@ -1059,11 +1256,11 @@ inline RRTNodePtr BIKRRT::addTreeNode(RRTNodePtr& parent, const StatePVA& state,
 inline RRTNodePtr BIKRRT::addTreeNode(RRTNodePtr& parent, const StatePVA& state, const Piece& piece, 
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
-  RRTNodePtr new_node_ptr = node_pool_[valid_start_tree_node_nums_++];
+  RRTNodePtr new_node_ptr = node_pool_.newNode(valid_start_tree_node_nums_++);
   new_node_ptr->parent = parent;
-  parent->children.push_back(new_node_ptr);
+  parent->addChild(new_node_ptr);
   new_node_ptr->x = state;
-  new_node_ptr->poly_seg = piece;
+  node_pool_.polySeg(new_node_ptr) = piece;
   new_node_ptr->cost_from_start = parent->cost_from_start + cost_from_parent;
   new_node_ptr->tau_from_start = parent->tau_from_start + tau_from_parent;
   new_node_ptr->cost_from_parent = cost_from_parent;
@@ -1075,14 +1272,14 @@ inline void BIKRRT::changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent, const
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
   if (node->parent)
-    node->parent->children.remove(node);  //DON'T FORGET THIS, remove it form its parent's children list
+    node->parent->removeChild(node);  //DON'T FORGET THIS, remove it form its parent's children list
   node->parent = parent;
   node->cost_from_parent = cost_from_parent;
   node->tau_from_parent = tau_from_parent;
   node->cost_from_start = parent->cost_from_start + cost_from_parent;
   node->tau_from_start = parent->tau_from_start + tau_from_parent;
-  node->poly_seg = piece;
-  parent->children.push_back(node);
+  node_pool_.polySeg(node) = piece;
+  parent->addChild(node);
 
   // for all its descedants, change the cost_from_start and tau_from_start;
   RRTNode* descendant(node);
@@ -1092,7 +1289,7 @@ inline void BIKRRT::changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent, const
   {
     descendant = Q.front();
     Q.pop();
-    for (const auto& leafptr : descendant->children) 
+    for (RRTNode* leafptr = descendant->first_child; leafptr; leafptr = leafptr->next_sibling) 
     {
       leafptr->cost_from_start = leafptr->cost_from_parent + descendant->cost_from_start;
       leafptr->tau_from_start = leafptr->tau_from_parent + descendant->tau_from_start;
@@ -1101,6 +1298,156 @@ inline void BIKRRT::changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent, const
   }
 }
 
+// Keeps the trees of the last search for a replan towards the same goal.
+// The start tree is re-rooted at x_start by connecting to the node on the
+// last solution path that gives the cheapest path, so only that node's
+// subtree stays in the start tree. Edges that collide in the current map are
+// cut with their subtrees, and the surviving nodes are moved to the front of
+// the pool. Returns the number of nodes kept.
+int BIKRRT::reuseTrees(const StatePVA &x_start)
+{
+  vector<RRTNodePtr> last_path;
+  for (RRTNodePtr node = last_bridge_start_tree_; node && node != start_node_; node = node->parent)
+  {
+    last_path.push_back(node);
+  }
+
+  start_node_->x = x_start;
+  start_node_->cost_from_start = 0.0;
+  start_node_->tau_from_start = 0.0;
+  start_node_->first_child = nullptr; // old branches are dropped
+  RRTNodePtr new_child(nullptr);
+  Piece new_child_seg;
+  double best_key(DBL_MAX), new_child_cost(0.0), new_child_tau(0.0);
+  for (const RRTNodePtr &node : last_path)
+  {
+    if (!bvp_.solve(x_start, node->x, ACC_KNOWN))
+      continue;
+    // the rest of the path from node to the bridge costs the same as before
+    double key = bvp_.getCostStar() - node->cost_from_start;
+    if (key >= best_key)
+      continue;
+    CoefficientMat coeff;
+    bvp_.getCoeff(coeff);
+    Piece seg(bvp_.getTauStar(), coeff);
+    if (!checkSegmentConstraints(seg))
+      continue;
+    best_key = key;
+    new_child = node;
+    new_child_seg = seg;
+    new_child_cost = bvp_.getCostStar();
+    new_child_tau = bvp_.getTauStar();
+  }
+  if (new_child)
+  {
+    changeNodeParent(new_child, start_node_, new_child_seg, new_child_cost, new_child_tau);
+  }
+
+  /* bfs over both trees, only through edges still collision free */
+  vector<RRTNodePtr> keep;
+  keep.reserve(valid_start_tree_node_nums_);
+  keep.push_back(goal_node_);
+  keep.push_back(start_node_);
+  for (size_t i = 0; i < keep.size(); ++i)
+  {
+    for (RRTNodePtr child = keep[i]->first_child; child; child = child->next_sibling)
+    {
+      if (pos_checker_ptr_->checkPolySeg(node_pool_.polySeg(child)))
+        keep.push_back(child);
+    }
+  }
+
+  int bridge_start_id = last_bridge_start_tree_ ? last_bridge_start_tree_->id : -1;
+  int bridge_goal_id = last_bridge_goal_tree_ ? last_bridge_goal_tree_->id : -1;
+  vector<int> new_ids;
+  node_pool_.compact(keep, new_ids);
+  goal_node_ = node_pool_[0];
+  start_node_ = node_pool_[1];
+  valid_start_tree_node_nums_ = keep.size();
+  if (bridge_start_id >= 0 && bridge_goal_id >= 0 && new_ids[bridge_start_id] >= 0 && new_ids[bridge_goal_id] >= 0)
+  {
+    last_bridge_start_tree_ = node_pool_[new_ids[bridge_start_id]];
+    last_bridge_goal_tree_ = node_pool_[new_ids[bridge_goal_id]];
+  }
+  else
+  {
+    last_bridge_start_tree_ = nullptr;
+    last_bridge_goal_tree_ = nullptr;
+  }
+  return valid_start_tree_node_nums_;
+}
+
+void BIKRRT::recordSolution(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr &bridge_node_goal_tree, double cost, int source)
+{
+  Trajectory traj;
+  fillTraj(bridge_node_start_tree, bridge_node_goal_tree, traj);
+  traj_list_.emplace_back(traj);
+  solution_cost_list_.emplace_back(cost);
+  solution_time_list_.emplace_back((ros::Time::now() - t_start_).toSec());
+  solution_source_list_.emplace_back(source);
+  ROS_WARN_STREAM("curr cost: " << cost);
+}
+
+// Branch and bound: a start tree node whose cost plus a lower bound of its cost to the goal
+// reaches cost_bound cannot be on a better solution, and neither can its subtree. The same 
+// holds for goal tree nodes with a lower bound from the start. Such nodes are dropped from
+// the trees and the spatial index, and the pool is compacted so that their slots are reused.
+// The nodes on the current solution are always kept, the bridge nodes are updated to the
+// compacted pool. Returns the number of nodes removed.
+int BIKRRT::pruneTrees(double cost_bound, double index_cell_size, RRTNodePtr &bridge_node_start_tree, RRTNodePtr &bridge_node_goal_tree)
+{
+  prune_on_path_.assign(valid_start_tree_node_nums_, 0);
+  for (RRTNodePtr node = bridge_node_start_tree; node; node = node->parent)
+    prune_on_path_[node->id] = 1;
+  for (RRTNodePtr node = bridge_node_goal_tree; node; node = node->parent)
+    prune_on_path_[node->id] = 1;
+
+  /* bfs over both trees, a dropped node takes its subtree along */
+  prune_keep_.clear();
+  prune_keep_.push_back(goal_node_);
+  prune_keep_.push_back(start_node_);
+  for (size_t i = 0; i < prune_keep_.size(); ++i)
+  {
+    for (RRTNodePtr child = prune_keep_[i]->first_child; child; child = child->next_sibling)
+    {
+      // a path through the node may cross the bridge, where the acc jumps, so the acc terms are left out
+      double lower_bound = child->tree_type == START_TREE 
+          ? bvp_.costLowerBound(child->x, goal_node_->x, ACC_UNKNOWN, vel_limit_, acc_limit_, jerk_limit_)
+          : bvp_.costLowerBound(start_node_->x, child->x, ACC_UNKNOWN, vel_limit_, acc_limit_, jerk_limit_);
+      if (prune_on_path_[child->id] || child->cost_from_start + lower_bound < cost_bound)
+        prune_keep_.push_back(child);
+    }
+  }
+  int n_pruned = valid_start_tree_node_nums_ - (int)prune_keep_.size();
+  if (n_pruned <= 0)
+    return 0;
+
+  // not every tree node is indexed (inner nodes of regionally optimized segments are not)
+  prune_indexed_ids_.clear();
+  for (const RRTNodePtr &node : node_index_.nodes())
+    prune_indexed_ids_.push_back(node->id);
+  int bridge_start_id = bridge_node_start_tree->id;
+  int bridge_goal_id = bridge_node_goal_tree->id;
+
+  node_pool_.compact(prune_keep_, prune_new_ids_);
+  goal_node_ = node_pool_[0];
+  start_node_ = node_pool_[1];
+  valid_start_tree_node_nums_ = prune_keep_.size();
+  bridge_node_start_tree = node_pool_[prune_new_ids_[bridge_start_id]];
+  bridge_node_goal_tree = node_pool_[prune_new_ids_[bridge_goal_id]];
+
+  node_index_.reset(index_cell_size, tree_node_nums_);
+  for (int id : prune_indexed_ids_)
+  {
+    if (prune_new_ids_[id] >= 0)
+    {
+      RRTNodePtr node = node_pool_[prune_new_ids_[id]];
+      node_index_.insert(node->x.head(3), node);
+    }
+  }
+  return n_pruned;
+}
+
 inline bool BIKRRT::regionalOpt(const Piece& oringin_seg, const pair<Vector3d, Vector3d>& collide_pts_one_seg, const pair<double, double>& t_s_e)
 {
   int split_seg_num = 2;
@@ -1149,13 +1496,14 @@ inline void BIKRRT::sampleWholeTree(const RRTNodePtr &root, vector< StatePVA >*
   RRTNode* node = root;
   std::queue<RRTNode*> Q;
   Q.push(node);
+  TrajSamples samples;
   while (!Q.empty()) 
   {
     node = Q.front();
     Q.pop();
-    for (const auto& leafptr : node->children) 
+    for (RRTNode* leafptr = node->first_child; leafptr; leafptr = leafptr->next_sibling) 
     {
-      leafptr->poly_seg.sampleOneSeg(vis_x);
+      node_pool_.polySeg(leafptr).sampleOneSeg(vis_x, samples);
       knots.push_back(leafptr->x.head(3));
       Q.push(leafptr);
     }
@@ -1169,8 +1517,9 @@ void BIKRRT::fillTraj(const RRTNodePtr &goal_leaf, Trajectory& traj)
   RRTNodePtr node = goal_leaf;
   while (node->parent) 
   {
-    durs.push_back(node->poly_seg.getDuration());
-    coeffMats.push_back(node->poly_seg.getCoeffMat());
+    const Piece &seg = node_pool_.polySeg(node);
+    durs.push_back(seg.getDuration());
+    coeffMats.push_back(seg.getCoeffMat());
     node = node->parent;
   }
   std::reverse(std::begin(durs), std::end(durs));
@@ -1185,8 +1534,9 @@ void BIKRRT::fillTraj(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr
   RRTNodePtr node = bridge_node_start_tree;
   while (node->parent) 
   {
-    durs.push_back(node->poly_seg.getDuration());
-    coeffMats.push_back(node->poly_seg.getCoeffMat());
+    const Piece &seg = node_pool_.polySeg(node);
+    durs.push_back(seg.getDuration());
+    coeffMats.push_back(seg.getCoeffMat());
     node = node->parent;
   }
   std::reverse(std::begin(durs), std::end(durs));
@@ -1194,28 +1544,76 @@ void BIKRRT::fillTraj(const RRTNodePtr &bridge_node_start_tree, const RRTNodePtr
   node = bridge_node_goal_tree;
   while (node->parent) 
   {
-    durs.push_back(node->poly_seg.getDuration());
-    coeffMats.push_back(node->poly_seg.getCoeffMat());
+    const Piece &seg = node_pool_.polySeg(node);
+    durs.push_back(seg.getDuration());
+    coeffMats.push_back(seg.getCoeffMat());
     node = node->parent;
   }
   traj = Trajectory(durs, coeffMats);
 }
 
-inline bool BIKRRT::checkSegmentConstraints(const Piece &seg)
+void BIKRRT::evaluateCandidates(parentCandidates &cands, const StatePVA &x_rand, bool backward)
 {
-  if (!seg.checkMaxVelRate(vel_limit_))
+  int n_cands = cands.size();
+  if (thread_pool_)
   {
-    // ROS_WARN("vel constraints violate!");
-    return false;
+    // one contiguous chunk per worker, each solved as a batch, so every pair goes 
+    // through the same arithmetic as in the serial batch and gets the same result
+    int n_chunks = std::min(n_cands, thread_pool_->size());
+    thread_pool_->parallelFor(n_chunks, [&](int worker_id, int c) {
+      evaluateCandidateRange(worker_bvps_[worker_id], worker_batches_[worker_id], x_rand, backward, 
+                             cands, n_cands * c / n_chunks, n_cands * (c + 1) / n_chunks);
+    });
   }
-  if (!seg.checkMaxAccRate(acc_limit_))
+  else
   {
-    // ROS_WARN("acc constraints violate!");
-    return false;
+    evaluateCandidateRange(bvp_, batch_, x_rand, backward, cands, 0, n_cands);
   }
-  if (!seg.checkMaxJerkRate(jerk_limit_))
+}
+
+// all boundary value problems of cands[begin, end) in one batch, then the per segment checks.
+// Only touches its own bvp solver, batch and candidates, so it can be called from any worker thread.
+// backward: cand.node is the parent of x_rand in the start tree, otherwise x_rand
+// connects forward to cand.node in the goal tree.
+// With lazy collision checking the collision check is left to ParentSelector::selectParentLazily()
+void BIKRRT::evaluateCandidateRange(BVPSolver::IntegratorBVP &bvp, candidateBatch &batch, const StatePVA &x_rand, 
+                                    bool backward, parentCandidates &cands, int begin, int end)
+{
+  int n = end - begin;
+  batch.starts.resize(Eigen::NoChange, n);
+  batch.goals.resize(Eigen::NoChange, n);
+  for (int i = 0; i < n; ++i)
+  {
+    if (backward)
+    {
+      batch.starts.col(i) = cands[begin + i].node->x;
+      batch.goals.col(i) = x_rand;
+    }
+    else
+    {
+      batch.starts.col(i) = x_rand;
+      batch.goals.col(i) = cands[begin + i].node->x;
+    }
+  }
+  bvp.solveBatch(batch.starts, batch.goals, backward ? ACC_KNOWN : INITIAL_ACC_UNKNOWN, batch.sol);
+  for (int i = 0; i < n; ++i)
+  {
+    parentCandidate &cand = cands[begin + i];
+    ParentSelector::resetCandidate(cand);
+    cand.solved = batch.sol.solved[i];
+    if (!cand.solved)
+      continue;
+    cand.cost = batch.sol.cost_star[i];
+    cand.tau = batch.sol.tau_star[i];
+    parent_selector_.checkCandidateSeg(cand, batch.sol.coeff[i]);
+  }
+}
+
+inline bool BIKRRT::checkSegmentConstraints(const Piece &seg)
+{
+  if (!seg.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_))
   {
-    // ROS_WARN("jerk constraints violate!");
+    // ROS_WARN("dynamic constraints violate!");
     return false;
   }
   if (!pos_checker_ptr_->checkPolySeg(seg))
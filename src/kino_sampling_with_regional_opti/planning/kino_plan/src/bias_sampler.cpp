@@ -284,6 +284,35 @@ void BiasSampler::setupRandomSampling(const Vector3d& init_pt, const Vector3d& g
 }
 
 bool BiasSampler::samplingOnce(int idx, StatePVA& rand_state)
+{
+  if (!informed_ || informed_bvp_ == nullptr || informed_cost_ >= DBL_MAX)
+  {
+    if (!sampleOnTrack(idx, rand_state))
+      return false;
+    return pos_checker_->validateASample(rand_state);
+  }
+
+  // redraw instead of leaving samples that cannot improve the solution to the BVPs
+  for (int i = 0; i < informed_tries_; ++i)
+  {
+    if (!sampleOnTrack(idx, rand_state))
+      continue;
+    if (informedLowerBound(rand_state) < informed_cost_)
+      return pos_checker_->validateASample(rand_state);
+    ++informed_rejected_nums_;
+  }
+  if (!sampleInSpheroid(rand_state))
+    return false;
+  ++spheroid_sample_nums_;
+  if (informedLowerBound(rand_state) >= informed_cost_)
+  {
+    ++informed_rejected_nums_;
+    return false;
+  }
+  return pos_checker_->validateASample(rand_state);
+}
+
+bool BiasSampler::sampleOnTrack(int idx, StatePVA& rand_state)
 {
   idx = idx % tracks_.size();
   double pos_mean = pos_mean_rand_(gen_);
@@ -318,10 +347,6 @@ bool BiasSampler::samplingOnce(int idx, StatePVA& rand_state)
   // {
   //   return false;
   // }
-  if (!pos_checker_->validateASample(rand_state))
-  {
-    return false;
-  }
 
   // if ((pos - init_pos_).norm() < 1.5 || (pos - goal_pos_).norm() < 1.5)
   // {
@@ -331,4 +356,66 @@ bool BiasSampler::samplingOnce(int idx, StatePVA& rand_state)
   return true;
 }
 
+void BiasSampler::setInformedQuery(const StatePVA &x_start, const StatePVA &x_goal, const BVPSolver::IntegratorBVP *bvp, 
+                                   double max_vel, double max_acc, double max_jerk)
+{
+  informed_start_ = x_start;
+  informed_goal_ = x_goal;
+  informed_bvp_ = bvp;
+  informed_vel_ = max_vel;
+  informed_acc_ = max_acc;
+  informed_jerk_ = max_jerk;
+  informed_cost_ = DBL_MAX;
+  informed_rejected_nums_ = 0;
+  spheroid_sample_nums_ = 0;
+}
+
+// the acc of a sample is only known after its parent is chosen, so the acc terms are left out
+inline double BiasSampler::informedLowerBound(const StatePVA &x)
+{
+  return informed_bvp_->costLowerBound(informed_start_, x, ACC_UNKNOWN, informed_vel_, informed_acc_, informed_jerk_) 
+       + informed_bvp_->costLowerBound(x, informed_goal_, ACC_UNKNOWN, informed_vel_, informed_acc_, informed_jerk_);
+}
+
+// every cost is at least the duration, which is at least distance / max_vel, 
+// so |p - p_start| + |p - p_goal| < max_vel * cost holds for all informed positions
+bool BiasSampler::sampleInSpheroid(StatePVA &rand_state)
+{
+  Vector3d p_start = informed_start_.head(3), p_goal = informed_goal_.head(3);
+  double c_min = (p_goal - p_start).norm();
+  double a = 0.5 * informed_vel_ * informed_cost_;
+  if (!(a > 0.5 * c_min) || std::isinf(a))
+    return false;
+  double b = sqrt(a * a - 0.25 * c_min * c_min);
+
+  // uniform in the unit ball, then scaled and rotated onto the spheroid
+  Vector3d ball(std_normal_rand_(gen_), std_normal_rand_(gen_), std_normal_rand_(gen_));
+  double norm = ball.norm();
+  if (norm < 1e-9)
+    return false;
+  ball *= cbrt(unit_rand_(gen_)) / norm;
+  Vector3d e1 = c_min > 1e-6 ? Vector3d((p_goal - p_start) / c_min) : Vector3d::UnitX();
+  Vector3d e2 = e1.unitOrthogonal();
+  Vector3d e3 = e1.cross(e2);
+  Vector3d p = 0.5 * (p_start + p_goal) + a * ball[0] * e1 + b * ball[1] * e2 + b * ball[2] * e3;
+
+  // heading towards the goal, magnitude and spread as on the tracks
+  double vel_mag = vel_mag_rand_(gen_);
+  if (vel_mag > vel_mag_mean_) 
+    vel_mag = vel_mag_mean_ - (vel_mag - vel_mag_mean_);
+  if (vel_mag <= 0)
+    return false;
+  Vector3d dir = p_goal - p;
+  dir[2] = 0.0;
+  if (dir.norm() < 1e-6)
+    dir = e1;
+  Vector3d v_m = dir.normalized() * vel_mag;
+  rotateClockwise3d(vel_hor_dir_rand_(gen_), v_m);
+
+  rand_state.head(3) = p;
+  rand_state.segment(3, 3) = v_m;
+  rand_state.tail(3).setZero();
+  return true;
+}
+
 }
\ No newline at end of file
@@ -1,9 +1,21 @@
 #include "kino_plan/bvp_solver.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 namespace BVPSolver
 {
 
+/* Newton seed of tau^N + p[2]*tau^(N-2) + ... + p[N] = 0, taken from the polynomial 
+ * itself so every solve is independent of the solves before it (and of the worker 
+ * it ran on). Dropping the middle terms gives tau = |p[N]|^(1/N), which is exact for 
+ * rest-to-rest states and close when the position term dominates. */
+template <int N>
+static inline double tauSeed(const double (&p)[N + 1])
+{
+  return std::pow(std::fabs(p[N]), 1.0 / N);
+}
+
 bool IntegratorBVP::solveDouble()
 {
   bool result = calTauStarDouble();
@@ -38,7 +50,7 @@ minimize Inte(1 + acc^T * rho * acc, 0, tau)
 */
 bool IntegratorBVP::calTauStarDouble()
 {
-  VectorXd p(5);
+  double p[5];
   p[0] = 1;
   p[1] = 0;
   p[2] = (x0_[3]*x0_[3] + x0_[3]*x1_[3] + x1_[3]*x1_[3] 
@@ -51,13 +63,15 @@ bool IntegratorBVP::calTauStarDouble()
   p[4] =(- x0_[0]*x0_[0] + 2.0*x0_[0]*x1_[0] - x1_[0]*x1_[0] 
         - x0_[1]*x0_[1] + 2.0*x0_[1]*x1_[1] - x1_[1]*x1_[1] 
         - x0_[2]*x0_[2] + 2.0*x0_[2]*x1_[2] - x1_[2]*x1_[2]) * 36.0 * rho_;
-  std::set<double> roots = RootFinder::solvePolynomial(p, 0.01, 100, 1e-6);
+  double roots[4];
+  int n_roots = RootFinder::solveFixedDegree<4>(p, 0.01, 100, 1e-6, roots, tauSeed<4>(p));
   
   bool result = false;
   double tau = DBL_MAX;
   double cost = DBL_MAX;
-  for (const double& root : roots) 
+  for (int i = 0; i < n_roots; ++i) 
   {
+    double root = roots[i];
     double t1 = x0_[0] - x1_[0];
     double t2 = x0_[1] - x1_[1];
     double t3 = x0_[2] - x1_[2];
@@ -116,7 +130,7 @@ bool IntegratorBVP::solveTriple()
 // */
 // bool IntegratorBVP::calTauStarTriple()
 // {
-//   VectorXd p(5);
+//   double p[5];
 //   p[0] = 35 + rho_*(3*x0_[6]*x0_[6] + 3*x0_[7]*x0_[7] + 3*x0_[8]*x0_[8] 
 //                     + x0_[6]*x1_[6] + 3*x1_[6]*x1_[6] + x0_[7]*x1_[7]
 //                     + 3*x1_[7]*x1_[7] + x0_[8]*x1_[8] + 3*x1_[8]*x1_[8]);
@@ -193,21 +207,23 @@ bool IntegratorBVP::calTauStarTriple()
   double t8 = (x0_[0]-x1_[0])*(x0_[3]+x1_[3]) + (x0_[1]-x1_[1])*(x0_[4]+x1_[4]) + (x0_[2]-x1_[2])*(x0_[5]+x1_[5]);
   double t9 = (x0_[0]-x1_[0])*(x0_[0]-x1_[0]) + (x0_[1]-x1_[1])*(x0_[1]-x1_[1]) + (x0_[2]-x1_[2])*(x0_[2]-x1_[2]);
 
-  VectorXd p(7);
+  double p[7];
   p[0] = 1.0;
   p[1] = 0.0;
   p[2] = - 3*rho_*t2;
   p[3] = - 48*rho_*t4;
   p[4] = - 72*rho_*t7;
-  p[5] = - 2800*rho_*t8;
+  p[5] = - 2880*rho_*t8;
   p[6] = - 3600*rho_*t9;
-  std::set<double> roots = RootFinder::solvePolynomial(p, 0.01, 100, 1e-6);
+  double roots[6];
+  int n_roots = RootFinder::solveFixedDegree<6>(p, 0.01, 100, 1e-6, roots, tauSeed<6>(p));
   bool result = false;
   double tau = DBL_MAX;
   double cost = DBL_MAX;
   
-  for (const double& root : roots) 
+  for (int i = 0; i < n_roots; ++i) 
   {
+    double root = roots[i];
     double root2 = root*root;
     double root3 = root2*root;
     double root4 = root3*root;
@@ -244,7 +260,7 @@ bool IntegratorBVP::calTauStarTripleAccUnknown()
   double t4 = rho_*x0_diff_x1_012.dot(x0_plus_x1_345);
   double t5 = rho_*x0_diff_x1_012.dot(x0_diff_x1_012);
 
-  VectorXd p(7);
+  double p[7];
   p[0] = 1.0;
   p[1] = 0.0;
   p[2] = - 8*t1;
@@ -252,14 +268,16 @@ bool IntegratorBVP::calTauStarTripleAccUnknown()
   p[4] = - 48*t3;
   p[5] = - 320*t4;
   p[6] = - 1600*t5;
-  std::set<double> roots = RootFinder::solvePolynomial(p, 0.01, 100, 1e-6);
+  double roots[6];
+  int n_roots = RootFinder::solveFixedDegree<6>(p, 0.01, 100, 1e-6, roots, tauSeed<6>(p));
   
   bool result = false;
   double tau = DBL_MAX;
   double cost = DBL_MAX;
   
-  for (const double& root : roots) 
+  for (int i = 0; i < n_roots; ++i) 
   {
+    double root = roots[i];
     double root2 = root*root;
     double root3 = root2*root;
     double root4 = root3*root;
@@ -323,7 +341,7 @@ bool IntegratorBVP::calTauStarTripleInitialAccUnknown()
   double t4 = rho_*x0_diff_x1_012.dot(x0_plus_x1_345);
   double t5 = rho_*x0_diff_x1_012.dot(x0_diff_x1_012);
 
-  VectorXd p(7);
+  double p[7];
   p[0] = 1.0;
   p[1] = 0.0;
   p[2] = - 8*t1;
@@ -331,14 +349,16 @@ bool IntegratorBVP::calTauStarTripleInitialAccUnknown()
   p[4] = - 48*t3;
   p[5] = - 320*t4;
   p[6] = - 1600*t5;
-  std::set<double> roots = RootFinder::solvePolynomial(p, 0.01, 100, 1e-6);
+  double roots[6];
+  int n_roots = RootFinder::solveFixedDegree<6>(p, 0.01, 100, 1e-6, roots, tauSeed<6>(p));
   
   bool result = false;
   double tau = DBL_MAX;
   double cost = DBL_MAX;
   
-  for (const double& root : roots) 
+  for (int i = 0; i < n_roots; ++i) 
   {
+    double root = roots[i];
     double root2 = root*root;
     double root3 = root2*root;
     double root4 = root3*root;
@@ -405,7 +425,7 @@ bool IntegratorBVP::calTauStarTripleVelAccUnknown()
   double t1 = rho_*(x0_012.dot(x0_345) - x0_345.dot(x1_012));
   double t0 = rho_*x0_diff_x1_012.dot(x0_diff_x1_012);
 
-  VectorXd p(7);
+  double p[7];
   p[0] = 1.0;
   p[1] = 0.0;
   p[2] = - 5*t4;
@@ -413,13 +433,15 @@ bool IntegratorBVP::calTauStarTripleVelAccUnknown()
   p[4] = - 60*t2;
   p[5] = - 160*t1;
   p[6] = - 100*t0;
-  std::set<double> roots = RootFinder::solvePolynomial(p, 0.01, 100, 1e-6);
+  double roots[6];
+  int n_roots = RootFinder::solveFixedDegree<6>(p, 0.01, 100, 1e-6, roots, tauSeed<6>(p));
   bool result = false;
   double tau = DBL_MAX;
   double cost = DBL_MAX;
   
-  for (const double& root : roots) 
+  for (int i = 0; i < n_roots; ++i) 
   {
+    double root = roots[i];
     double root2 = root*root;
     double root3 = root2*root;
     double root4 = root3*root;
@@ -470,6 +492,194 @@ bool IntegratorBVP::solveTripleVelAccUnknown()
   return result;
 }
 
+/* 
+batched version of calTauStarTriple*() and solveTriple*(). 
+For all three boundary types the optimal tau is a root of 
+  tau^6 + p2*tau^4 + p3*tau^3 + p4*tau^2 + p5*tau + p6 
+and the cost is (tau^6 + d0 + d1*tau + d2*tau^2 + d3*tau^3 + d4*tau^4) / tau^5, 
+so p and d, and the coefficient matrices once tau is known, are assembled 
+for all pairs with array expressions over the rows of the batch. 
+Only the root finding is done pair by pair.
+*/
+int IntegratorBVP::solveBatch(const StateBatch &starts, const StateBatch &goals, int type, BatchSolution &sol)
+{
+  typedef Eigen::Array<double, 1, Eigen::Dynamic> RowArray;
+  int n = starts.cols();
+  sol.tau_star.setConstant(n, DBL_MAX);
+  sol.cost_star.setConstant(n, DBL_MAX);
+  sol.solved.assign(n, false);
+  sol.coeff.resize(n);
+  if (model_ != TRIPLE_INTEGRATOR)
+  {
+    printf("Batch solve only supports the triple integrator.");
+    return 0;
+  }
+  if (n == 0)
+    return 0;
+
+  auto x0 = [&starts](int k) { return starts.row(k).array(); };
+  auto x1 = [&goals](int k) { return goals.row(k).array(); };
+
+  Eigen::Matrix<double, 5, Eigen::Dynamic, Eigen::RowMajor> p(5, n), d(5, n);
+  if (type == ACC_UNKNOWN || type == INITIAL_ACC_UNKNOWN)
+  {
+    // same terms as calTauStarTripleAccUnknown() / calTauStarTripleInitialAccUnknown(), 
+    // the latter with the roles of start and goal swapped
+    const StateBatch &a = type == ACC_UNKNOWN ? starts : goals; // end with acc fixed
+    const StateBatch &b = type == ACC_UNKNOWN ? goals : starts;
+    auto xa = [&a](int k) { return a.row(k).array(); };
+    auto xb = [&b](int k) { return b.row(k).array(); };
+    RowArray diff0 = x0(0) - x1(0), diff1 = x0(1) - x1(1), diff2 = x0(2) - x1(2);
+    double s = type == ACC_UNKNOWN ? 1.0 : -1.0;
+
+    RowArray t1 = rho_*(xa(6)*xa(6) + xa(7)*xa(7) + xa(8)*xa(8));
+    RowArray t2 = rho_*(7*(xa(3)*xa(6) + xa(4)*xa(7) + xa(5)*xa(8)) + 3*(xa(6)*xb(3) + xa(7)*xb(4) + xa(8)*xb(5)));
+    RowArray t3 = rho_*(8*(xa(3)*xa(3) + xa(4)*xa(4) + xa(5)*xa(5)) + 3*(xb(3)*xb(3) + xb(4)*xb(4) + xb(5)*xb(5)) 
+                            + s*5*(xa(6)*diff0 + xa(7)*diff1 + xa(8)*diff2) + 9*(x0(3)*x1(3) + x0(4)*x1(4) + x0(5)*x1(5)));
+    RowArray t4 = rho_*(diff0*(5*xa(3) + 3*xb(3)) + diff1*(5*xa(4) + 3*xb(4)) + diff2*(5*xa(5) + 3*xb(5)));
+    RowArray t5 = rho_*(diff0*diff0 + diff1*diff1 + diff2*diff2);
+
+    p.row(0) = -8*t1;
+    p.row(1) = -s*16*t2;
+    p.row(2) = -48*t3;
+    p.row(3) = -320*t4;
+    p.row(4) = -1600*t5;
+    d.row(0) = 320*t5;
+    d.row(1) = 80*t4;
+    d.row(2) = 16*t3;
+    d.row(3) = s*8*t2;
+    d.row(4) = 8*t1;
+  }
+  else    // type == ACC_KNOWN
+  {
+    // same terms as calTauStarTriple()
+    RowArray diff0 = x0(0) - x1(0), diff1 = x0(1) - x1(1), diff2 = x0(2) - x1(2);
+    RowArray t1 = 3*(x0(6)*x0(6) + x0(7)*x0(7) + x0(8)*x0(8) + x1(6)*x1(6) + x1(7)*x1(7) + x1(8)*x1(8));
+    RowArray t2 = t1 - 2*(x0(6)*x1(6) + x0(7)*x1(7) + x0(8)*x1(8));
+    RowArray t3 = 3*(x0(3)*x0(6) + x0(4)*x0(7) + x0(5)*x0(8) - x1(3)*x1(6) - x1(4)*x1(7) - x1(5)*x1(8));
+    RowArray t4 = t3 + 2*(x0(6)*x1(3) + x0(7)*x1(4) + x0(8)*x1(5) - x0(3)*x1(6) - x0(4)*x1(7) - x0(5)*x1(8));
+    RowArray t5 = 8*(x0(3)*x0(3) + x0(4)*x0(4) + x0(5)*x0(5) + x1(3)*x1(3) + x1(4)*x1(4) + x1(5)*x1(5));
+    RowArray t6 = t5 + 5*(diff0*(x0(6)-x1(6)) + diff1*(x0(7)-x1(7)) + diff2*(x0(8)-x1(8)));
+    RowArray t7 = t6 + 14*(x0(3)*x1(3) + x0(4)*x1(4) + x0(5)*x1(5));
+    RowArray t8 = diff0*(x0(3)+x1(3)) + diff1*(x0(4)+x1(4)) + diff2*(x0(5)+x1(5));
+    RowArray t9 = diff0*diff0 + diff1*diff1 + diff2*diff2;
+
+    p.row(0) = -3*rho_*t2;
+    p.row(1) = -48*rho_*t4;
+    p.row(2) = -72*rho_*t7;
+    p.row(3) = -2880*rho_*t8;
+    p.row(4) = -3600*rho_*t9;
+    d.row(0) = rho_*720*t9;
+    d.row(1) = rho_*720*t8;
+    d.row(2) = rho_*24*t7;
+    d.row(3) = rho_*24*t4;
+    d.row(4) = rho_*3*t2;
+  }
+
+  /* optimal tau, pair by pair */
+  int n_solved(0);
+  double poly[7], roots[6];
+  poly[0] = 1.0;
+  poly[1] = 0.0;
+  for (int i = 0; i < n; ++i)
+  {
+    for (int k = 0; k < 5; ++k)
+      poly[k + 2] = p(k, i);
+    int n_roots = RootFinder::solveFixedDegree<6>(poly, 0.01, 100, 1e-6, roots, tauSeed<6>(poly));
+    for (int k = 0; k < n_roots; ++k) 
+    {
+      double root = roots[k];
+      double root2 = root*root;
+      double root3 = root2*root;
+      double root4 = root3*root;
+      double root5 = root4*root;
+      double root6 = root5*root;
+      double current = (root6 + d(0, i) + d(1, i)*root + d(2, i)*root2 + d(3, i)*root3 + d(4, i)*root4) / root5;
+      if (current < sol.cost_star[i]) 
+      {
+        sol.tau_star[i] = root;
+        sol.cost_star[i] = current;
+        sol.solved[i] = true;
+      }
+    }
+    if (sol.solved[i])
+      ++n_solved;
+  }
+
+  /* coefficient matrices, row r * 6 + c holds coeff(r, c) of all pairs */
+  RowArray tau = sol.tau_star.transpose();
+  RowArray tau2 = tau*tau;
+  RowArray tau3 = tau*tau2;
+  RowArray tau4 = tau*tau3;
+  RowArray tau5 = tau*tau4;
+  Eigen::Matrix<double, 3 * 6, Eigen::Dynamic, Eigen::RowMajor> c(3 * 6, n);
+  for (int r = 0; r < 3; ++r)
+  {
+    if (type == ACC_UNKNOWN)
+    {
+      c.row(r*6 + 0) = -(8*x0(r) + 5*tau*x0(r+3) + tau2*x0(r+6) - 8*x1(r) + 3*tau*x1(r+3))/(3*tau5);
+      c.row(r*6 + 1) = -(-50*x0(r) - 32*tau*x0(r+3) - 7*tau2*x0(r+6) + 50*x1(r) - 18*tau*x1(r+3))/(6*tau4);
+      c.row(r*6 + 2) = -(20*x0(r) + 14*tau*x0(r+3) + 4*tau2*x0(r+6) - 20*x1(r) + 6*tau*x1(r+3))/(3*tau3);
+      c.row(r*6 + 3) = x0(r+6)/2;
+    }
+    else if (type == INITIAL_ACC_UNKNOWN)
+    {
+      c.row(r*6 + 0) = -(8*x0(r) + 5*tau*x1(r+3) - tau2*x1(r+6) - 8*x1(r) + 3*tau*x0(r+3))/(3*tau5);
+      c.row(r*6 + 1) = -(-10*x0(r) - 4*tau*x0(r+3) + tau2*x1(r+6) + 10*x1(r) - 6*tau*x1(r+3))/(2*tau4);
+      c.row(r*6 + 2).setZero();
+      c.row(r*6 + 3) = -(20*x0(r) + 12*tau*x0(r+3) - tau2*x1(r+6) - 20*x1(r) + 8*tau*x1(r+3))/(6*tau2);
+    }
+    else
+    {
+      c.row(r*6 + 0) = -(12*x0(r) + 6*tau*x0(r+3) + tau2*x0(r+6) - 12*x1(r) + 6*tau*x1(r+3) - tau2*x1(r+6))/(2*tau5);
+      c.row(r*6 + 1) = -(-30*x0(r) - 16*tau*x0(r+3) - 3*tau2*x0(r+6) + 30*x1(r) - 14*tau*x1(r+3) + 2*tau2*x1(r+6))/(2*tau4);
+      c.row(r*6 + 2) = -(20*x0(r) + 12*tau*x0(r+3) + 3*tau2*x0(r+6) - 20*x1(r) + 8*tau*x1(r+3) - tau2*x1(r+6))/(2*tau3);
+      c.row(r*6 + 3) = x0(r+6)/2;
+    }
+    c.row(r*6 + 4) = x0(r+3);
+    c.row(r*6 + 5) = x0(r);
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    for (int r = 0; r < 3; ++r)
+      for (int col = 0; col < 6; ++col)
+        sol.coeff[i](r, col) = c(r*6 + col, i);
+  }
+
+  return n_solved;
+}
+
+/* 
+A segment of duration tau that keeps |vel| < max_vel has |p1 - p0| < tau * max_vel, 
+likewise for vel with max_acc and acc with max_jerk, which gives a minimum tau. 
+By Cauchy-Schwarz Inte(|u|^2, 0, tau) >= |Inte(u, 0, tau)|^2 / tau, with u the jerk 
+(acc for the double integrator), so cost(tau) >= tau + rho * |a1 - a0|^2 / tau, 
+which is minimized over tau >= tau_min in closed form. 
+*/
+double IntegratorBVP::costLowerBound(const VectorXd &start, const VectorXd &goal, int type, 
+                                     double max_vel, double max_acc, double max_jerk) const
+{
+  double dp = (goal.head(3) - start.head(3)).norm();
+  double dv = (goal.segment(3, 3) - start.segment(3, 3)).norm();
+  double tau_min = std::max(dp / max_vel, dv / max_acc);
+  double energy(0.0);
+  if (model_ == DOUBLE_INTEGRATOR)
+  {
+    energy = rho_ * dv * dv;
+  }
+  else if (type == ACC_KNOWN)
+  {
+    // acc of one end is free otherwise
+    double da = (goal.segment(6, 3) - start.segment(6, 3)).norm();
+    tau_min = std::max(tau_min, da / max_jerk);
+    energy = rho_ * da * da;
+  }
+  double tau = std::max(tau_min, sqrt(energy));
+  if (tau <= 0.0)
+    return 0.0;
+  return tau + energy / tau;
+}
+
 void IntegratorBVP::calCoeffFromTau(double tau, CoefficientMat &coeff)
 {
   double t2 = tau*tau;
@@ -0,0 +1,94 @@
+#include "kino_plan/grid_index.h"
+#include <cmath>
+#include <algorithm>
+
+namespace kino_planner
+{
+GridIndex::GridIndex() : cell_size_(1.0), cell_size_inv_(1.0), bucket_mask_(0)
+{
+}
+
+void GridIndex::reset(double cell_size, int capacity)
+{
+  if (!(cell_size > 0.0) || std::isinf(cell_size))
+    cell_size = 1.0;
+  cell_size_ = cell_size;
+  cell_size_inv_ = 1.0 / cell_size;
+
+  unsigned int n_buckets = 1024;
+  while (n_buckets < 2 * (unsigned int)std::max(capacity, 1))
+    n_buckets <<= 1;
+
+  if (n_buckets != bucket_head_.size())
+  {
+    bucket_head_.assign(n_buckets, -1);
+    bucket_mask_ = n_buckets - 1;
+  }
+  else
+  {
+    // only the buckets used last time need clearing
+    for (const auto &c : cells_)
+      bucket_head_[bucketOf(c[0], c[1], c[2])] = -1;
+  }
+
+  next_.clear();
+  cells_.clear();
+  pts_.clear();
+  nodes_.clear();
+  next_.reserve(capacity);
+  cells_.reserve(capacity);
+  pts_.reserve(capacity);
+  nodes_.reserve(capacity);
+}
+
+void GridIndex::insert(const Eigen::Vector3d &pos, RRTNodePtr node)
+{
+  Eigen::Vector3i c((int)std::floor(pos[0] * cell_size_inv_),
+                    (int)std::floor(pos[1] * cell_size_inv_),
+                    (int)std::floor(pos[2] * cell_size_inv_));
+  int b = bucketOf(c[0], c[1], c[2]);
+  next_.push_back(bucket_head_[b]);
+  bucket_head_[b] = (int)nodes_.size();
+  cells_.push_back(c);
+  pts_.push_back(pos);
+  nodes_.push_back(node);
+}
+
+int GridIndex::rangeQuery(const Eigen::Vector3d &center, double radius, std::vector<RRTNodePtr> &nbrs) const
+{
+  nbrs.clear();
+  if (nodes_.empty() || !(radius >= 0.0))
+    return 0;
+
+  double radius_sqr = radius * radius;
+  int x_lo = (int)std::floor((center[0] - radius) * cell_size_inv_);
+  int x_hi = (int)std::floor((center[0] + radius) * cell_size_inv_);
+  int y_lo = (int)std::floor((center[1] - radius) * cell_size_inv_);
+  int y_hi = (int)std::floor((center[1] + radius) * cell_size_inv_);
+  int z_lo = (int)std::floor((center[2] - radius) * cell_size_inv_);
+  int z_hi = (int)std::floor((center[2] + radius) * cell_size_inv_);
+
+  for (int x = x_lo; x <= x_hi; ++x)
+    for (int y = y_lo; y <= y_hi; ++y)
+      for (int z = z_lo; z <= z_hi; ++z)
+      {
+        for (int i = bucket_head_[bucketOf(x, y, z)]; i >= 0; i = next_[i])
+        {
+          // different cells may share a bucket
+          const Eigen::Vector3i &c = cells_[i];
+          if (c[0] != x || c[1] != y || c[2] != z)
+            continue;
+          if ((pts_[i] - center).squaredNorm() <= radius_sqr)
+            nbrs.push_back(nodes_[i]);
+        }
+      }
+  return (int)nbrs.size();
+}
+
+inline int GridIndex::bucketOf(int x, int y, int z) const
+{
+  unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u) ^ ((unsigned int)z * 83492791u);
+  return (int)(h & bucket_mask_);
+}
+
+} // namespace kino_planner
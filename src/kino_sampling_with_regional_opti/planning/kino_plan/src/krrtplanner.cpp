@@ -1,6 +1,7 @@
 #include "kino_plan/krrtplanner.h"
 #include <queue>
 #include <unordered_set>
+#include <algorithm>
 
 ros::Time t_start_, t_end_;
 
@@ -12,8 +13,6 @@ KRRTPlanner::KRRTPlanner(const ros::NodeHandle& nh): sampler_(nh)
 
 KRRTPlanner::~KRRTPlanner()
 {
-  for (int i = 0; i < tree_node_nums_; i++) 
-    delete start_tree_[i];
 }
 
 void KRRTPlanner::init(const ros::NodeHandle& nh)
@@ -30,6 +29,9 @@ void KRRTPlanner::init(const ros::NodeHandle& nh)
   nh.param("krrt/rewire", rewire_, true);
   nh.param("krrt/use_regional_opt", use_regional_opt_, false);
   nh.param("krrt/test_convergency", test_convergency_, false);
+  nh.param("krrt/lazy_collision", lazy_collision_, false);
+  nh.param("krrt/shrink_radius", shrink_radius_, false);
+  nh.param("krrt/shrink_radius_node_nums", shrink_radius_node_nums_, 100);
   
   ROS_WARN_STREAM("[krrt] param: vel_limit: " << vel_limit_);
   ROS_WARN_STREAM("[krrt] param: acc_limit: " << acc_limit_);
@@ -43,24 +45,29 @@ void KRRTPlanner::init(const ros::NodeHandle& nh)
   ROS_WARN_STREAM("[krrt] param: rewire: " << rewire_);
   ROS_WARN_STREAM("[krrt] param: use_regional_opt: " << use_regional_opt_);
   ROS_WARN_STREAM("[krrt] param: test_convergency: " << test_convergency_);
+  ROS_WARN_STREAM("[krrt] param: lazy_collision: " << lazy_collision_);
+  ROS_WARN_STREAM("[krrt] param: shrink_radius: " << shrink_radius_);
+  ROS_WARN_STREAM("[krrt] param: shrink_radius_node_nums: " << shrink_radius_node_nums_);
 
+  parent_selector_.init(vel_limit_, acc_limit_, jerk_limit_, lazy_collision_);
   bvp_.init(TRIPLE_INTEGRATOR);
   bvp_.setRho(rho_);
+  shrink_radius_node_nums_ = max(shrink_radius_node_nums_, 2);
+  // neighbour radii for every tau up to the largest one rrtStar() asks for
+  reach_radius_table_.init(radius_cost_between_two_states_ * 0.75, 512);
 
   valid_start_tree_node_nums_ = 0;
   
   //pre allocate memory
-  start_tree_.resize(tree_node_nums_);
-  for (int i = 0; i < tree_node_nums_; i++) 
-  {
-    start_tree_[i] = new RRTNode;
-  }
+  start_tree_.init(tree_node_nums_);
+  nbrs_.reserve(tree_node_nums_);
 }
 
 void KRRTPlanner::setPosChecker(const PosChecker::Ptr &checker)
 {
   pos_checker_ptr_ = checker;
   sampler_.setPosChecker(checker);
+  parent_selector_.setPosChecker(checker);
 }
 
 void KRRTPlanner::setVisualizer(const VisualRviz::Ptr &vis)
@@ -71,11 +78,7 @@ void KRRTPlanner::setVisualizer(const VisualRviz::Ptr &vis)
 // reset() is called every time before plan();
 void KRRTPlanner::reset()
 {
-  for (int i = 0; i <= valid_start_tree_node_nums_; i++) 
-  {
-    start_tree_[i]->parent = nullptr;
-    start_tree_[i]->children.clear();
-  }
+  // nodes are re-initialized when taken from the pool, nothing to walk here
   valid_start_tree_node_nums_ = 0;
 }
 
@@ -84,6 +87,8 @@ int KRRTPlanner::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc
                       double search_time)
 {
   t_start_ = ros::Time::now();
+  // released before the search, which locks the map once per iteration
+  OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
   
   if (pos_checker_ptr_->getVoxelState(start_pos) != 0) 
   {
@@ -123,13 +128,13 @@ int KRRTPlanner::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc
   }
   
   /* construct start and goal nodes */
-  start_node_ = start_tree_[1]; //init ptr
+  start_node_ = start_tree_.newNode(1); //init ptr
   start_node_->x.head(3) = start_pos;
   start_node_->x.segment(3, 3) = start_vel;
   start_node_->x.tail(3) = start_acc;
   start_node_->cost_from_start = 0.0;
   start_node_->tau_from_start = 0.0;
-  goal_node_ = start_tree_[0]; //init ptr
+  goal_node_ = start_tree_.newNode(0); //init ptr
   goal_node_->x.head(3) = end_pos;
   if (end_vel.norm() >= vel_limit_)
   {
@@ -159,17 +164,15 @@ int KRRTPlanner::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc
     // poly_seg.sampleOneSeg(&vis_x);
     // vis_ptr_->visualizeStates(vis_x, BLUE, pos_checker_ptr_->getLocalTime());
 
-    bool vel_cons = poly_seg.checkMaxVelRate(vel_limit_);
-    bool acc_cons = poly_seg.checkMaxAccRate(acc_limit_);
-    bool jerk_cons = poly_seg.checkMaxJerkRate(jerk_limit_);
+    bool dyn_cons = poly_seg.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_);
     bool pos_cons = getTraversalLines(poly_seg, traversal_lines);
-    if (vel_cons && acc_cons && jerk_cons && pos_cons)
+    if (dyn_cons && pos_cons)
     {
       ROS_WARN("Best traj collision free, one shot connected");
       goal_node_->cost_from_start = best_cost;
       goal_node_->parent = start_node_;
       goal_node_->tau_from_start = best_tau;
-      goal_node_->poly_seg = poly_seg;
+      start_tree_.polySeg(goal_node_) = poly_seg;
       goal_node_->cost_from_parent = best_cost;
       goal_node_->tau_from_parent = best_tau;
       fillTraj(goal_node_, traj_);
@@ -203,6 +206,7 @@ int KRRTPlanner::plan(Vector3d start_pos, Vector3d start_vel, Vector3d start_acc
   sampler_.getTopo(p_head, tracks);
   vis_ptr_->visualizeTopo(p_head, tracks, pos_checker_ptr_->getLocalTime());
 
+  map_lock.unlock();
   return rrtStar(start_node_->x, goal_node_->x, tree_node_nums_, search_time, radius_cost_between_two_states_, rewire_);
 }
 
@@ -225,17 +229,23 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
   traj_list_.clear();
   solution_cost_list_.clear();
   solution_time_list_.clear();
-
-  /* kd tree init */
-  kdtree *kd_tree = kd_create(3);
-  //Add start and goal nodes to kd tree
-  kd_insert3(kd_tree, start_node_->x[0], start_node_->x[1], start_node_->x[2], start_node_);
-  kd_insert3(kd_tree, goal_node_->x[0], goal_node_->x[1], goal_node_->x[2], goal_node_);
-
-  //TODO changable radius
+  pos_check_nums_ = 0;
+  pos_check_skipped_nums_ = 0;
+  bvp_solve_nums_ = 0;
+  bvp_skipped_nums_ = 0;
+
+  // radius is the largest cost radius, it shrinks with the tree if shrink_radius_ is set
+  const double max_radius = radius;
+  int radius_node_nums = 0;
   double tau_for_instance = radius * 0.75; //maximum
   double fwd_radius_p = getForwardRadius(tau_for_instance, radius);  
   double bcwd_radius_p = getBackwardRadius(tau_for_instance, radius);
+
+  /* spatial index init, cells sized to the neighbour query radius */
+  node_index_.reset(max(fwd_radius_p, bcwd_radius_p), tree_node_nums_);
+  //Add start and goal nodes to spatial index
+  node_index_.insert(start_node_->x.head(3), start_node_);
+  node_index_.insert(goal_node_->x.head(3), goal_node_);
   // ROS_INFO_STREAM("bcwd_radius_p: " << bcwd_radius_p);
   // ROS_INFO_STREAM("fwd_radius_p: " << fwd_radius_p);
 
@@ -244,6 +254,8 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
   int idx = 0;
   for (idx = 0; (ros::Time::now() - rrt_start_time).toSec() < search_time && valid_start_tree_node_nums_ < n ; ++idx) 
   {
+    /* the map fusion may only update the map between two iterations */
+    OccMap::ReadLock map_lock = pos_checker_ptr_->lockMapForRead();
     /* biased random sampling */
     StatePVA x_rand;
     bool good_sample = sampler_.samplingOnce(idx, x_rand);
@@ -253,26 +265,17 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
       continue;
     }
     /* make sure that nearby nodes are in different lattices */
-    struct kdres *p_nbr_set = kd_nearest_range3(kd_tree, x_rand[0], x_rand[1], x_rand[2], 1);
-    if (p_nbr_set == nullptr)
+    node_index_.rangeQuery(x_rand.head(3), 1, nbrs_);
+    for (const RRTNodePtr &curr_node : nbrs_)
     {
-      ROS_ERROR("kd range query error");
-      break;
-    }
-    while(!kd_res_end(p_nbr_set)) 
-    {
-      RRTNodePtr curr_node = (RRTNodePtr)kd_res_item_data(p_nbr_set);
       Vector3d dir1(x_rand[3], x_rand[4], x_rand[5]);
       Vector3d dir2(curr_node->x[3], curr_node->x[4], curr_node->x[5]);
-      double angle_diff();
       if (dir1.dot(dir2) > 0) 
       {
         good_sample = false;
         break;
       }
-      kd_res_next(p_nbr_set);
     }
-    kd_res_free(p_nbr_set); 
     if (!good_sample) 
     {
       continue;
@@ -281,16 +284,21 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
 
     valid_samples.push_back(x_rand);
     ++valid_sample_nums_;
-    
-    /* kd_tree bounds search for parent */
-    struct kdres *p_bcwd_nbr_set;
-    p_bcwd_nbr_set = getBackwardNeighbour(x_rand, kd_tree, radius - tau_for_instance, bcwd_radius_p);
-    if (p_bcwd_nbr_set == nullptr)
+
+    /* neighbourhood shrinks as the tree grows, cost radius ~ (log(n) / n)^(1 / d) with state dimension d = 9 */
+    if (shrink_radius_ && valid_start_tree_node_nums_ > shrink_radius_node_nums_ && valid_start_tree_node_nums_ != radius_node_nums)
     {
-      ROS_ERROR("bkwd kd range query error");
-      break;
+      radius_node_nums = valid_start_tree_node_nums_;
+      double n_nodes = valid_start_tree_node_nums_, n_0 = shrink_radius_node_nums_;
+      radius = max_radius * pow(log(n_nodes) / n_nodes * n_0 / log(n_0), 1.0 / 9.0);
+      tau_for_instance = radius * 0.75;
+      fwd_radius_p = getForwardRadius(tau_for_instance, radius);
+      bcwd_radius_p = getBackwardRadius(tau_for_instance, radius);
     }
-    /* choose parent from kd tree range query result*/
+    
+    /* bounds search for parent in spatial index */
+    getBackwardNeighbour(x_rand, radius - tau_for_instance, bcwd_radius_p, nbrs_);
+    /* choose parent from range query result*/
     double min_dist(DBL_MAX);
     double tau_from_s(DBL_MAX);
     double cost_from_p(0.0);
@@ -301,65 +309,63 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
     vector<pair<Vector3d, Vector3d>> collide_pts;
     vector<pair<double, double>> collide_timestamp;
     vector<Piece> regional_seg;
-    while(!kd_res_end(p_bcwd_nbr_set)) 
+    candidates_.clear();
+    for (RRTNodePtr curr_node : nbrs_)
     {
-      RRTNodePtr curr_node = (RRTNodePtr)kd_res_item_data(p_bcwd_nbr_set);
       if (curr_node == goal_node_) 
       {
         // goal node can not be parent of any other node
-        kd_res_next( p_bcwd_nbr_set );
         continue;
       }
-      if (bvp_.solve(curr_node->x, x_rand, ACC_KNOWN))
+      // a parent this expensive gets the sample rejected anyway
+      if (goal_found && curr_node->cost_from_start + bvp_.costLowerBound(curr_node->x, x_rand, ACC_KNOWN, vel_limit_, acc_limit_, jerk_limit_) >= goal_node_->cost_from_start)
       {
-        CoefficientMat coeff;
-        bvp_.getCoeff(coeff);
-        Piece seg_from_parent = Piece(bvp_.getTauStar(), coeff);
-        // bool connected = checkSegmentConstraints(seg_from_parent);
-        bool vel_cons = seg_from_parent.checkMaxVelRate(vel_limit_);
-        bool acc_cons = seg_from_parent.checkMaxAccRate(acc_limit_);
-        bool jerk_cons = seg_from_parent.checkMaxJerkRate(jerk_limit_);
-        pair<Vector3d, Vector3d> collide_pts_one_seg;
-        pair<double, double> t_s_e;
-        bool need_region_opt(false);
-        bool pos_cons = pos_checker_ptr_->checkPolySeg(seg_from_parent, collide_pts_one_seg, t_s_e, need_region_opt);
-        bool connected = vel_cons && acc_cons && jerk_cons && pos_cons;
-        if (connected) 
-        {
-          if (min_dist > (curr_node->cost_from_start + bvp_.getCostStar()))
-          {
-            cost_from_p = bvp_.getCostStar();
-            tau_from_p = bvp_.getTauStar();
-            min_dist = curr_node->cost_from_start + cost_from_p;
-            tau_from_s = curr_node->tau_from_start + tau_from_p;
-            find_parent_seg = seg_from_parent;
-            x_near = curr_node;
-            // ROS_INFO("one parent found");
-          } 
-        }
-        else if (!goal_found && need_region_opt && use_regional_opt_ && seg_from_parent.getAcc(bvp_.getTauStar()).norm() < acc_limit_)
-        {
-          double dis = (curr_node->x - x_rand).head(3).norm();
-          // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
-          // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_init).head(3).norm() - (curr_node->x-x_init).head(3).norm()) > 3) 
-          {
-            //find segs to be regionally optimized
-            regional_parents.push_back(curr_node);
-            collide_pts.push_back(collide_pts_one_seg);
-            regional_seg.push_back(seg_from_parent);
-            collide_timestamp.push_back(t_s_e);
-            // ROS_WARN_STREAM("region parent: " << curr_node->x.transpose());
-            // ROS_WARN_STREAM("collides: " << collide_pts_one_seg.first.transpose() << ",  " << collide_pts_one_seg.second.transpose());
-          }
-        }
+        ++bvp_skipped_nums_;
+        continue;
       }
-      else
+      candidates_.emplace_back();
+      candidates_.back().node = curr_node;
+    }
+    bvp_solve_nums_ += candidates_.size();
+    evaluateCandidates(candidates_, x_rand);
+    if (lazy_collision_)
+      parent_selector_.selectParentLazily(candidates_, !goal_found && use_regional_opt_);
+    parent_selector_.countPosChecks(candidates_, pos_check_nums_, pos_check_skipped_nums_);
+
+    for (const parentCandidate &cand : candidates_)
+    {
+      RRTNodePtr curr_node = cand.node;
+      if (!cand.solved)
       {
         ROS_ERROR("sth. wrong with the bvp solver");
+        continue;
+      }
+      if (cand.connected) 
+      {
+        if (min_dist > (curr_node->cost_from_start + cand.cost))
+        {
+          cost_from_p = cand.cost;
+          tau_from_p = cand.tau;
+          min_dist = curr_node->cost_from_start + cost_from_p;
+          tau_from_s = curr_node->tau_from_start + tau_from_p;
+          find_parent_seg = cand.seg;
+          x_near = curr_node;
+          // ROS_INFO("one parent found");
+        } 
+      }
+      else if (!goal_found && cand.need_region_opt && use_regional_opt_ && cand.seg.getAcc(cand.tau).norm() < acc_limit_)
+      {
+        // only 2m < distance with potential parent < 5m and collision duration < 0.5 are stored to be optimized
+        // if (dis < 5.0 && dis > 2.0 && (t_s_e.second - t_s_e.first) <= 0.5 && ((x_rand-x_init).head(3).norm() - (curr_node->x-x_init).head(3).norm()) > 3) 
+        {
+          //find segs to be regionally optimized
+          regional_parents.push_back(curr_node);
+          collide_pts.push_back(cand.collide_pts);
+          regional_seg.push_back(cand.seg);
+          collide_timestamp.push_back(cand.t_s_e);
+        }
       }
-      kd_res_next(p_bcwd_nbr_set); //go to next in kd tree range query result
     }
-    kd_res_free(p_bcwd_nbr_set); //reset kd tree range query
 
     size_t n_r_p = regional_parents.size();
     RRTNode* sampled_node(nullptr);
@@ -378,7 +384,7 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
           optimizer_ptr_->getTraj(local_opt_traj);
 
           /* regional optimization succeeds when find parent, then:
-           * 1. add nodes of the local traj to rrt and kd_tree; 
+           * 1. add nodes of the local traj to rrt and spatial index; 
            */
           //sample rejection
           int n_mid_with_last_pt = local_opt_traj.getPieceNum();
@@ -420,8 +426,8 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
               curr_node_in_regional_traj = addTreeNode(last_node, mid_x, local_opt_traj[j], cost[j], tau);
             last_node = curr_node_in_regional_traj;
           }
-          /* 1.2 add the randomly sampled node to kd_tree */
-          kd_insert3(kd_tree, mid_x[0], mid_x[1], mid_x[2], curr_node_in_regional_traj);
+          /* 1.2 add the randomly sampled node to spatial index */
+          node_index_.insert(mid_x.head(3), curr_node_in_regional_traj);
           sampled_node = curr_node_in_regional_traj;
           break;
         }
@@ -429,7 +435,7 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
     } 
     else if (x_near != nullptr)
     {
-      /* parent found within radius, then add a node to rrt and kd_tree */
+      /* parent found within radius, then add a node to rrt and spatial index */
       //sample rejection
       Vector3d calculated_acc = find_parent_seg.getAcc(tau_from_p);
       if (calculated_acc.norm() >= acc_limit_)
@@ -450,8 +456,8 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
       /* 1.1 add the randomly sampled node to rrt_tree */
       sampled_node = addTreeNode(x_near, x_rand, find_parent_seg, min_dist, tau_from_s, cost_from_p, tau_from_p);
 
-      /* 1.2 add the randomly sampled node to kd_tree */
-      kd_insert3(kd_tree, x_rand[0], x_rand[1], x_rand[2], sampled_node);
+      /* 1.2 add the randomly sampled node to spatial index */
+      node_index_.insert(x_rand.head(3), sampled_node);
     }
     /* end of find parent */
 
@@ -466,14 +472,12 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
     bvp_.getCoeff(coeff);
     Piece seg2goal = Piece(bvp_.getTauStar(), coeff);
     // bool connected_to_goal = checkSegmentConstraints(seg2goal);
-    bool vel_cons = seg2goal.checkMaxVelRate(vel_limit_);
-    bool acc_cons = seg2goal.checkMaxAccRate(acc_limit_);
-    bool jerk_cons = seg2goal.checkMaxJerkRate(jerk_limit_);
+    bool dyn_cons = seg2goal.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_);
     pair<Vector3d, Vector3d> collide_pts_one_seg;
     pair<double, double> t_s_e;
     bool need_region_opt(false);
     bool pos_cons = pos_checker_ptr_->checkPolySeg(seg2goal, collide_pts_one_seg, t_s_e, need_region_opt);
-    bool connected_to_goal = vel_cons && acc_cons && jerk_cons && pos_cons;
+    bool connected_to_goal = dyn_cons && pos_cons;
     if (connected_to_goal && goal_node_->cost_from_start > min_dist + bvp_.getCostStar()) 
     {
       changeNodeParent(goal_node_, sampled_node, seg2goal, bvp_.getCostStar(), bvp_.getTauStar());
@@ -565,23 +569,21 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
     /* 2.rewire */
     if (rewire) 
     {
-      //kd_tree bounds search
-      struct kdres *p_fwd_nbr_set;
-      p_fwd_nbr_set = getForwardNeighbour(x_rand, kd_tree, tau_for_instance, fwd_radius_p);
-      if (p_fwd_nbr_set == nullptr)
+      //spatial index bounds search
+      getForwardNeighbour(x_rand, tau_for_instance, fwd_radius_p, nbrs_);
+      for (RRTNodePtr curr_node : nbrs_)
       {
-        ROS_ERROR("fwd kd range query error");
-        break;
-      }
-      while(!kd_res_end(p_fwd_nbr_set)) 
-      {
-        RRTNode* curr_node = (RRTNode*)kd_res_item_data(p_fwd_nbr_set);
         if (curr_node == goal_node_ || curr_node == start_node_) 
         {
           // already tried to connect to goal from random sampled node
-          kd_res_next(p_fwd_nbr_set);
           continue;
         }
+        if (sampled_node->cost_from_start + bvp_.costLowerBound(x_rand, curr_node->x, ACC_KNOWN, vel_limit_, acc_limit_, jerk_limit_) >= curr_node->cost_from_start)
+        {
+          ++bvp_skipped_nums_;
+          continue;
+        }
+        ++bvp_solve_nums_;
         Piece seg_rewire;
         if(bvp_.solve(x_rand, curr_node->x, ACC_KNOWN))
         {
@@ -593,6 +595,13 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
         {
           ROS_ERROR("sth. wrong with the bvp solver");
         }
+        // lazy: only edges that would improve the node are collision checked
+        if (lazy_collision_ && sampled_node->cost_from_start + bvp_.getCostStar() >= curr_node->cost_from_start)
+        {
+          ++pos_check_skipped_nums_;
+          continue;
+        }
+        ++pos_check_nums_;
         bool connected = checkSegmentConstraints(seg_rewire);
         if (connected && sampled_node->cost_from_start + bvp_.getCostStar() < curr_node->cost_from_start) 
         {
@@ -617,10 +626,7 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
             }
           }
         }
-        /* go to the next entry */
-        kd_res_next(p_fwd_nbr_set);
       }
-      kd_res_free(p_fwd_nbr_set);
     }/* end of rewire */
 
     // vis_x.clear();
@@ -630,6 +636,9 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
 
   }/* end of sample once */
   t_end_ = ros::Time::now();
+  ROS_INFO_STREAM("[KRRT]: checkPolySeg calls: " << pos_check_nums_ << ", avoided by lazy collision checking: " << pos_check_skipped_nums_);
+  ROS_INFO_STREAM("[KRRT]: neighbour BVP solves: " << bvp_solve_nums_ << ", skipped by cost lower bound: " << bvp_skipped_nums_ 
+                  << " (" << 100.0 * bvp_skipped_nums_ / max(1, bvp_solve_nums_ + bvp_skipped_nums_) << "%)");
 
   // vis_x.clear();
   // vector<Vector3d> knots;
@@ -703,59 +712,15 @@ int KRRTPlanner::rrtStar(const StatePVA& x_init, const StatePVA& x_final, int n,
 
 double KRRTPlanner::getForwardRadius(double tau, double cost)
 {
-  MatrixXd G(3, 3);
-  G.setZero();
-  double tau_2 = tau * tau;
-  double tau_3 = tau_2 * tau;
-  double tau_4 = tau_3 * tau;
-  double tau_5 = tau_4 * tau;
-  G(0, 0) = 720.0 / tau_5;
-  G(1, 1) = 192.0 / tau_3;
-  G(2, 2) = 9.0 / tau;
-  G(0, 1) = G(1, 0) = -360.0 / tau_4;
-  G(0, 2) = G(2, 0) = 60.0 / tau_3;
-  G(1, 2) = G(2, 1) = -36.0 / tau_2;
-  G = G * rho_ / (cost - tau) * 3.0;
-  // ROS_INFO_STREAM("G: \n" << G);
-  Eigen::EigenSolver<MatrixXd> es(G);
-  // cout << "The eigenvalues of G are:" << endl << es.eigenvalues() << endl;
-  // cout << "The matrix of eigenvectors, V, is:" << endl << es.eigenvectors() << endl << endl;
-  double radius_p(0.0);
-  for (int i = 0; i < 3; ++i)
-  {
-    radius_p = max(radius_p, sqrt(1.0 / es.eigenvalues()[i].real()) * fabs(es.eigenvectors().col(i)[i]));
-  }
-  return radius_p * 1.732;
+  return reach_radius_table_.radius(tau, cost, rho_);
 }
 
 double KRRTPlanner::getBackwardRadius(double tau, double cost)
 {
-  MatrixXd G(3, 3);
-  G.setZero();
-  double tau_2 = tau * tau;
-  double tau_3 = tau_2 * tau;
-  double tau_4 = tau_3 * tau;
-  double tau_5 = tau_4 * tau;
-  G(0, 0) = 720.0 / tau_5;
-  G(1, 1) = 192.0 / tau_3;
-  G(2, 2) = 9.0 / tau;
-  G(0, 1) = G(1, 0) = -360.0 / tau_4;
-  G(0, 2) = G(2, 0) = 60.0 / tau_3;
-  G(1, 2) = G(2, 1) = -36.0 / tau_2;
-  G = G * rho_ / (cost - tau) * 3.0;
-  // ROS_INFO_STREAM("G: \n" << G);
-  Eigen::EigenSolver<MatrixXd> es(G);
-  // cout << "The eigenvalues of G are:" << endl << es.eigenvalues() << endl;
-  // cout << "The matrix of eigenvectors, V, is:" << endl << es.eigenvectors() << endl << endl;
-  double radius_p(0.0);
-  for (int i = 0; i < 3; ++i)
-  {
-    radius_p = max(radius_p, sqrt(1.0 / es.eigenvalues()[i].real()) * fabs(es.eigenvectors().col(i)[i]));
-  }
-  return radius_p * 1.732;
+  return reach_radius_table_.radius(tau, cost, rho_);
 }
 
-struct kdres *KRRTPlanner::getForwardNeighbour(const StatePVA& x0, struct kdtree *kd_tree, double tau, double radius_p)
+void KRRTPlanner::getForwardNeighbour(const StatePVA& x0, double tau, double radius_p, vector<RRTNodePtr>& nbrs)
 {
   double half_tau_square = tau * tau / 2;
   StatePVA x_ba_tau;
@@ -775,10 +740,10 @@ struct kdres *KRRTPlanner::getForwardNeighbour(const StatePVA& x0, struct kdtree
     // vis_ptr_->visualizeReachVel(1, x_ba_tau.head(3) + x_ba_tau.tail(3), 2 * radius_v, pos_checker_ptr_->getLocalTime());
     // getchar();
   }
-  return kd_nearest_range3(kd_tree, x_ba_tau[0], x_ba_tau[1], x_ba_tau[2], radius_p);
+  node_index_.rangeQuery(x_ba_tau.head(3), radius_p, nbrs);
 }
 
-struct kdres *KRRTPlanner::getBackwardNeighbour(const StatePVA& x1, struct kdtree *kd_tree, double tau, double radius_p)
+void KRRTPlanner::getBackwardNeighbour(const StatePVA& x1, double tau, double radius_p, vector<RRTNodePtr>& nbrs)
 {
   StatePVA expNegATau_x1;
   double half_tau_square = tau * tau / 2;
@@ -798,18 +763,18 @@ struct kdres *KRRTPlanner::getBackwardNeighbour(const StatePVA& x1, struct kdtre
     // vis_ptr_->visualizeReachVel(1, expNegATau_x1.head(3) + expNegATau_x1.tail(3), 2 * radius_v, pos_checker_ptr_->getLocalTime());
     // getchar();
   }
-  return kd_nearest_range3(kd_tree, expNegATau_x1[0], expNegATau_x1[1], expNegATau_x1[2], radius_p);
+  node_index_.rangeQuery(expNegATau_x1.head(3), radius_p, nbrs);
 }
 
 inline RRTNodePtr KRRTPlanner::addTreeNode(RRTNodePtr& parent, const StatePVA& state, const Piece& piece, 
                                            const double& cost_from_start, const double& tau_from_start, 
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
-  RRTNodePtr new_node_ptr = start_tree_[valid_start_tree_node_nums_++];
+  RRTNodePtr new_node_ptr = start_tree_.newNode(valid_start_tree_node_nums_++);
   new_node_ptr->parent = parent;
-  parent->children.push_back(new_node_ptr);
+  parent->addChild(new_node_ptr);
   new_node_ptr->x = state;
-  new_node_ptr->poly_seg = piece;
+  start_tree_.polySeg(new_node_ptr) = piece;
   new_node_ptr->cost_from_start = cost_from_start;
   new_node_ptr->tau_from_start = tau_from_start;
   new_node_ptr->cost_from_parent = cost_from_parent;
@@ -820,11 +785,11 @@ inline RRTNodePtr KRRTPlanner::addTreeNode(RRTNodePtr& parent, const StatePVA& s
 inline RRTNodePtr KRRTPlanner::addTreeNode(RRTNodePtr& parent, const StatePVA& state, const Piece& piece, 
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
-  RRTNodePtr new_node_ptr = start_tree_[valid_start_tree_node_nums_++];
+  RRTNodePtr new_node_ptr = start_tree_.newNode(valid_start_tree_node_nums_++);
   new_node_ptr->parent = parent;
-  parent->children.push_back(new_node_ptr);
+  parent->addChild(new_node_ptr);
   new_node_ptr->x = state;
-  new_node_ptr->poly_seg = piece;
+  start_tree_.polySeg(new_node_ptr) = piece;
   new_node_ptr->cost_from_start = parent->cost_from_start + cost_from_parent;
   new_node_ptr->tau_from_start = parent->tau_from_start + tau_from_parent;
   new_node_ptr->cost_from_parent = cost_from_parent;
@@ -836,14 +801,14 @@ inline void KRRTPlanner::changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent,
                                            const double& cost_from_parent, const double& tau_from_parent)
 {
   if (node->parent)
-    node->parent->children.remove(node);  //DON'T FORGET THIS, remove it form its parent's children list
+    node->parent->removeChild(node);  //DON'T FORGET THIS, remove it form its parent's children list
   node->parent = parent;
   node->cost_from_parent = cost_from_parent;
   node->tau_from_parent = tau_from_parent;
   node->cost_from_start = parent->cost_from_start + cost_from_parent;
   node->tau_from_start = parent->tau_from_start + tau_from_parent;
-  node->poly_seg = piece;
-  parent->children.push_back(node);
+  start_tree_.polySeg(node) = piece;
+  parent->addChild(node);
 
   // for all its descedants, change the cost_from_start and tau_from_start;
   RRTNode* descendant(node);
@@ -853,7 +818,7 @@ inline void KRRTPlanner::changeNodeParent(RRTNodePtr& node, RRTNodePtr& parent,
   {
     descendant = Q.front();
     Q.pop();
-    for (const auto& leafptr : descendant->children) 
+    for (RRTNode* leafptr = descendant->first_child; leafptr; leafptr = leafptr->next_sibling) 
     {
       leafptr->cost_from_start = leafptr->cost_from_parent + descendant->cost_from_start;
       leafptr->tau_from_start = leafptr->tau_from_parent + descendant->tau_from_start;
@@ -911,13 +876,14 @@ inline void KRRTPlanner::sampleWholeTree(const RRTNodePtr &root, vector< StatePV
   RRTNode* node = root;
   std::queue<RRTNode*> Q;
   Q.push(node);
+  TrajSamples samples;
   while (!Q.empty()) 
   {
     node = Q.front();
     Q.pop();
-    for (const auto& leafptr : node->children) 
+    for (RRTNode* leafptr = node->first_child; leafptr; leafptr = leafptr->next_sibling) 
     {
-      leafptr->poly_seg.sampleOneSeg(vis_x);
+      start_tree_.polySeg(leafptr).sampleOneSeg(vis_x, samples);
       knots.push_back(leafptr->x.head(3));
       Q.push(leafptr);
     }
@@ -931,8 +897,9 @@ void KRRTPlanner::fillTraj(const RRTNodePtr &goal_leaf, Trajectory& traj)
   RRTNodePtr node = goal_leaf;
   while (node->parent) 
   {
-    durs.push_back(node->poly_seg.getDuration());
-    coeffMats.push_back(node->poly_seg.getCoeffMat());
+    const Piece &seg = start_tree_.polySeg(node);
+    durs.push_back(seg.getDuration());
+    coeffMats.push_back(seg.getCoeffMat());
     node = node->parent;
   }
   std::reverse(std::begin(durs), std::end(durs));
@@ -940,21 +907,37 @@ void KRRTPlanner::fillTraj(const RRTNodePtr &goal_leaf, Trajectory& traj)
   traj = Trajectory(durs, coeffMats);
 }
 
-inline bool KRRTPlanner::checkSegmentConstraints(const Piece &seg)
+// solves the boundary value problems of all candidates in one batch, then checks each segment.
+// With lazy collision checking the collision check is left to ParentSelector::selectParentLazily()
+void KRRTPlanner::evaluateCandidates(parentCandidates &cands, const StatePVA &x_rand)
 {
-  if (!seg.checkMaxVelRate(vel_limit_))
+  int n_cands = cands.size();
+  batch_starts_.resize(Eigen::NoChange, n_cands);
+  batch_goals_.resize(Eigen::NoChange, n_cands);
+  for (int i = 0; i < n_cands; ++i)
   {
-    // ROS_WARN("vel constraints violate!");
-    return false;
+    batch_starts_.col(i) = cands[i].node->x;
+    batch_goals_.col(i) = x_rand;
   }
-  if (!seg.checkMaxAccRate(acc_limit_))
+  bvp_.solveBatch(batch_starts_, batch_goals_, ACC_KNOWN, batch_sol_);
+  for (int i = 0; i < n_cands; ++i)
   {
-    // ROS_WARN("acc constraints violate!");
-    return false;
+    parentCandidate &cand = cands[i];
+    ParentSelector::resetCandidate(cand);
+    cand.solved = batch_sol_.solved[i];
+    if (!cand.solved)
+      continue;
+    cand.cost = batch_sol_.cost_star[i];
+    cand.tau = batch_sol_.tau_star[i];
+    parent_selector_.checkCandidateSeg(cand, batch_sol_.coeff[i]);
   }
-  if (!seg.checkMaxJerkRate(jerk_limit_))
+}
+
+inline bool KRRTPlanner::checkSegmentConstraints(const Piece &seg)
+{
+  if (!seg.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_))
   {
-    // ROS_WARN("jerk constraints violate!");
+    // ROS_WARN("dynamic constraints violate!");
     return false;
   }
   if (!pos_checker_ptr_->checkPolySeg(seg))
@@ -0,0 +1,93 @@
+#include "kino_plan/parent_selector.h"
+#include <algorithm>
+
+namespace kino_planner
+{
+
+ParentSelector::ParentSelector()
+    : vel_limit_(-1.0), acc_limit_(-1.0), jerk_limit_(-1.0), lazy_collision_(false)
+{
+}
+
+void ParentSelector::init(double vel_limit, double acc_limit, double jerk_limit, bool lazy_collision)
+{
+  vel_limit_ = vel_limit;
+  acc_limit_ = acc_limit;
+  jerk_limit_ = jerk_limit;
+  lazy_collision_ = lazy_collision;
+}
+
+void ParentSelector::resetCandidate(parentCandidate &cand)
+{
+  cand.dyn_feasible = false;
+  cand.pos_checked = false;
+  cand.connected = false;
+  cand.need_region_opt = false;
+}
+
+void ParentSelector::checkCandidateSeg(parentCandidate &cand, const CoefficientMat &coeff) const
+{
+  cand.seg = Piece(cand.tau, coeff);
+  cand.dyn_feasible = cand.seg.checkDynamicLimits(vel_limit_, acc_limit_, jerk_limit_);
+  if (!lazy_collision_)
+    checkCandidatePos(cand);
+}
+
+void ParentSelector::checkCandidatePos(parentCandidate &cand) const
+{
+  bool pos_cons = pos_checker_->checkPolySeg(cand.seg, cand.collide_pts, cand.t_s_e, cand.need_region_opt);
+  cand.pos_checked = true;
+  cand.connected = cand.dyn_feasible && pos_cons;
+}
+
+// Collision checks candidates in the order of cost_from_start + bvp cost and stops
+// at the first feasible one, which is the parent the full search would choose.
+// If none is feasible and regional optimization wants the collision info, the
+// candidates skipped for violating the dynamic limits are checked as well.
+// Returns the index of the parent or -1.
+int ParentSelector::selectParentLazily(parentCandidates &cands, bool keep_region_info)
+{
+  lazy_order_.clear();
+  for (int i = 0; i < (int)cands.size(); ++i)
+  {
+    if (cands[i].solved)
+      lazy_order_.push_back(i);
+  }
+  // stable, so ties keep range query order like the full search
+  std::stable_sort(lazy_order_.begin(), lazy_order_.end(), [&cands](int a, int b) {
+    return cands[a].node->cost_from_start + cands[a].cost < cands[b].node->cost_from_start + cands[b].cost;
+  });
+
+  for (int i : lazy_order_)
+  {
+    if (!cands[i].dyn_feasible)
+      continue;
+    checkCandidatePos(cands[i]);
+    if (cands[i].connected)
+      return i;
+  }
+  if (keep_region_info)
+  {
+    for (int i : lazy_order_)
+    {
+      if (!cands[i].pos_checked)
+        checkCandidatePos(cands[i]);
+    }
+  }
+  return -1;
+}
+
+void ParentSelector::countPosChecks(const parentCandidates &cands, int &checked, int &skipped) const
+{
+  for (const parentCandidate &cand : cands)
+  {
+    if (!cand.solved)
+      continue;
+    if (cand.pos_checked)
+      ++checked;
+    else
+      ++skipped;
+  }
+}
+
+} // namespace kino_planner
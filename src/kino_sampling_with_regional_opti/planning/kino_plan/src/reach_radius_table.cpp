@@ -0,0 +1,71 @@
+#include "kino_plan/reach_radius_table.h"
+#include <Eigen/Eigen>
+#include <cmath>
+#include <algorithm>
+
+namespace kino_planner
+{
+ReachRadiusTable::ReachRadiusTable() : max_tau_(0.0), step_inv_(0.0)
+{
+}
+
+void ReachRadiusTable::init(double max_tau, int size)
+{
+  unit_radius_.clear();
+  max_tau_ = 0.0;
+  if (!(max_tau > 0.0) || size < 2)
+    return;
+
+  max_tau_ = max_tau;
+  step_inv_ = (size - 1) / max_tau;
+  unit_radius_.resize(size);
+  unit_radius_[0] = 0.0; // the reachable set shrinks to a point as tau -> 0
+  for (int i = 1; i < size; ++i)
+    unit_radius_[i] = unitRadius(i / step_inv_);
+}
+
+double ReachRadiusTable::radius(double tau, double cost, double rho) const
+{
+  if (cost <= tau || tau <= 0.0)
+    return 0.0;
+
+  double unit_radius;
+  if (tau < max_tau_)
+  {
+    double x = tau * step_inv_;
+    int i = (int)x;
+    double w = x - i;
+    unit_radius = (1.0 - w) * unit_radius_[i] + w * unit_radius_[i + 1];
+  }
+  else
+  {
+    unit_radius = unitRadius(tau);
+  }
+  return unit_radius * sqrt((cost - tau) / (3.0 * rho));
+}
+
+double ReachRadiusTable::unitRadius(double tau)
+{
+  Eigen::Matrix3d G;
+  double tau_2 = tau * tau;
+  double tau_3 = tau_2 * tau;
+  double tau_4 = tau_3 * tau;
+  double tau_5 = tau_4 * tau;
+  G(0, 0) = 720.0 / tau_5;
+  G(1, 1) = 192.0 / tau_3;
+  G(2, 2) = 9.0 / tau;
+  G(0, 1) = G(1, 0) = -360.0 / tau_4;
+  G(0, 2) = G(2, 0) = 60.0 / tau_3;
+  G(1, 2) = G(2, 1) = -36.0 / tau_2;
+  // G is symmetric, eigen pairs are taken in descending order of eigenvalue. The 
+  // general EigenSolver mostly returns them in that order too, but not for every tau
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(G);
+  double radius_p(0.0);
+  for (int i = 0; i < 3; ++i)
+  {
+    radius_p = std::max(radius_p, sqrt(1.0 / es.eigenvalues()[2 - i]) * fabs(es.eigenvectors().col(2 - i)[i]));
+  }
+  return radius_p * 1.732;
+}
+
+} // namespace kino_planner
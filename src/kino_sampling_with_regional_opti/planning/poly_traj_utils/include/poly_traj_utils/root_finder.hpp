@@ -510,13 +510,12 @@ inline double shrinkInterval(double *coeffs, int numCoeffs, double lbound, doubl
 // Calculate a single zero of poly coeffs(x) inside [lbound, ubound]
 // Requirements: coeffs(lbound)*coeffs(ubound) < 0, lbound < ubound
 {
-    double *dcoeffs = new double[numCoeffs - 1];
+    double dcoeffs[RootFinderParam::highestOrder];
     polyDeri(coeffs, dcoeffs, numCoeffs);
     auto func = [&coeffs, &numCoeffs](double x) { return polyEval(coeffs, numCoeffs, x); };
     auto dfunc = [&dcoeffs, &numCoeffs](double x) { return polyEval(dcoeffs, numCoeffs - 1, x); };
     constexpr int maxDblIts = 128;
     double rts = safeNewton(func, dfunc, lbound, ubound, tol, maxDblIts);
-    delete[] dcoeffs;
     return rts;
 }
 
@@ -733,6 +732,190 @@ inline std::set<double> isolateRealRoots(const Eigen::VectorXd &coeffs, double l
     return rts;
 }
 
+template <int N>
+inline void polyEvalFixed(const double *p, double x, double &f, double &df)
+// Evaluate p(x) and p'(x), where p has fixed degree N and coefficients in descending order
+// Powers of x are accumulated instead of the Horner scheme, see polyEval()
+{
+    double xn = 1.0;
+    f = p[N];
+    df = 0.0;
+    for (int i = N - 1; i >= 0; i--)
+    {
+        df += (N - i) * p[i] * xn;
+        xn *= x;
+        f += p[i] * xn;
+    }
+    return;
+}
+
+inline double splitPoint(double l, double h)
+// Bisection point of [l, h], geometric when the interval spans magnitudes
+{
+    return (l > 0.0 && h > 4.0 * l) ? sqrt(l * h) : 0.5 * (l + h);
+}
+
+template <int N>
+inline double monoNewton(const double *p, double l, double h, double fl,
+                         double x0, double tol, int maxIts)
+// Safe Newton method on [l, h] where p(l)*p(h)<0 and p has one root inside,
+// started from x0 if it lies inside the interval, otherwise from the split point.
+// Bisects whenever the Newton step leaves the bracket or does not halve the last step
+{
+    bool increasing = fl < 0.0;
+    double x = (x0 > l && x0 < h) ? x0 : splitPoint(l, h);
+    double f, df, xn;
+    double dxold = h - l;
+    for (int j = 0; j < maxIts; j++)
+    {
+        polyEvalFixed<N>(p, x, f, df);
+        if (f == 0.0)
+        {
+            break;
+        }
+        if ((f < 0.0) == increasing)
+        {
+            l = x;
+        }
+        else
+        {
+            h = x;
+        }
+
+        xn = x - f / df;
+        if (!(xn > l && xn < h) || fabs(2.0 * (xn - x)) > dxold)
+        {
+            xn = splitPoint(l, h);
+        }
+        dxold = fabs(xn - x);
+        x = xn;
+        if (dxold < tol || h - l < tol)
+        {
+            break;
+        }
+    }
+    return x;
+}
+
+template <int N>
+inline double rootMagnitudeBound(const double *p, double ubound)
+// Halves ubound as long as |p(x)| > 0 is guaranteed for all |x| >= ubound / 2,
+// i.e. |p[0]| x^N > sum_k |p[k]| x^(N-k)
+{
+    if (p[0] == 0.0)
+    {
+        return ubound;
+    }
+    double a[N + 1];
+    double inv = 1.0 / fabs(p[0]);
+    for (int k = 1; k <= N; k++)
+    {
+        a[k] = fabs(p[k]) * inv;
+    }
+    double xinv = 2.0 / ubound;
+    while (ubound > DBL_EPSILON)
+    {
+        double xk = 1.0, sum = 0.0;
+        for (int k = 1; k <= N; k++)
+        {
+            xk *= xinv;
+            sum += a[k] * xk;
+        }
+        if (sum >= 1.0)
+        {
+            break;
+        }
+        ubound *= 0.5;
+        xinv *= 2.0;
+    }
+    return ubound;
+}
+
+template <int N>
+inline int fixedDegreeRoots(const double *p, double lbound, double ubound,
+                            double tol, double *roots, double seed)
+// Roots of p with fixed degree N inside (lbound, ubound) in ascending order.
+// The stationary points, i.e. the roots of p', split the interval into
+// pieces where p is monotone, so each piece holds at most one root.
+// Recursion on the degree ends at the linear case, everything lives on the stack
+{
+    if (lbound >= 0.0)
+    {
+        // Descartes' rule of signs: at most one positive root means the sign
+        // change over the interval brackets it, no need for the stationary points
+        int signVars = 0;
+        double last = 0.0;
+        for (int i = 0; i <= N; i++)
+        {
+            if (p[i] != 0.0)
+            {
+                signVars += (last != 0.0 && (last < 0.0) != (p[i] < 0.0));
+                last = p[i];
+            }
+        }
+        if (signVars <= 1)
+        {
+            double fl, fh, df;
+            polyEvalFixed<N>(p, lbound, fl, df);
+            polyEvalFixed<N>(p, ubound, fh, df);
+            if (fl == 0.0 || fh == 0.0 || (fl < 0.0) == (fh < 0.0))
+            {
+                return 0;
+            }
+            roots[0] = monoNewton<N>(p, lbound, ubound, fl, seed, tol, 64);
+            return 1;
+        }
+    }
+
+    double dp[N];
+    for (int i = 0; i < N; i++)
+    {
+        dp[i] = (N - i) * p[i];
+    }
+    double brks[N + 1];
+    brks[0] = lbound;
+    int nBrks = 1 + fixedDegreeRoots<N - 1>(dp, lbound, ubound, tol, brks + 1, seed);
+    brks[nBrks++] = ubound;
+
+    int nRoots = 0;
+    double fl, fh, df;
+    polyEvalFixed<N>(p, lbound, fl, df);
+    for (int i = 1; i < nBrks; i++)
+    {
+        polyEvalFixed<N>(p, brks[i], fh, df);
+        if (fh == 0.0)
+        {
+            if (i < nBrks - 1)
+            {
+                roots[nRoots++] = brks[i];
+            }
+        }
+        else if (fl != 0.0 && (fl < 0.0) != (fh < 0.0))
+        {
+            roots[nRoots++] = monoNewton<N>(p, brks[i - 1], brks[i], fl, seed, tol, 64);
+        }
+        fl = fh;
+    }
+    return nRoots;
+}
+
+template <>
+inline int fixedDegreeRoots<1>(const double *p, double lbound, double ubound,
+                               double /*tol*/, double *roots, double /*seed*/)
+{
+    if (p[0] == 0.0)
+    {
+        return 0;
+    }
+    double rt = -p[1] / p[0];
+    if (rt > lbound && rt < ubound)
+    {
+        roots[0] = rt;
+        return 1;
+    }
+    return 0;
+}
+
 } // namespace RootFinderPriv
 
 namespace RootFinder
@@ -858,6 +1041,22 @@ inline Eigen::VectorXd polySqr(const Eigen::VectorXd &coef)
     return result;
 }
 
+template <int N>
+inline void polySqrAdd(const double *coef, double *result)
+// Add the self-convolution of coef(x), which has fixed degree N, onto result
+// with 2N+1 coefficients. Sums of squares are built on the stack this way
+{
+    for (int i = 0; i <= N; i++)
+    {
+        result[2 * i] += coef[i] * coef[i];
+        for (int j = i + 1; j <= N; j++)
+        {
+            result[i + j] += 2.0 * coef[i] * coef[j];
+        }
+    }
+    return;
+}
+
 inline double polyVal(const Eigen::VectorXd &coeffs, double x,
                       bool numericalStability = true)
 // Evaluate the polynomial at x, i.e., coeffs(x)
@@ -987,6 +1186,89 @@ inline int countRoots(const Eigen::VectorXd &coeffs, double l, double r)
     return nRoots;
 }
 
+template <int N>
+inline int countRootsFixed(const double (&coeffs)[N + 1], double l, double r)
+// Same as countRoots() for a polynomial of fixed degree N, without touching the heap
+// Boundary values, i.e., coeffs(l) and coeffs(r), must be nonzero
+{
+    int nRoots = 0;
+
+    int valid = N + 1;
+    for (int i = 0; i <= N; i++)
+    {
+        if (fabs(coeffs[i]) < DBL_EPSILON)
+        {
+            valid--;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (valid > 1 && fabs(coeffs[N]) > DBL_EPSILON)
+    {
+        // Build the Sturm sequence, the first remainder may be written
+        // past len * len when the derivative is already constant
+        int len = valid;
+        int order = len - 1;
+        double sturmSeqs[(N + 1) * (N + 3)];
+        int szSeq[N + 2] = {0};
+        int num = 0;
+
+        const double *monicCoeffs = coeffs + N + 1 - valid;
+        double lead = monicCoeffs[0];
+        for (int i = 0; i < len; i++)
+        {
+            sturmSeqs[i] = i == 0 ? 1.0 : monicCoeffs[i] / lead;
+            sturmSeqs[i + 1 + len] = (order - i) * sturmSeqs[i] / order;
+        }
+        szSeq[0] = len;
+        szSeq[1] = len - 1;
+        num += 2;
+
+        bool remainderConstant = false;
+        int idx = 0;
+        while (!remainderConstant)
+        {
+            szSeq[idx + 2] = RootFinderPriv::polyMod(&(sturmSeqs[(idx + 1) * len - szSeq[idx]]),
+                                                     &(sturmSeqs[(idx + 2) * len - szSeq[idx + 1]]),
+                                                     &(sturmSeqs[(idx + 3) * len - szSeq[idx]]),
+                                                     szSeq[idx], szSeq[idx + 1]);
+            remainderConstant = szSeq[idx + 2] == 1;
+            for (int i = 1; i < szSeq[idx + 2]; i++)
+            {
+                sturmSeqs[(idx + 3) * len - szSeq[idx + 2] + i] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
+            }
+            sturmSeqs[(idx + 3) * len - szSeq[idx + 2]] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
+            num++;
+            idx++;
+        }
+
+        // Count numbers of sign variations at two boundaries
+        double yl, lastyl, yr, lastyr;
+        lastyl = RootFinderPriv::polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], l);
+        lastyr = RootFinderPriv::polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], r);
+        for (int i = 1; i < num; i++)
+        {
+            yl = RootFinderPriv::polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], l);
+            yr = RootFinderPriv::polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], r);
+            if (lastyl == 0.0 || lastyl * yl < 0.0)
+            {
+                ++nRoots;
+            }
+            if (lastyr == 0.0 || lastyr * yr < 0.0)
+            {
+                --nRoots;
+            }
+            lastyl = yl;
+            lastyr = yr;
+        }
+    }
+
+    return nRoots;
+}
+
 inline std::set<double> solvePolynomial(const Eigen::VectorXd &coeffs, double lbound, double ubound, double tol, bool isolation = true)
 // Calculate roots of coeffs(x) inside (lbound, rbound)
 //
@@ -1085,6 +1367,54 @@ inline std::set<double> solvePolynomial(const Eigen::VectorXd &coeffs, double lb
     return rts;
 }
 
+template <int N>
+inline int solveFixedDegree(const double (&coeffs)[N + 1], double lbound, double ubound,
+                            double tol, double (&roots)[N], double seed = 0.0)
+// Calculate roots of coeffs(x) inside (lbound, ubound) for a polynomial of fixed degree N,
+// coefficients in descending order. Returns the number of roots written to roots in
+// ascending order. Unlike solvePolynomial() nothing is allocated, which matters
+// for the many small polynomials of the BVP solvers.
+//
+// seed: a guess of a root, e.g. the result for a nearby problem. The safe Newton
+//       iteration of the piece that contains it starts from there
+//
+// Roots of even multiplicity are only found if they are hit exactly
+{
+    ubound = std::min(ubound, RootFinderPriv::rootMagnitudeBound<N>(coeffs, ubound));
+    if (!(lbound < ubound))
+    {
+        return 0;
+    }
+    return RootFinderPriv::fixedDegreeRoots<N>(coeffs, lbound, ubound, tol, roots, seed);
+}
+
+template <int N>
+struct RootArray
+// At most N distinct real roots in ascending order, kept on the stack.
+// Iterates like the std::set returned by solvePolynomial()
+{
+    double data[N > 0 ? N : 1];
+    int num = 0;
+
+    inline int size() const { return num; }
+    inline bool empty() const { return num == 0; }
+    inline const double *begin() const { return data; }
+    inline const double *end() const { return data + num; }
+    inline double operator[](int i) const { return data[i]; }
+};
+
+template <int N>
+inline RootArray<N> solvePolynomialFixed(const double (&coeffs)[N + 1], double lbound, double ubound, double tol)
+// Heap-free counterpart of solvePolynomial() for polynomials of degree at most N,
+// coefficients in descending order. Leading zeros are allowed, so N only needs to be
+// the largest degree a call site can produce. An identically zero polynomial has no roots.
+// Like solveFixedDegree(), roots of even multiplicity are only found if they are hit exactly
+{
+    RootArray<N> rts;
+    rts.num = solveFixedDegree<N>(coeffs, lbound, ubound, tol, rts.data);
+    return rts;
+}
+
 } // namespace RootFinder
 
 #endif
\ No newline at end of file
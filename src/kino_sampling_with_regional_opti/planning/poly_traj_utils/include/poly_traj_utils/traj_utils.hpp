@@ -4,6 +4,7 @@
 #include "root_finder.hpp"
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <Eigen/Eigen>
 
 // Polynomial order and trajectory dimension are fixed here
@@ -22,6 +23,54 @@ typedef Eigen::Matrix<double, 9, 1> StatePVA;
 typedef Eigen::Matrix<double, TrajDim, 1> ControlJrk;
 typedef Eigen::Matrix<double, TrajDim, 1> ControlAcc;
 
+// Pos/vel/acc of a trajectory at a batch of time stamps, stored per axis so that
+// each column is contiguous, i.e. pos.col(0) holds the x of all stamps
+struct TrajSamples
+{
+    Eigen::ArrayXd t;
+    Eigen::Array<double, Eigen::Dynamic, TrajDim> pos, vel, acc;
+    // normalized time of each stamp in its piece
+    Eigen::ArrayXd tn;
+
+    // Buffers only grow, so a reused TrajSamples stops allocating
+    inline void resize(int n)
+    {
+        if (t.size() < n)
+        {
+            t.resize(n);
+            tn.resize(n);
+            pos.resize(n, TrajDim);
+            vel.resize(n, TrajDim);
+            acc.resize(n, TrajDim);
+        }
+        num = n;
+        return;
+    }
+
+    inline int size() const
+    {
+        return num;
+    }
+
+    inline Eigen::Vector3d getPos(int i) const
+    {
+        return pos.row(i).transpose().matrix();
+    }
+
+    inline Eigen::Vector3d getVel(int i) const
+    {
+        return vel.row(i).transpose().matrix();
+    }
+
+    inline Eigen::Vector3d getAcc(int i) const
+    {
+        return acc.row(i).transpose().matrix();
+    }
+
+private:
+    int num = 0;
+};
+
 // A single piece of a trajectory, which is indeed a polynomial
 class Piece
 {
@@ -252,258 +301,218 @@ public:
     // Get the max velocity rate of the piece
     inline double getMaxVelRate() const
     {
-        // Compute normalized squared vel norm polynomial coefficient matrix
-        Eigen::MatrixXd nVelCoeffMat = getVelCoeffMat(true);
-        Eigen::VectorXd coeff = RootFinder::polySqr(nVelCoeffMat.row(0)) +
-                                RootFinder::polySqr(nVelCoeffMat.row(1)) +
-                                RootFinder::polySqr(nVelCoeffMat.row(2));
-        int N = coeff.size();
-        int n = N - 1;
-        for (int i = 0; i < N; i++)
+        return getMaxRate<1>();
+    }
+
+    // Get the max acceleration rate of the piece
+    inline double getMaxAccRate() const
+    {
+        return getMaxRate<2>();
+    }
+
+    inline double getMaxJerkRate() const
+    {
+        return getMaxRate<3>();
+    }
+
+    // Check whether velocity rate of the piece is always less than maxVelRate
+    inline bool checkMaxVelRate(double maxVelRate) const
+    {
+        return checkMaxRate<1>(maxVelRate);
+    }
+
+    // Check whether accleration rate of the piece is always less than maxAccRate
+    inline bool checkMaxAccRate(double maxAccRate) const
+    {
+        return checkMaxRate<2>(maxAccRate);
+    }
+
+    // Check whether jerk rate of the piece is always less than maxJerkRate
+    inline bool checkMaxJerkRate(double maxJerkRate) const
+    {
+        return checkMaxRate<3>(maxJerkRate);
+    }
+
+    // Same as checkMaxVelRate() && checkMaxAccRate() && checkMaxJerkRate(),
+    // but all three hull tests run before any Sturm sequence is built,
+    // and the root counting goes from the lowest degree (jerk) up
+    inline bool checkDynamicLimits(double maxVelRate, double maxAccRate, double maxJerkRate) const
+    {
+        int velHull = hullRateTest<1>(maxVelRate);
+        if (velHull < 0)
         {
-            coeff(i) *= n;
-            n--;
+            return false;
         }
-        if (coeff.head(N - 1).squaredNorm() < DBL_EPSILON)
+        int accHull = hullRateTest<2>(maxAccRate);
+        if (accHull < 0)
         {
-            return 0.0;
+            return false;
         }
-        else
+        int jerkHull = hullRateTest<3>(maxJerkRate);
+        if (jerkHull < 0)
         {
-            // Search an open interval whose boundaries are not zeros
-            double l = -0.0625;
-            double r = 1.0625;
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), l)) < DBL_EPSILON)
-            {
-                l = 0.5 * l;
-            }
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), r)) < DBL_EPSILON)
-            {
-                r = 0.5 * (r + 1.0);
-            }
-            // Find all stationaries
-            std::set<double> candidates = RootFinder::solvePolynomial(coeff.head(N - 1), l, r,
-                                                                      FLT_EPSILON / duration);
-
-            // Check boundary points and stationaries within duration
-            candidates.insert(0.0);
-            candidates.insert(1.0);
-            double maxVelRateSqr = -INFINITY;
-            double tempNormSqr;
-            for (std::set<double>::const_iterator it = candidates.begin();
-                 it != candidates.end();
-                 it++)
-            {
-                if (0.0 <= *it && 1.0 >= *it)
-                {
-                    // Recover the actual time then get the vel squared norm
-                    tempNormSqr = getVel((*it) * duration).squaredNorm();
-                    maxVelRateSqr = maxVelRateSqr < tempNormSqr ? tempNormSqr : maxVelRateSqr;
-                }
-            }
-            return sqrt(maxVelRateSqr);
+            return false;
         }
+        return (jerkHull > 0 || sturmRateTest<3>(maxJerkRate)) &&
+               (accHull > 0 || sturmRateTest<2>(maxAccRate)) &&
+               (velHull > 0 || sturmRateTest<1>(maxVelRate));
     }
 
-    // Get the max acceleration rate of the piece
-    inline double getMaxAccRate() const
+    // Get the Bernstein coefficients, i.e. the control points, of the K-th derivative
+    // over the normalized interval. The curve stays inside their convex hull
+    // and passes through the first and the last one
+    template <int K>
+    inline Eigen::Matrix<double, TrajDim, TrajOrder - K + 1> getBernsteinCoeffMat() const
     {
-        // Compute normalized squared acc norm polynomial coefficient matrix
-        Eigen::MatrixXd nAccCoeffMat = getAccCoeffMat(true);
-        Eigen::VectorXd coeff = RootFinder::polySqr(nAccCoeffMat.row(0)) +
-                                RootFinder::polySqr(nAccCoeffMat.row(1)) +
-                                RootFinder::polySqr(nAccCoeffMat.row(2));
-        int N = coeff.size();
-        int n = N - 1;
-        for (int i = 0; i < N; i++)
+        double ctrl[TrajDim][TrajOrder - K + 1];
+        normBernsteinCoeffs<K>(ctrl);
+        Eigen::Matrix<double, TrajDim, TrajOrder - K + 1> ctrlMat;
+        for (int d = 0; d < TrajDim; d++)
         {
-            coeff(i) *= n;
-            n--;
+            for (int i = 0; i <= TrajOrder - K; i++)
+            {
+                ctrlMat(d, i) = ctrl[d][i];
+            }
         }
-        if (coeff.head(N - 1).squaredNorm() < DBL_EPSILON)
+        return ctrlMat;
+    }
+
+    // Conservative axis-aligned bounding box of the piece from its control points
+    inline void getHullBoundingBox(Eigen::Vector3d &lb, Eigen::Vector3d &ub) const
+    {
+        double ctrl[TrajDim][TrajOrder + 1];
+        normBernsteinCoeffs<0>(ctrl);
+        for (int d = 0; d < TrajDim; d++)
         {
-            return 0.0;
+            lb(d) = ub(d) = ctrl[d][0];
+            for (int i = 1; i <= TrajOrder; i++)
+            {
+                lb(d) = std::min(lb(d), ctrl[d][i]);
+                ub(d) = std::max(ub(d), ctrl[d][i]);
+            }
         }
-        else
+        return;
+    }
+
+    // Check whether the piece stays inside the box [lb, ub]
+    // The control points decide most cases, the extrema of an axis
+    // are only solved for when its hull crosses the box
+    inline bool checkInBox(const Eigen::Vector3d &lb, const Eigen::Vector3d &ub) const
+    {
+        double ctrl[TrajDim][TrajOrder + 1];
+        normBernsteinCoeffs<0>(ctrl);
+        for (int d = 0; d < TrajDim; d++)
         {
-            // Search an open interval whose boundaries are not zeros
-            double l = -0.0625;
-            double r = 1.0625;
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), l)) < DBL_EPSILON)
+            // The end points are on the curve
+            if (ctrl[d][0] < lb(d) || ctrl[d][0] > ub(d) ||
+                ctrl[d][TrajOrder] < lb(d) || ctrl[d][TrajOrder] > ub(d))
             {
-                l = 0.5 * l;
+                return false;
             }
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), r)) < DBL_EPSILON)
+            double lo = ctrl[d][0], hi = ctrl[d][0];
+            for (int i = 1; i <= TrajOrder; i++)
             {
-                r = 0.5 * (r + 1.0);
+                lo = std::min(lo, ctrl[d][i]);
+                hi = std::max(hi, ctrl[d][i]);
             }
-            // Find all stationaries
-            std::set<double> candidates = RootFinder::solvePolynomial(coeff.head(N - 1), l, r,
-                                                                      FLT_EPSILON / duration);
-            // Check boundary points and stationaries within duration
-            candidates.insert(0.0);
-            candidates.insert(1.0);
-            double maxAccRateSqr = -INFINITY;
-            double tempNormSqr;
-            for (std::set<double>::const_iterator it = candidates.begin();
-                 it != candidates.end();
-                 it++)
+            if (lo >= lb(d) && hi <= ub(d))
             {
-                if (0.0 <= *it && 1.0 >= *it)
-                {
-                    // Recover the actual time then get the acc squared norm
-                    tempNormSqr = getAcc((*it) * duration).squaredNorm();
-                    maxAccRateSqr = maxAccRateSqr < tempNormSqr ? tempNormSqr : maxAccRateSqr;
-                }
+                continue;
             }
-            return sqrt(maxAccRateSqr);
-        }
-    }
-
-    inline double getMaxJerkRate() const
-    {
-        // Compute normalized squared jerk norm polynomial coefficient matrix
-        Eigen::MatrixXd nJerkCoeffMat = getJerkCoeffMat(true);
-        Eigen::VectorXd coeff = RootFinder::polySqr(nJerkCoeffMat.row(0)) +
-                                RootFinder::polySqr(nJerkCoeffMat.row(1)) +
-                                RootFinder::polySqr(nJerkCoeffMat.row(2));
-        int N = coeff.size();
-        int n = N - 1;
-        for (int i = 0; i < N; i++)
-        {
-            coeff(i) *= n;
-            n--;
-        }
-        if (coeff.head(N - 1).squaredNorm() < DBL_EPSILON)
-        {
-            return 0.0;
-        }
-        else
-        {
-            // Search an open interval whose boundaries are not zeros
-            double l = -0.0625;
-            double r = 1.0625;
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), l)) < DBL_EPSILON)
+            // Ambiguous axis, check the values at its stationaries
+            double coeff[TrajOrder + 1];
+            double dcoeff[TrajOrder];
+            for (int i = 0; i <= TrajOrder; i++)
             {
-                l = 0.5 * l;
+                coeff[i] = nCoeffMat(d, i);
             }
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), r)) < DBL_EPSILON)
+            for (int i = 0; i < TrajOrder; i++)
             {
-                r = 0.5 * (r + 1.0);
+                dcoeff[i] = (TrajOrder - i) * coeff[i];
             }
-            // Find all stationaries
-            std::set<double> candidates = RootFinder::solvePolynomial(coeff.head(N - 1), l, r,
-                                                                      FLT_EPSILON / duration);
-            // Check boundary points and stationaries within duration
-            candidates.insert(0.0);
-            candidates.insert(1.0);
-            double maxJerkRateSqr = -INFINITY;
-            double tempNormSqr;
-            for (std::set<double>::const_iterator it = candidates.begin();
-                 it != candidates.end();
-                 it++)
+            double stationaries[TrajOrder - 1];
+            int num = RootFinder::solveFixedDegree<TrajOrder - 1>(dcoeff, 0.0, 1.0, FLT_EPSILON, stationaries);
+            double f, df;
+            for (int i = 0; i < num; i++)
             {
-                if (0.0 <= *it && 1.0 >= *it)
+                RootFinderPriv::polyEvalFixed<TrajOrder>(coeff, stationaries[i], f, df);
+                if (f < lb(d) || f > ub(d))
                 {
-                    // Recover the actual time then get the acc squared norm
-                    tempNormSqr = getJerk((*it) * duration).squaredNorm();
-                    maxJerkRateSqr = maxJerkRateSqr < tempNormSqr ? tempNormSqr : maxJerkRateSqr;
+                    return false;
                 }
             }
-            return sqrt(maxJerkRateSqr);
         }
+        return true;
     }
 
-    // Check whether velocity rate of the piece is always less than maxVelRate
-    inline bool checkMaxVelRate(double maxVelRate) const
+    //Scale the Piece(t) to Piece(k*t)
+    inline void scaleTime(double k)
     {
-        double sqrMaxVelRate = maxVelRate * maxVelRate;
-        if (getVel(0.0).squaredNorm() >= sqrMaxVelRate ||
-            getVel(duration).squaredNorm() >= sqrMaxVelRate)
-        {
-            return false;
-        }
-        else
-        {
-            Eigen::MatrixXd nVelCoeffMat = getVelCoeffMat(true);
-            Eigen::VectorXd coeff = RootFinder::polySqr(nVelCoeffMat.row(0)) +
-                                    RootFinder::polySqr(nVelCoeffMat.row(1)) +
-                                    RootFinder::polySqr(nVelCoeffMat.row(2));
-            // Convert the actual squared maxVelRate to a normalized one
-            double t2 = duration * duration;
-            coeff.tail<1>()(0) -= sqrMaxVelRate * t2;
-            // Directly check the root existence in the normalized interval
-            return RootFinder::countRoots(coeff, 0.0, 1.0) == 0;
-        }
+        duration /= k;
+        return;
     }
 
-    // Check whether accleration rate of the piece is always less than maxAccRate
-    inline bool checkMaxAccRate(double maxAccRate) const
+    // Evaluate the stamps samples.t in rows [offset, offset + n), which are
+    // shifted by tStart into the local time of this piece. Horner's scheme runs
+    // over all stamps of an axis at once, so Eigen vectorizes it
+    inline void evaluateBatch(int offset, int n, double tStart, TrajSamples &samples) const
     {
-        double sqrMaxAccRate = maxAccRate * maxAccRate;
-        if (getAcc(0.0).squaredNorm() >= sqrMaxAccRate ||
-            getAcc(duration).squaredNorm() >= sqrMaxAccRate)
+        auto tn = samples.tn.segment(offset, n);
+        tn = (samples.t.segment(offset, n) - tStart) / duration;
+        for (int d = 0; d < TrajDim; d++)
         {
-            return false;
-        }
-        else
-        {
-            Eigen::MatrixXd nAccCoeffMat = getAccCoeffMat(true);
-            Eigen::VectorXd coeff = RootFinder::polySqr(nAccCoeffMat.row(0)) +
-                                    RootFinder::polySqr(nAccCoeffMat.row(1)) +
-                                    RootFinder::polySqr(nAccCoeffMat.row(2));
-            // Convert the actual squared maxAccRate to a normalized one
-            double t2 = duration * duration;
-            double t4 = t2 * t2;
-            coeff.tail<1>()(0) -= sqrMaxAccRate * t4;
-            // Directly check the root existence in the normalized interval
-            return RootFinder::countRoots(coeff, 0.0, 1.0) == 0;
+            auto pos = samples.pos.col(d).segment(offset, n);
+            auto vel = samples.vel.col(d).segment(offset, n);
+            auto acc = samples.acc.col(d).segment(offset, n);
+            pos.setConstant(nCoeffMat(d, 0));
+            vel.setConstant(TrajOrder * nCoeffMat(d, 0));
+            acc.setConstant(TrajOrder * (TrajOrder - 1) * nCoeffMat(d, 0));
+            for (int i = 1; i <= TrajOrder; i++)
+            {
+                pos = pos * tn + nCoeffMat(d, i);
+                if (i < TrajOrder)
+                {
+                    vel = vel * tn + (TrajOrder - i) * nCoeffMat(d, i);
+                }
+                if (i < TrajOrder - 1)
+                {
+                    acc = acc * tn + (TrajOrder - i) * (TrajOrder - i - 1) * nCoeffMat(d, i);
+                }
+            }
+            // Recover the actual vel and acc
+            vel /= duration;
+            acc /= duration * duration;
         }
+        return;
     }
 
-    // Check whether jerk rate of the piece is always less than maxJerkRate
-    inline bool checkMaxJerkRate(double maxJerkRate) const
+    // Evaluate n stamps t0, t0 + dt, ... of this piece
+    inline void sampleBatch(double t0, double dt, int n, TrajSamples &samples) const
     {
-        double sqrMaxJerkRate = maxJerkRate * maxJerkRate;
-        if (getJerk(0.0).squaredNorm() >= sqrMaxJerkRate ||
-            getJerk(duration).squaredNorm() >= sqrMaxJerkRate)
+        samples.resize(n);
+        for (int i = 0; i < n; i++)
         {
-            return false;
-        }
-        else
-        {
-            Eigen::MatrixXd nJerkCoeffMat = getJerkCoeffMat(true);
-            Eigen::VectorXd coeff = RootFinder::polySqr(nJerkCoeffMat.row(0)) +
-                                    RootFinder::polySqr(nJerkCoeffMat.row(1)) +
-                                    RootFinder::polySqr(nJerkCoeffMat.row(2));
-            // Convert the actual squared maxJerkRate to a normalized one
-            double t2 = duration * duration;
-            double t4 = t2 * t2;
-            double t6 = t4 * t2;
-            coeff.tail<1>()(0) -= sqrMaxJerkRate * t6;
-            // Directly check the root existence in the normalized interval
-            return RootFinder::countRoots(coeff, 0.0, 1.0) == 0;
+            samples.t(i) = t0 + i * dt;
         }
+        evaluateBatch(0, n, 0.0, samples);
+        return;
     }
 
-    //Scale the Piece(t) to Piece(k*t)
-    inline void scaleTime(double k)
+    inline void sampleOneSeg(std::vector< StatePVA >* vis_x) const 
     {
-        duration /= k;
-        return;
+        TrajSamples samples;
+        sampleOneSeg(vis_x, samples);
     }
 
-    inline void sampleOneSeg(std::vector< StatePVA >* vis_x) const 
+    // Same as above, reusing the sample buffers of the caller
+    inline void sampleOneSeg(std::vector< StatePVA >* vis_x, TrajSamples &samples) const
     {
         double dt = 0.01;
-        for (double t = 0.0; t < duration; t += dt) 
+        sampleBatch(0.0, dt, (int)ceil(duration / dt), samples);
+        for (int i = 0; i < samples.size(); i++)
         {
-            Eigen::Vector3d pos, vel, acc;
-            pos = getPos(t);
-            vel = getVel(t);
-            acc = getAcc(t);
             StatePVA x;
-            x << pos(0), pos(1), pos(2), vel(0), vel(1), vel(2), acc(0), acc(1), acc(2);
+            x << samples.getPos(i), samples.getVel(i), samples.getAcc(i);
             vis_x->push_back(x);
         }
     }
@@ -557,23 +566,27 @@ public:
     inline double project_pt(const Eigen::Vector3d &pt,
                            double &tt, Eigen::Vector3d &pro_pt) {
         // 2*(p-p0)^T * \dot{p} = 0
-        auto l_coeff = getCoeffMat();
-        l_coeff.col(5) = l_coeff.col(5) - pt;
-        auto r_coeff = getVelCoeffMat();
-        Eigen::VectorXd eq = Eigen::VectorXd::Zero(2 * 5);
-        for (int j = 0; j < l_coeff.rows(); ++j) {
-            eq = eq + RootFinder::polyConv(l_coeff.row(j), r_coeff.row(j));
+        CoefficientMat l_coeff = getCoeffMat();
+        l_coeff.col(TrajOrder) = l_coeff.col(TrajOrder) - pt;
+        VelCoefficientMat r_coeff = getVelCoeffMat();
+        double eq[2 * TrajOrder] = {0.0};
+        for (int j = 0; j < TrajDim; ++j) {
+            for (int a = 0; a <= TrajOrder; ++a) {
+                for (int b = 0; b < TrajOrder; ++b) {
+                    eq[a + b] += l_coeff(j, a) * r_coeff(j, b);
+                }
+            }
         }
         double l = -0.0625;
         double r = duration + 0.0625;
-        while (fabs(RootFinder::polyVal(eq, l)) < DBL_EPSILON) {
+        while (fabs(RootFinderPriv::polyEval(eq, 2 * TrajOrder, l)) < DBL_EPSILON) {
             l = 0.5 * l;
         }
-        while (fabs(RootFinder::polyVal(eq, r)) < DBL_EPSILON) {
+        while (fabs(RootFinderPriv::polyEval(eq, 2 * TrajOrder, r)) < DBL_EPSILON) {
             r = 0.5 * (duration + r);
         }
-        std::set<double> roots =
-            RootFinder::solvePolynomial(eq, l, r, 1e-6);
+        const RootFinder::RootArray<2 * TrajOrder - 1> roots =
+            RootFinder::solvePolynomialFixed<2 * TrajOrder - 1>(eq, l, r, 1e-6);
         // std::cout << "# roots: " << roots.size() << std::endl;
         double min_dist = -1;
         for (const auto &root : roots) {
@@ -600,19 +613,22 @@ public:
                                    const Eigen::Vector3d v,
                                    double &tt, Eigen::Vector3d &pt) const {
         // (pt - p)^T * v = 0
-        auto coeff = getCoeffMat();
-        coeff.col(5) = coeff.col(5) - p;
-        Eigen::VectorXd eq = coeff.transpose() * v;
+        CoefficientMat coeff = getCoeffMat();
+        coeff.col(TrajOrder) = coeff.col(TrajOrder) - p;
+        double eq[TrajOrder + 1];
+        for (int i = 0; i <= TrajOrder; ++i) {
+            eq[i] = coeff.col(i).dot(v);
+        }
         double l = -0.0625;
         double r = duration + 0.0625;
-        while (fabs(RootFinder::polyVal(eq, l)) < DBL_EPSILON) {
+        while (fabs(RootFinderPriv::polyEval(eq, TrajOrder + 1, l)) < DBL_EPSILON) {
             l = 0.5 * l;
         }
-        while (fabs(RootFinder::polyVal(eq, r)) < DBL_EPSILON) {
+        while (fabs(RootFinderPriv::polyEval(eq, TrajOrder + 1, r)) < DBL_EPSILON) {
             r = 0.5 * (duration + r);
         }
-        std::set<double> roots =
-            RootFinder::solvePolynomial(eq, l, r, 1e-6);
+        const RootFinder::RootArray<TrajOrder> roots =
+            RootFinder::solvePolynomialFixed<TrajOrder>(eq, l, r, 1e-6);
         for (const auto &root : roots) {
             tt = root;
             pt = getPos(root);
@@ -621,6 +637,232 @@ public:
         return false;
     }
 
+private:
+    // Coefficients of the K-th derivative over the normalized interval,
+    // i.e. the rows of getVelCoeffMat(true) etc. for K = 1, 2, 3, kept on the stack
+    template <int K>
+    inline void normDeriCoeffs(double (&deri)[TrajDim][TrajOrder - K + 1]) const
+    {
+        for (int i = 0; i <= TrajOrder - K; i++)
+        {
+            double n = 1.0;
+            for (int k = 0; k < K; k++)
+            {
+                n *= TrajOrder - i - k;
+            }
+            for (int d = 0; d < TrajDim; d++)
+            {
+                deri[d][i] = n * nCoeffMat(d, i);
+            }
+        }
+        return;
+    }
+
+    // Bernstein coefficients of the K-th derivative over the normalized interval,
+    // ctrl_k = sum_{j<=k} C(k,j) / C(N,j) * a_j with a_j the coefficient of t^j
+    template <int K>
+    inline void normBernsteinCoeffs(double (&ctrl)[TrajDim][TrajOrder - K + 1]) const
+    {
+        double deri[TrajDim][TrajOrder - K + 1];
+        normDeriCoeffs<K>(deri);
+        powerToBernstein<TrajOrder - K>(deri, ctrl);
+        return;
+    }
+
+    template <int N>
+    static inline void powerToBernstein(const double (&deri)[TrajDim][N + 1], double (&ctrl)[TrajDim][N + 1])
+    {
+        for (int k = 0; k <= N; k++)
+        {
+            for (int d = 0; d < TrajDim; d++)
+            {
+                ctrl[d][k] = 0.0;
+            }
+            double ckj = 1.0, cnj = 1.0;
+            for (int j = 0; j <= k; j++)
+            {
+                double w = ckj / cnj;
+                for (int d = 0; d < TrajDim; d++)
+                {
+                    ctrl[d][k] += w * deri[d][N - j];
+                }
+                ckj = ckj * (k - j) / (j + 1);
+                cnj = cnj * (N - j) / (j + 1);
+            }
+        }
+        return;
+    }
+
+    // Conservative test of |d^K Piece / dt^K| < maxRate over the whole piece.
+    // The Bernstein coefficients of the squared norm are weighted means of the
+    // dot products of the control points and bound it from above.
+    // Returns 1 if all of them are below the limit, -1 if an end point
+    // violates it, and 0 if the hull cannot tell
+    template <int K>
+    inline int hullRateTest(double maxRate) const
+    {
+        constexpr int N = TrajOrder - K;
+        double deri[TrajDim][N + 1];
+        normDeriCoeffs<K>(deri);
+        // Convert the actual squared maxRate to a normalized one
+        double tk = 1.0;
+        for (int k = 0; k < K; k++)
+        {
+            tk *= duration;
+        }
+        double sqrMaxRate = maxRate * maxRate * tk * tk;
+
+        // The end points are the first and the last control points,
+        // test them before the conversion
+        double head = 0.0, tail = 0.0;
+        for (int d = 0; d < TrajDim; d++)
+        {
+            double sum = 0.0;
+            for (int i = 0; i <= N; i++)
+            {
+                sum += deri[d][i];
+            }
+            head += deri[d][N] * deri[d][N];
+            tail += sum * sum;
+        }
+        if (head >= sqrMaxRate || tail >= sqrMaxRate)
+        {
+            return -1;
+        }
+
+        double ctrl[TrajDim][N + 1];
+        powerToBernstein<N>(deri, ctrl);
+        double dots[N + 1][N + 1];
+        for (int i = 0; i <= N; i++)
+        {
+            for (int j = i; j <= N; j++)
+            {
+                dots[i][j] = 0.0;
+                for (int d = 0; d < TrajDim; d++)
+                {
+                    dots[i][j] += ctrl[d][i] * ctrl[d][j];
+                }
+            }
+        }
+
+        double binom[N + 1];
+        binom[0] = 1.0;
+        for (int i = 1; i <= N; i++)
+        {
+            binom[i] = binom[i - 1] * (N - i + 1) / i;
+        }
+        // The product has degree 2N, c_m = sum_{i+j=m} C(N,i) C(N,j) / C(2N,m) <b_i, b_j>
+        double binom2N = 1.0;
+        for (int m = 1; m < 2 * N; m++)
+        {
+            binom2N = binom2N * (2 * N - m + 1) / m;
+            double cm = 0.0;
+            for (int i = std::max(0, m - N); 2 * i <= m; i++)
+            {
+                int j = m - i;
+                cm += (i == j ? 1.0 : 2.0) * binom[i] * binom[j] * dots[i][j];
+            }
+            if (cm >= sqrMaxRate * binom2N)
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // Exact test of |d^K Piece / dt^K| < maxRate by Sturm root counting
+    template <int K>
+    inline bool sturmRateTest(double maxRate) const
+    {
+        double coeff[2 * (TrajOrder - K) + 1];
+        normSqrCoeffs<K>(maxRate, coeff);
+        return checkNegative<2 * (TrajOrder - K)>(coeff);
+    }
+
+    template <int K>
+    inline bool checkMaxRate(double maxRate) const
+    {
+        int hull = hullRateTest<K>(maxRate);
+        return hull > 0 || (hull == 0 && sturmRateTest<K>(maxRate));
+    }
+
+    // Coefficients of |d^K Piece / dt^K|^2 - maxRate^2 over the normalized interval
+    template <int K>
+    inline void normSqrCoeffs(double maxRate, double (&coeff)[2 * (TrajOrder - K) + 1]) const
+    {
+        double deri[TrajDim][TrajOrder - K + 1];
+        normDeriCoeffs<K>(deri);
+        for (int i = 0; i <= 2 * (TrajOrder - K); i++)
+        {
+            coeff[i] = 0.0;
+        }
+        for (int d = 0; d < TrajDim; d++)
+        {
+            RootFinder::polySqrAdd<TrajOrder - K>(deri[d], coeff);
+        }
+        // Convert the actual squared maxRate to a normalized one
+        double tk = 1.0;
+        for (int k = 0; k < K; k++)
+        {
+            tk *= duration;
+        }
+        coeff[2 * (TrajOrder - K)] -= maxRate * maxRate * tk * tk;
+        return;
+    }
+
+    // Whether coeff(0) < 0 and coeff(1) < 0
+    template <int N>
+    static inline bool boundsNegative(const double (&coeff)[N + 1])
+    {
+        double sum = 0.0;
+        for (int i = 0; i <= N; i++)
+        {
+            sum += coeff[i];
+        }
+        return coeff[N] < 0.0 && sum < 0.0;
+    }
+
+    // Whether coeff(t) < 0 for all t in [0, 1]
+    template <int N>
+    static inline bool checkNegative(const double (&coeff)[N + 1])
+    {
+        // Directly check the root existence in the normalized interval
+        return boundsNegative<N>(coeff) && RootFinder::countRootsFixed<N>(coeff, 0.0, 1.0) == 0;
+    }
+
+    // Max norm of the K-th derivative, found among the boundaries and the
+    // stationaries of its squared norm
+    template <int K>
+    inline double getMaxRate() const
+    {
+        constexpr int N = 2 * (TrajOrder - K);
+        double coeff[N + 1];
+        normSqrCoeffs<K>(0.0, coeff);
+        double dcoeff[N];
+        double sum = coeff[N];
+        for (int i = 0; i < N; i++)
+        {
+            dcoeff[i] = (N - i) * coeff[i];
+            sum += coeff[i];
+        }
+        double stationaries[N - 1];
+        int num = RootFinder::solveFixedDegree<N - 1>(dcoeff, 0.0, 1.0, FLT_EPSILON / duration, stationaries);
+
+        double maxRateSqr = std::max(coeff[N], sum);
+        double f, df;
+        for (int i = 0; i < num; i++)
+        {
+            RootFinderPriv::polyEvalFixed<N>(coeff, stationaries[i], f, df);
+            maxRateSqr = std::max(maxRateSqr, f);
+        }
+        // Recover the actual rate from the normalized one
+        double tk = 1.0;
+        for (int k = 0; k < K; k++)
+        {
+            tk *= duration;
+        }
+        return sqrt(maxRateSqr) / tk;
+    }
 };
 
 // 用中文介绍Trajectory类的成员函数
@@ -630,6 +872,22 @@ private:
     // 用Piece类的vector来存储整个轨迹
     typedef std::vector<Piece> Pieces;
     Pieces pieces;
+    // Start time of each piece, with the total duration appended, i.e.
+    // tStarts[i + 1] = tStarts[i] + pieces[i].getDuration().
+    // Kept up to date by every method that changes the pieces. Durations
+    // changed through the non-const operator[] are not tracked
+    std::vector<double> tStarts{0.0};
+
+    inline void rebuildStarts()
+    {
+        tStarts.resize(pieces.size() + 1);
+        tStarts[0] = 0.0;
+        for (size_t i = 0; i < pieces.size(); i++)
+        {
+            tStarts[i + 1] = tStarts[i] + pieces[i].getDuration();
+        }
+        return;
+    }
 
 public:
     Trajectory() = default;
@@ -644,8 +902,16 @@ public:
         {
             pieces.emplace_back(durs[i], coeffMats[i]);
         }
+        rebuildStarts();
     }
 
+    // Remembers the piece of the last query, so that monotonically
+    // increasing queries, e.g. from a tracking loop, do not search at all
+    struct Cursor
+    {
+        int idx = 0;
+    };
+
     inline int getPieceNum() const
     {
         return pieces.size();
@@ -666,12 +932,13 @@ public:
     // Get total duration of the trajectory
     inline double getTotalDuration() const
     {
-        double totalDuration = 0.0;
-        for (int i = 0; i < getPieceNum(); i++)
-        {
-            totalDuration += pieces[i].getDuration();
-        }
-        return totalDuration;
+        return tStarts.back();
+    }
+
+    // Get the start time of the i-th piece, i = getPieceNum() gives the total duration
+    inline double getPieceStartTime(int i) const
+    {
+        return tStarts[i];
     }
 
     // Reload the operator[] to reach the i-th piece
@@ -688,6 +955,7 @@ public:
     inline void clear(void)
     {
         pieces.clear();
+        tStarts.assign(1, 0.0);
     }
 
     inline Pieces::const_iterator begin() const
@@ -703,6 +971,7 @@ public:
     inline void reserve(const int &n)
     {
         pieces.reserve(n);
+        tStarts.reserve(n + 1);
         return;
     }
 
@@ -710,6 +979,7 @@ public:
     inline void emplace_back(const Piece &piece)
     {
         pieces.emplace_back(piece);
+        tStarts.push_back(tStarts.back() + piece.getDuration());
         return;
     }
 
@@ -718,6 +988,7 @@ public:
     inline void emplace_back(const ArgTypeL &argL, const ArgTypeR &argR)
     {
         pieces.emplace_back(argL, argR);
+        tStarts.push_back(tStarts.back() + pieces.back().getDuration());
         return;
     }
 
@@ -725,28 +996,93 @@ public:
     inline void append(const Trajectory &traj)
     {
         pieces.insert(pieces.end(), traj.begin(), traj.end());
+        rebuildStarts();
         return;
     }
 
     // Find the piece at which the time t is located
     // The index is returned and the offset in t is removed
+    // A time on a junction belongs to the earlier piece, times out of
+    // the trajectory to the first or the last piece
     inline int locatePieceIdx(double &t) const
     {
-        int idx;
-        double dur;
-        for (idx = 0;
-             idx < getPieceNum() &&
-             t > (dur = pieces[idx].getDuration());
-             idx++)
+        if (pieces.empty())
+        {
+            return -1;
+        }
+        // Binary search over the end times of all but the last piece
+        int idx = std::lower_bound(tStarts.begin() + 1, tStarts.end() - 1, t) - (tStarts.begin() + 1);
+        t -= tStarts[idx];
+        return idx;
+    }
+
+    // Same as above, starting from the piece of the last query
+    // Moving forward is a linear walk, a query back in time falls back to the binary search
+    inline int locatePieceIdx(double &t, Cursor &cursor) const
+    {
+        int last = getPieceNum() - 1;
+        if (cursor.idx > last || cursor.idx < 0 || (cursor.idx > 0 && t <= tStarts[cursor.idx]))
         {
-            t -= dur;
+            cursor.idx = locatePieceIdx(t);
+            return cursor.idx;
         }
-        if (idx == getPieceNum())
+        while (cursor.idx < last && t > tStarts[cursor.idx + 1])
         {
-            idx--;
-            t += pieces[idx].getDuration();
+            cursor.idx++;
         }
-        return idx;
+        t -= tStarts[cursor.idx];
+        return cursor.idx;
+    }
+
+    // Evaluate the sorted stamps samples.t(0 .. samples.size() - 1)
+    // The piece cursor only moves forward, following the rule of locatePieceIdx()
+    inline void evaluateBatch(TrajSamples &samples) const
+    {
+        int n = samples.size();
+        int last = getPieceNum() - 1;
+        if (last < 0)
+        {
+            return;
+        }
+        Cursor cursor;
+        for (int i = 0; i < n;)
+        {
+            double t = samples.t(i);
+            int idx = locatePieceIdx(t, cursor);
+            int j = i + 1;
+            while (j < n && (idx == last || samples.t(j) <= tStarts[idx + 1]))
+            {
+                j++;
+            }
+            pieces[idx].evaluateBatch(i, j - i, tStarts[idx], samples);
+            i = j;
+        }
+        return;
+    }
+
+    // Evaluate n stamps t0, t0 + dt, ... of the trajectory
+    inline void sampleBatch(double t0, double dt, int n, TrajSamples &samples) const
+    {
+        samples.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            samples.t(i) = t0 + i * dt;
+        }
+        evaluateBatch(samples);
+        return;
+    }
+
+    // Evaluate the sorted stamps ts of the trajectory
+    inline void sampleBatch(const std::vector<double> &ts, TrajSamples &samples) const
+    {
+        int n = ts.size();
+        samples.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            samples.t(i) = ts[i];
+        }
+        evaluateBatch(samples);
+        return;
     }
 
     // Get the position at time t of the trajectory
@@ -770,6 +1106,25 @@ public:
         return pieces[pieceIdx].getAcc(t);
     }
 
+    // Getters for monotonically increasing t, see Cursor
+    inline Eigen::Vector3d getPos(double t, Cursor &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getPos(t);
+    }
+
+    inline Eigen::Vector3d getVel(double t, Cursor &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getVel(t);
+    }
+
+    inline Eigen::Vector3d getAcc(double t, Cursor &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getAcc(t);
+    }
+
     // Get the position at the juncIdx-th waypoint
     inline Eigen::Vector3d getJuncPos(int juncIdx) const
     {
@@ -888,14 +1243,16 @@ public:
         {
             pieces[i].scaleTime(k);
         }
+        rebuildStarts();
     }
 
     inline void sampleWholeTrajectory(std::vector< StatePVA >* vis_x) const 
     {
+        TrajSamples samples;
         int n = getPieceNum();
         for (int i = 0; i < n; ++i)
         {
-            pieces[i].sampleOneSeg(vis_x);
+            pieces[i].sampleOneSeg(vis_x, samples);
         }
     }
     
@@ -0,0 +1,214 @@
+// Heap allocations and time of Piece::project_pt() and Piece::intersection_plane(), which solve
+// with RootFinder::solvePolynomialFixed(), against the VectorXd / std::set path they replaced,
+// plus solvePolynomial() against solvePolynomialFixed() on random degree 9 polynomials.
+// Allocations are counted by interposing malloc, so this needs glibc.
+// Returns 1 if the two paths disagree.
+//   rosrun poly_traj_utils root_finder_alloc_bench
+#include "poly_traj_utils/traj_utils.hpp"
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+
+static long malloc_calls = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+  ++malloc_calls;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+  ++malloc_calls;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  ++malloc_calls;
+  return __libc_realloc(ptr, size);
+}
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double usSince(const Clock::time_point &t)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - t).count();
+}
+
+// Piece::project_pt() before it moved to the fixed capacity solver
+static double legacyProjectPt(const Piece &piece, const Eigen::Vector3d &pt, double &tt, Eigen::Vector3d &pro_pt)
+{
+  double duration = piece.getDuration();
+  auto l_coeff = piece.getCoeffMat();
+  l_coeff.col(5) = l_coeff.col(5) - pt;
+  auto r_coeff = piece.getVelCoeffMat();
+  Eigen::VectorXd eq = Eigen::VectorXd::Zero(2 * 5);
+  for (int j = 0; j < l_coeff.rows(); ++j)
+    eq = eq + RootFinder::polyConv(l_coeff.row(j), r_coeff.row(j));
+  double l = -0.0625;
+  double r = duration + 0.0625;
+  while (fabs(RootFinder::polyVal(eq, l)) < DBL_EPSILON)
+    l = 0.5 * l;
+  while (fabs(RootFinder::polyVal(eq, r)) < DBL_EPSILON)
+    r = 0.5 * (duration + r);
+  std::set<double> roots = RootFinder::solvePolynomial(eq, l, r, 1e-6);
+  double min_dist = -1;
+  for (const auto &root : roots)
+  {
+    if (root < 0 || root > duration)
+      continue;
+    if (piece.getVel(root).norm() < 1e-6)
+      continue;
+    Eigen::Vector3d p = piece.getPos(root);
+    double distance = (p - pt).norm();
+    if (distance < min_dist || min_dist < 0)
+    {
+      min_dist = distance;
+      tt = root;
+      pro_pt = p;
+    }
+  }
+  return min_dist;
+}
+
+// Piece::intersection_plane() before it moved to the fixed capacity solver
+static bool legacyIntersectionPlane(const Piece &piece, const Eigen::Vector3d &p, const Eigen::Vector3d &v,
+                                    double &tt, Eigen::Vector3d &pt)
+{
+  double duration = piece.getDuration();
+  auto coeff = piece.getCoeffMat();
+  coeff.col(5) = coeff.col(5) - p;
+  Eigen::VectorXd eq = coeff.transpose() * v;
+  double l = -0.0625;
+  double r = duration + 0.0625;
+  while (fabs(RootFinder::polyVal(eq, l)) < DBL_EPSILON)
+    l = 0.5 * l;
+  while (fabs(RootFinder::polyVal(eq, r)) < DBL_EPSILON)
+    r = 0.5 * (duration + r);
+  std::set<double> roots = RootFinder::solvePolynomial(eq, l, r, 1e-6);
+  for (const auto &root : roots)
+  {
+    tt = root;
+    pt = piece.getPos(root);
+    return true;
+  }
+  return false;
+}
+
+int main()
+{
+  const int n_pieces = 20000;
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> rand_unit(-1.0, 1.0), rand_dur(0.5, 3.0);
+
+  std::vector<Piece> pieces;
+  std::vector<Eigen::Vector3d> pts, plane_pts, plane_dirs;
+  pieces.reserve(n_pieces);
+  for (int i = 0; i < n_pieces; ++i)
+  {
+    CoefficientMat coeff;
+    for (int r = 0; r < TrajDim; ++r)
+      for (int c = 0; c <= TrajOrder; ++c)
+        coeff(r, c) = rand_unit(gen) * (c == TrajOrder ? 5.0 : 1.0);
+    Piece piece(rand_dur(gen), coeff);
+    pieces.push_back(piece);
+    Eigen::Vector3d mid = piece.getPos(piece.getDuration() / 2);
+    pts.push_back(mid + Eigen::Vector3d(rand_unit(gen), rand_unit(gen), rand_unit(gen)));
+    plane_pts.push_back(mid);
+    plane_dirs.push_back(Eigen::Vector3d(rand_unit(gen), rand_unit(gen), rand_unit(gen)).normalized());
+  }
+
+  /* projection and plane intersection, old path then the current one */
+  std::vector<double> legacy_t(2 * n_pieces), fixed_t(2 * n_pieces);
+  long calls = malloc_calls;
+  auto t = Clock::now();
+  for (int i = 0; i < n_pieces; ++i)
+  {
+    Eigen::Vector3d pt;
+    if (legacyProjectPt(pieces[i], pts[i], legacy_t[2 * i], pt) < 0)
+      legacy_t[2 * i] = -1.0;
+    if (!legacyIntersectionPlane(pieces[i], plane_pts[i], plane_dirs[i], legacy_t[2 * i + 1], pt))
+      legacy_t[2 * i + 1] = -1.0;
+  }
+  double legacy_us = usSince(t);
+  long legacy_mallocs = malloc_calls - calls;
+
+  calls = malloc_calls;
+  t = Clock::now();
+  for (int i = 0; i < n_pieces; ++i)
+  {
+    Eigen::Vector3d pt;
+    if (pieces[i].project_pt(pts[i], fixed_t[2 * i], pt) < 0)
+      fixed_t[2 * i] = -1.0;
+    if (!pieces[i].intersection_plane(plane_pts[i], plane_dirs[i], fixed_t[2 * i + 1], pt))
+      fixed_t[2 * i + 1] = -1.0;
+  }
+  double fixed_us = usSince(t);
+  long fixed_mallocs = malloc_calls - calls;
+
+  int t_differ = 0;
+  double max_dt = 0.0;
+  for (int i = 0; i < 2 * n_pieces; ++i)
+  {
+    double dt = std::fabs(legacy_t[i] - fixed_t[i]);
+    max_dt = std::max(max_dt, dt);
+    // both paths solve to 1e-6
+    if (dt > 1e-5)
+      ++t_differ;
+  }
+  printf("project_pt + intersection_plane, %d pieces:\n", n_pieces);
+  printf("  std::set path: %ld mallocs (%.1f per piece), %.3f us per piece\n",
+         legacy_mallocs, (double)legacy_mallocs / n_pieces, legacy_us / n_pieces);
+  printf("  fixed path:    %ld mallocs (%.1f per piece), %.3f us per piece\n",
+         fixed_mallocs, (double)fixed_mallocs / n_pieces, fixed_us / n_pieces);
+  printf("  t differs in %d of %d calls, max |dt| %.3g\n", t_differ, 2 * n_pieces, max_dt);
+
+  /* random degree 9 polynomials on [-1, 1] */
+  const int n_polys = 20000;
+  std::vector<std::array<double, 10>> polys(n_polys);
+  for (auto &p : polys)
+    for (double &c : p)
+      c = rand_unit(gen);
+  int sets_differ = 0;
+  long generic_mallocs = 0, fixed_poly_mallocs = 0;
+  double generic_us = 0.0, fixed_poly_us = 0.0;
+  for (const auto &p : polys)
+  {
+    Eigen::VectorXd coeffs = Eigen::Map<const Eigen::VectorXd>(p.data(), 10);
+    calls = malloc_calls;
+    t = Clock::now();
+    std::set<double> generic = RootFinder::solvePolynomial(coeffs, -1.0, 1.0, 1e-9);
+    generic_us += usSince(t);
+    generic_mallocs += malloc_calls - calls;
+
+    double c[10];
+    std::copy(p.begin(), p.end(), c);
+    calls = malloc_calls;
+    t = Clock::now();
+    RootFinder::RootArray<9> fixed = RootFinder::solvePolynomialFixed<9>(c, -1.0, 1.0, 1e-9);
+    fixed_poly_us += usSince(t);
+    fixed_poly_mallocs += malloc_calls - calls;
+
+    bool same = (int)generic.size() == fixed.size();
+    int k = 0;
+    for (auto it = generic.begin(); same && it != generic.end(); ++it, ++k)
+      same = std::fabs(*it - fixed[k]) < 1e-6;
+    if (!same)
+      ++sets_differ;
+  }
+  printf("degree 9 polynomials, %d:\n", n_polys);
+  printf("  solvePolynomial:         %ld mallocs (%.1f per call), %.3f us per call\n",
+         generic_mallocs, (double)generic_mallocs / n_polys, generic_us / n_polys);
+  printf("  solvePolynomialFixed<9>: %ld mallocs (%.1f per call), %.3f us per call\n",
+         fixed_poly_mallocs, (double)fixed_poly_mallocs / n_polys, fixed_poly_us / n_polys);
+  printf("  root sets differ for %d of %d\n", sets_differ, n_polys);
+
+  return (t_differ == 0 && sets_differ == 0) ? 0 : 1;
+}